@@ -0,0 +1,106 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "backend.h"
+#include "xcl_img.h"
+#include "xcl_stream.h"
+#include "xmalloc.h"
+
+int backend_parse(const char *name, backend_type_t *type)
+{
+	assert(name != NULL);
+	assert(type != NULL);
+
+	if (strcmp(name, "auto") == 0)
+		*type = BACKEND_AUTO;
+	else if (strcmp(name, "opencl") == 0)
+		*type = BACKEND_OPENCL;
+	else if (strcmp(name, "native") == 0)
+		*type = BACKEND_NATIVE;
+	else
+		return RET_ERR;
+
+	return RET_OK;
+}
+
+/* takes over a runtime with a built program */
+struct backend *backend_opencl(struct clrt *rt)
+{
+	struct backend *be;
+
+	assert(rt != NULL);
+
+	be = xmalloc0(sizeof(*be));
+	be->type = BACKEND_OPENCL;
+	be->name = "opencl";
+	be->rt = rt;
+
+	return be;
+}
+
+/* takes over runtimes with built programs, work is spread over all of them */
+struct backend *backend_opencl_multi(struct clrt **rts, int n)
+{
+	struct backend *be;
+
+	assert(rts != NULL);
+	assert(n > 0);
+
+	be = xmalloc0(sizeof(*be));
+	be->type = BACKEND_OPENCL;
+	be->name = "opencl";
+	be->sched = xcl_sched_new(rts, n);
+	be->rt = rts[0];
+
+	return be;
+}
+
+/* `nthreads' <= 0 uses every online CPU */
+struct backend *backend_native(int nthreads)
+{
+	struct backend *be;
+
+	be = xmalloc0(sizeof(*be));
+	be->type = BACKEND_NATIVE;
+	be->name = "native";
+	be->nt = native_new(nthreads);
+
+	return be;
+}
+
+void backend_run(struct backend *be, struct pipeline *pl, struct img_ctx *src, struct img_ctx *dst)
+{
+	assert(be != NULL);
+
+	switch (be->type) {
+	case BACKEND_OPENCL:
+		if (be->sched != NULL)
+			xcl_sched_rows(be->sched, pl, src, dst, be->band);
+		else
+			xcl_stream_run(be->rt, pl, src, dst, be->band);
+		break;
+	case BACKEND_NATIVE:
+		native_pipeline_run(be->nt, pl, src, dst);
+		break;
+	default:
+		fprintf(stderr, "error: unknown backend %d\n", be->type);
+		abort();
+	}
+}
+
+void backend_destroy(struct backend *be)
+{
+	assert(be != NULL);
+
+	/* the scheduler owns the runtime of its first device */
+	if (be->sched != NULL)
+		xcl_sched_destroy(be->sched);
+	else if (be->rt != NULL)
+		clrt_destroy(be->rt);
+	if (be->nt != NULL)
+		native_destroy(be->nt);
+
+	xfree(be);
+}
@@ -0,0 +1,33 @@
+#ifndef BACKEND_H_
+#define BACKEND_H_
+
+#include "img.h"
+#include "pipeline.h"
+#include "clrt.h"
+#include "native.h"
+#include "xcl_sched.h"
+
+typedef enum {
+	BACKEND_AUTO = 0,	/* OpenCL if there is a platform, native otherwise */
+	BACKEND_OPENCL,
+	BACKEND_NATIVE
+} backend_type_t;
+
+/* where a pipeline runs, the same stages give the same result on both */
+struct backend {
+	backend_type_t type;
+	const char *name;
+	struct clrt *rt;	/* BACKEND_OPENCL, the first device with a scheduler */
+	struct xcl_sched *sched;	/* BACKEND_OPENCL on several devices */
+	struct native *nt;	/* BACKEND_NATIVE */
+	int band;		/* OpenCL rows per band, 0 only splits what does not fit */
+};
+
+int backend_parse(const char *name, backend_type_t *type);
+struct backend *backend_opencl(struct clrt *rt);
+struct backend *backend_opencl_multi(struct clrt **rts, int n);
+struct backend *backend_native(int nthreads);
+void backend_run(struct backend *be, struct pipeline *pl, struct img_ctx *src, struct img_ctx *dst);
+void backend_destroy(struct backend *be);
+
+#endif /* BACKEND_H_ */
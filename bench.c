@@ -0,0 +1,722 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <assert.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include <CL/cl.h>
+
+#include "img.h"
+#include "img_utils.h"
+#include "img_simd.h"
+#include "clrt.h"
+#include "cltune.h"
+#include "xcl_img.h"
+#include "xcl_stream.h"
+#include "xcl_sched.h"
+#include "native.h"
+#include "pipeline.h"
+#include "xmalloc.h"
+
+struct bench_size {
+	const char *name;
+	int w;
+	int h;
+};
+
+/* sizes past `-m' (8K by default) are skipped */
+static struct bench_size sizes[] = {
+	{ "VGA", 640, 480 },
+	{ "XGA", 1024, 768 },
+	{ "QXGA", 2048, 1536 },
+	{ "4K", 4096, 2048 },
+	{ "8K", 8192, 4096 },
+	{ "16K", 16384, 8192 },
+};
+
+#define NSIZES (sizeof(sizes)/sizeof(sizes[0]))
+
+/* sigma of the separable blur case */
+#define BENCH_SIGMA 2.0f
+
+/* blurs of the repeated blur case */
+#define BENCH_PASSES 4
+
+/* rows per band of the streaming check */
+#define STREAM_BAND 256
+
+/* kernel variant of a case, `border' < 0 if its result is not comparable */
+struct bench_variant {
+	variant_t variant;
+	const char *name;
+	int border;
+};
+
+/*
+ * One stage as benchmarked. The serial scalar `ref' gives the reference
+ * result and time, the native backend runs at every SIMD level and the
+ * OpenCL backend with each of `variants'.
+ */
+struct bench_case {
+	const char *name;
+	stage_type_t type;
+	float sigma;
+	img_type_t in;
+	int (*ref)(struct img_ctx *src, struct img_ctx *dst);
+	struct bench_variant variants[3];
+	int nvariants;
+	border_type_t edges;	/* what the 5x5 blur reads past them */
+	const char *mask;	/* convolve: built-in mask, `ref' is img_convolve() */
+	int passes;		/* times the stage is applied, 0 is once */
+};
+
+/* what one timed call runs */
+struct bench_job {
+	struct bench_case *bc;
+	struct pipeline *pl;
+	struct img_ctx *src;
+	struct img_ctx *dst;
+	struct clrt *rt;
+	struct native *nt;
+};
+
+struct bench_stat {
+	double median;
+	double p95;
+};
+
+static double now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec*1e3 + ts.tv_nsec/1e6;
+}
+
+/* deterministic noise over a gradient, so blurring does real work */
+static struct img_ctx *synthetic_gray(int w, int h)
+{
+	struct img_ctx *ctx;
+	unsigned int seed;
+	int x, y;
+
+	ctx = img_ctx_new_flags(w, h, TYPE_GRAY, C_NONE, IMG_F_NOZERO);
+	seed = 2463534242U;
+
+	for (y = 0; y < h; y++) {
+		for (x = 0; x < w; x++) {
+			seed ^= seed << 13;
+			seed ^= seed >> 17;
+			seed ^= seed << 5;
+			ctx->pix[y*w + x] = ((x + y) & 0xff)/2 + (seed & 0x7f);
+		}
+	}
+
+	return ctx;
+}
+
+static struct img_ctx *synthetic_rgb(int w, int h)
+{
+	struct img_ctx *ctx, *noise;
+	int i;
+
+	ctx = img_ctx_new_flags(w, h, TYPE_RGB, C_NONE, IMG_F_NOZERO);
+	noise = synthetic_gray(w, h);
+
+	for (i = 0; i < w*h; i++) {
+		ctx->r[i] = noise->pix[i];
+		ctx->g[i] = noise->pix[i] ^ 0x5a;
+		ctx->b[i] = ~noise->pix[i];
+	}
+
+	img_destroy_ctx(noise);
+
+	return ctx;
+}
+
+/* interleave into pixbuf style rows padded to 4 bytes */
+static struct img_ctx *packed_copy(struct img_ctx *rgb, unsigned char **mem)
+{
+	int x, y, pitch;
+	unsigned char *p;
+
+	pitch = (rgb->w*3 + 3) & ~3;
+	*mem = xmalloc(pitch*rgb->h);
+
+	for (y = 0; y < rgb->h; y++) {
+		p = *mem + y*pitch;
+		for (x = 0; x < rgb->w; x++) {
+			p[0] = rgb->r[y*rgb->pitch + x];
+			p[1] = rgb->g[y*rgb->pitch + x];
+			p[2] = rgb->b[y*rgb->pitch + x];
+			p += 3;
+		}
+	}
+
+	return img_ctx_wrap(*mem, rgb->w, rgb->h, pitch, 3);
+}
+
+/* pixels that differ, ignoring the `border' outermost rows and columns */
+static long compare(struct img_ctx *a, struct img_ctx *b, int border)
+{
+	long diff;
+	int x, y;
+
+	diff = 0;
+
+	for (y = border; y < a->h - border; y++) {
+		for (x = border; x < a->w - border; x++) {
+			if (a->pix[y*a->pitch + x] != b->pix[y*b->pitch + x])
+				diff++;
+		}
+	}
+
+	return diff;
+}
+
+
+static int blur_sep(struct img_ctx *src, struct img_ctx *dst, border_type_t border)
+{
+	float *wt, *tmp;
+	int radius;
+
+	radius = img_gauss_radius(BENCH_SIGMA);
+	wt = img_gauss_kernel1d(BENCH_SIGMA, radius);
+	tmp = xmalloc(src->w*src->h*sizeof(*tmp));
+
+	img_blur_h_rows(src, tmp, wt, radius, border, 0, src->h);
+	img_blur_v_rows(src, tmp, dst, wt, radius, border, 0, dst->h);
+
+	xfree(tmp);
+	xfree(wt);
+
+	return RET_OK;
+}
+
+static int ref_blur_sep(struct img_ctx *src, struct img_ctx *dst)
+{
+	return blur_sep(src, dst, BORDER_COPY);
+}
+
+static int ref_blur_sep_mirror(struct img_ctx *src, struct img_ctx *dst)
+{
+	return blur_sep(src, dst, BORDER_MIRROR);
+}
+
+static int ref_blur_mirror(struct img_ctx *src, struct img_ctx *dst)
+{
+	img_gaussian_blur_rows(src, dst, BORDER_MIRROR, 0, src->h);
+
+	return RET_OK;
+}
+
+static int ref_blur_passes(struct img_ctx *src, struct img_ctx *dst)
+{
+	return img_gaussian_blur_passes(src, dst, BENCH_PASSES);
+}
+
+static int ref_canny(struct img_ctx *src, struct img_ctx *dst)
+{
+	return img_canny(src, dst, CANNY_LOW, CANNY_HIGH);
+}
+
+static int ref_otsu(struct img_ctx *src, struct img_ctx *dst)
+{
+	return img_otsu_threshold(src, dst) < 0 ? RET_ERR : RET_OK;
+}
+
+static struct bench_case cases[] = {
+	{ "grayscale", STAGE_GRAYSCALE, 0, TYPE_RGB, img_grayscale,
+	  { { VARIANT_NAIVE, "double", -1 }, { VARIANT_VEC16, "vec16", 0 }, { VARIANT_AUTO, "auto", 0 } }, 3 },
+	{ "gray-pack", STAGE_GRAYSCALE, 0, TYPE_PACKED, img_grayscale,
+	  { { VARIANT_AUTO, "packed", 0 } }, 1 },
+	{ "blur5x5", STAGE_GAUSSIAN_BLUR, 0, TYPE_GRAY, img_gaussian_blur,
+	  { { VARIANT_NAIVE, "naive", 0 }, { VARIANT_TILED, "tiled", 0 }, { VARIANT_IMAGE, "image", 0 } }, 3 },
+	{ "mirror5x5", STAGE_GAUSSIAN_BLUR, 0, TYPE_GRAY, ref_blur_mirror,
+	  { { VARIANT_NAIVE, "naive", 0 }, { VARIANT_TILED, "tiled", 0 }, { VARIANT_IMAGE, "image", 0 } }, 3,
+	  BORDER_MIRROR },
+	{ "blur5x5x4", STAGE_GAUSSIAN_BLUR, 0, TYPE_GRAY, ref_blur_passes,
+	  { { VARIANT_NAIVE, "naive", 0 }, { VARIANT_TILED, "tiled", 0 } }, 2,
+	  BORDER_COPY, NULL, BENCH_PASSES },
+	{ "blur-sep", STAGE_GAUSSIAN_BLUR, BENCH_SIGMA, TYPE_GRAY, ref_blur_sep,
+	  { { VARIANT_AUTO, "separable", 0 } }, 1 },
+	{ "mirror-sep", STAGE_GAUSSIAN_BLUR, BENCH_SIGMA, TYPE_GRAY, ref_blur_sep_mirror,
+	  { { VARIANT_AUTO, "separable", 0 } }, 1, BORDER_MIRROR },
+	{ "box5", STAGE_CONVOLVE, 0, TYPE_GRAY, NULL,
+	  { { VARIANT_AUTO, "separable", 0 }, { VARIANT_NAIVE, "naive", 0 }, { VARIANT_TILED, "tiled", 0 } }, 3,
+	  BORDER_COPY, "box5" },
+	{ "sharpen", STAGE_CONVOLVE, 0, TYPE_GRAY, NULL,
+	  { { VARIANT_NAIVE, "naive", 0 }, { VARIANT_TILED, "tiled", 0 } }, 2,
+	  BORDER_COPY, "sharpen" },
+	{ "canny", STAGE_CANNY, 0, TYPE_GRAY, ref_canny,
+	  { { VARIANT_AUTO, "-", 0 } }, 1 },
+	{ "otsu", STAGE_OTSU, 0, TYPE_GRAY, ref_otsu,
+	  { { VARIANT_AUTO, "-", 0 } }, 1 },
+};
+
+#define NCASES (sizeof(cases)/sizeof(cases[0]))
+
+static void run_ref(void *arg)
+{
+	struct bench_job *job = arg;
+
+	if (job->bc->mask != NULL)
+		img_convolve(job->src, job->dst, job->pl->stages[0].conv, job->bc->edges);
+	else
+		job->bc->ref(job->src, job->dst);
+}
+
+static void run_native(void *arg)
+{
+	struct bench_job *job = arg;
+
+	native_pipeline_run(job->nt, job->pl, job->src, job->dst);
+}
+
+/* end to end, uploads and downloads included */
+static void run_opencl(void *arg)
+{
+	struct bench_job *job = arg;
+
+	xcl_pipeline_run(job->rt, job->pl, job->src, job->dst);
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+/* median and nearest rank 95th percentile of `iters' calls after `warmup' */
+static void bench_time(void (*fn)(void *), void *arg, int warmup, int iters, struct bench_stat *st)
+{
+	double *t, t0;
+	int i;
+
+	for (i = 0; i < warmup; i++)
+		fn(arg);
+
+	t = xmalloc(iters*sizeof(*t));
+
+	for (i = 0; i < iters; i++) {
+		t0 = now_ms();
+		fn(arg);
+		t[i] = now_ms() - t0;
+	}
+
+	qsort(t, iters, sizeof(*t), cmp_double);
+
+	st->median = iters%2 ? t[iters/2] : (t[iters/2 - 1] + t[iters/2])/2;
+	st->p95 = t[(95*iters + 99)/100 - 1];
+
+	xfree(t);
+}
+
+/* bytes a stage has to read and write at least */
+static double bench_bytes(struct img_ctx *src)
+{
+	double in;
+
+	switch (src->type) {
+	case TYPE_RGB:
+		in = 3.0*src->w*src->h;
+		break;
+	case TYPE_PACKED:
+		in = (double)src->pitch*src->h;
+		break;
+	default:
+		in = (double)src->w*src->h;
+		break;
+	}
+
+	return in + (double)src->w*src->h;
+}
+
+/* pixels that differ from the reference over every run, any fails the bench */
+static long mismatches;
+
+static void bench_row(struct bench_size *sz, struct bench_case *bc, const char *backend,
+		      const char *variant, struct bench_stat *st, struct img_ctx *src, long diff)
+{
+	double mpix;
+
+	mpix = sz->w*(double)sz->h/1e6;
+
+	printf("%-6s %-10s %-8s %-10s %10.3f %10.3f %10.1f %8.2f ", sz->name, bc->name, backend,
+	       variant, st->median, st->p95, mpix/(st->median/1e3),
+	       bench_bytes(src)/1e9/(st->median/1e3));
+
+	if (diff < 0) {
+		printf("%8s\n", "-");
+	} else {
+		printf("%8ld\n", diff);
+		mismatches += diff;
+	}
+}
+
+/*
+ * Every case at one size: the scalar reference first, then the native
+ * backend at each SIMD level and OpenCL with each kernel variant, all
+ * compared against the reference.
+ */
+static void bench_size(struct bench_size *sz, struct clrt *rt, struct native *nt, int warmup,
+		       int iters)
+{
+	struct img_ctx *rgb, *packed, *gray, *ref, *out, *src;
+	struct bench_case *bc;
+	struct bench_job job;
+	struct bench_stat st;
+	struct pipeline pl;
+	struct stage stage;
+	struct conv *conv;
+	simd_level_t levels[SIMD_NEON + 1], best, level;
+	unsigned char *mem;
+	size_t i;
+	int j, nlevels;
+
+	rgb = synthetic_rgb(sz->w, sz->h);
+	packed = packed_copy(rgb, &mem);
+	gray = synthetic_gray(sz->w, sz->h);
+	ref = img_ctx_new(sz->w, sz->h, TYPE_GRAY, C_NONE);
+	out = img_ctx_new(sz->w, sz->h, TYPE_GRAY, C_NONE);
+
+	/* every level the CPU has up to the current one */
+	best = img_simd_level();
+	nlevels = 0;
+	for (level = SIMD_NONE; level <= best; level++) {
+		if (img_simd_has(level))
+			levels[nlevels++] = level;
+	}
+
+	pl.stages = &stage;
+	pl.nstages = 1;
+
+	for (i = 0; i < NCASES; i++) {
+		bc = &cases[i];
+		src = bc->in == TYPE_RGB ? rgb : (bc->in == TYPE_PACKED ? packed : gray);
+
+		memset(&stage, 0, sizeof(stage));
+		stage.type = bc->type;
+		stage.sigma = bc->sigma;
+		stage.border = bc->edges;
+		stage.passes = bc->passes;
+		conv = bc->mask != NULL ? conv_builtin(bc->mask) : NULL;
+		stage.conv = conv;
+
+		memset(&job, 0, sizeof(job));
+		job.bc = bc;
+		job.pl = &pl;
+		job.src = src;
+		job.rt = rt;
+		job.nt = nt;
+
+		/* the planar reference, packed input has none */
+		job.src = bc->in == TYPE_PACKED ? rgb : src;
+		job.dst = ref;
+		img_simd_set(SIMD_NONE);
+		bench_time(run_ref, &job, warmup, iters, &st);
+		bench_row(sz, bc, "ref", "scalar", &st, job.src, -1);
+		job.src = src;
+
+		job.dst = out;
+		for (j = 0; j < nlevels; j++) {
+			img_simd_set(levels[j]);
+			bench_time(run_native, &job, warmup, iters, &st);
+			bench_row(sz, bc, "native", img_simd_name(levels[j]), &st, src,
+				  compare(ref, out, 0));
+		}
+		img_simd_set(best);
+
+		for (j = 0; rt != NULL && j < bc->nvariants; j++) {
+			stage.variant = bc->variants[j].variant;
+			bench_time(run_opencl, &job, warmup, iters, &st);
+			bench_row(sz, bc, "opencl", bc->variants[j].name, &st, src,
+				  bc->variants[j].border < 0 ? -1 : compare(ref, out, bc->variants[j].border));
+		}
+
+		if (conv != NULL)
+			conv_destroy(conv);
+	}
+
+	img_destroy_ctx(packed);
+	xfree(mem);
+	img_destroy_ctx(rgb);
+	img_destroy_ctx(gray);
+	img_destroy_ctx(ref);
+	img_destroy_ctx(out);
+}
+
+/* average milliseconds of a pipeline with uploads and downloads, in bands if `band' > 0 */
+static double time_stream(struct clrt *rt, struct pipeline *pl, struct img_ctx *src,
+			  struct img_ctx *dst, int band, int iters)
+{
+	double t0;
+	int i;
+
+	xcl_stream_run(rt, pl, src, dst, band);
+
+	t0 = now_ms();
+	for (i = 0; i < iters; i++)
+		xcl_stream_run(rt, pl, src, dst, band);
+
+	return (now_ms() - t0)/iters;
+}
+
+/* bands with their halo must give the same image as one pass */
+static void bench_stream(struct clrt *rt, int nsizes, int iters)
+{
+	struct img_ctx *rgb, *ref, *out;
+	struct stage chain[3];
+	struct pipeline pl;
+	double t_whole, t_bands;
+	long diff;
+	int i;
+
+	memset(chain, 0, sizeof(chain));
+	chain[0].type = STAGE_GRAYSCALE;
+	chain[1].type = STAGE_GAUSSIAN_BLUR;
+	chain[1].sigma = BENCH_SIGMA;
+	chain[2].type = STAGE_GAUSSIAN_BLUR;
+
+	pl.stages = chain;
+	pl.nstages = 3;
+
+	printf("\n%-8s %12s %12s %12s %s\n", "size", "whole ms", "bands ms", "band rows", "mismatch");
+
+	for (i = 0; i < nsizes; i++) {
+		rgb = synthetic_rgb(sizes[i].w, sizes[i].h);
+		ref = img_ctx_new(rgb->w, rgb->h, TYPE_GRAY, C_NONE);
+		out = img_ctx_new(rgb->w, rgb->h, TYPE_GRAY, C_NONE);
+
+		t_whole = time_stream(rt, &pl, rgb, ref, 0, iters);
+		t_bands = time_stream(rt, &pl, rgb, out, STREAM_BAND, iters);
+
+		/* again only the interior, for cl_img_gaussian_blur */
+		diff = compare(ref, out, 2);
+		mismatches += diff;
+		printf("%-8s %12.3f %12.3f %12d %ld\n", sizes[i].name, t_whole, t_bands, STREAM_BAND, diff);
+
+		img_destroy_ctx(rgb);
+		img_destroy_ctx(ref);
+		img_destroy_ctx(out);
+	}
+}
+
+/* bands spread over every device must give the image of one device */
+static void bench_sched(struct xcl_sched *sched, int nsizes, int iters)
+{
+	struct img_ctx *rgb, *ref, *out;
+	struct pipeline *base, *pl;
+	struct stage *st;
+	double t_one, t_all;
+	long diff;
+	int i, k;
+
+	base = pipeline_new();
+	pipeline_add(base, STAGE_GRAYSCALE);
+	st = pipeline_add(base, STAGE_GAUSSIAN_BLUR);
+	st->sigma = BENCH_SIGMA;
+	pipeline_add(base, STAGE_GAUSSIAN_BLUR);
+
+	/* variants pinned as the scheduler does, for the reference too */
+	pl = xcl_sched_pipeline(base);
+	pipeline_destroy(base);
+
+	printf("\n%-8s %12s %12s %s\n", "size", "device 0 ms", "all ms", "mismatch");
+
+	for (i = 0; i < nsizes; i++) {
+		rgb = synthetic_rgb(sizes[i].w, sizes[i].h);
+		ref = img_ctx_new(rgb->w, rgb->h, TYPE_GRAY, C_NONE);
+		out = img_ctx_new(rgb->w, rgb->h, TYPE_GRAY, C_NONE);
+
+		t_one = time_stream(sched->workers[0].rt, pl, rgb, ref, 0, iters);
+
+		xcl_sched_rows(sched, pl, rgb, out, 0);
+		t_all = now_ms();
+		for (k = 0; k < iters; k++)
+			xcl_sched_rows(sched, pl, rgb, out, 0);
+		t_all = (now_ms() - t_all)/iters;
+
+		diff = compare(ref, out, 2);
+		mismatches += diff;
+		printf("%-8s %12.3f %12.3f %ld\n", sizes[i].name, t_one, t_all, diff);
+		xcl_sched_report(sched, stdout, "bands");
+
+		img_destroy_ctx(rgb);
+		img_destroy_ctx(ref);
+		img_destroy_ctx(out);
+	}
+
+	pipeline_destroy(pl);
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: bench [-f kernels/img.cl] [-n iterations] [-w warm-up] [-m max size]"
+		" [-j threads] [-t tile] [-a] [-M]\n");
+	exit(EXIT_FAILURE);
+}
+
+/* mmap the kernel source */
+static char *map_source(const char *fname, size_t *fsize)
+{
+	struct stat sb;
+	FILE *file;
+	char *src;
+
+	if (stat(fname, &sb) == -1) {
+		fprintf(stderr, "error: %s\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	file = fopen(fname, "r");
+	if (file == NULL) {
+		fprintf(stderr, "error: %s\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	*fsize = sb.st_size;
+	src = mmap(NULL, *fsize, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+	fclose(file);
+
+	if (src == (void *)(-1)) {
+		fprintf(stderr, "error: %s\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	return src;
+}
+
+int main(int argc, char **argv)
+{
+	struct clrt *rt;
+	struct native *nt;
+	char *fname, *maxname, *src, options[512];
+	struct clrt **rts;
+	struct xcl_sched *sched;
+	int opt, iters, warmup, tile, nthreads, nsizes, i, autotune, multi, nrts;
+	size_t fsize;
+
+	fname = NULL;
+	maxname = "8K";
+	iters = 20;
+	warmup = 2;
+	tile = 0;
+	nthreads = 0;
+	autotune = 0;
+	multi = 0;
+
+	while ((opt = getopt(argc, argv, "f:n:w:m:j:t:aM")) != -1) {
+		switch (opt) {
+		case 'f':
+			fname = xstrdup(optarg);
+			break;
+		case 'n':
+			iters = atoi(optarg);
+			break;
+		case 'w':
+			warmup = atoi(optarg);
+			break;
+		case 'm':
+			/* largest size to run */
+			maxname = optarg;
+			break;
+		case 'j':
+			nthreads = atoi(optarg);
+			break;
+		case 't':
+			tile = atoi(optarg);
+			break;
+		case 'a':
+			/* tune local sizes in the warm-up runs, not saved */
+			autotune = 1;
+			break;
+		case 'M':
+			/* also split images over every device, needs -f */
+			multi = 1;
+			break;
+		default:
+			usage();
+		}
+	}
+
+	if (iters <= 0 || warmup < 0)
+		usage();
+
+	if (autotune && warmup == 0)
+		warmup = 1;
+
+	for (nsizes = 0; nsizes < NSIZES; nsizes++) {
+		if (strcmp(sizes[nsizes].name, maxname) == 0)
+			break;
+	}
+	if (nsizes == NSIZES) {
+		fprintf(stderr, "error: unknown size `%s'\n", maxname);
+		exit(EXIT_FAILURE);
+	}
+	nsizes++;
+
+	/* without kernels or a device only the host backends run */
+	rt = NULL;
+	if (fname != NULL) {
+		rt = clrt_new(CL_DEVICE_TYPE_CPU, FALSE);
+		if (rt == NULL) {
+			fprintf(stderr, "error: no OpenCL device\n");
+			exit(EXIT_FAILURE);
+		}
+		src = map_source(fname, &fsize);
+		xcl_build_options(rt, options, sizeof(options), tile);
+		clrt_build(rt, src, fsize, options, NULL);
+		rt->tune = cltune_new(rt->device, NULL, autotune);
+	}
+
+	sched = NULL;
+	if (rt != NULL && multi) {
+		rts = clrt_all(CL_DEVICE_TYPE_ALL, FALSE, 0, &nrts);
+		for (i = 0; i < nrts; i++) {
+			xcl_build_options(rts[i], options, sizeof(options), tile);
+			clrt_build(rts[i], src, fsize, options, NULL);
+			rts[i]->tune = cltune_new(rts[i]->device, NULL, autotune);
+		}
+		if (nrts > 0) {
+			sched = xcl_sched_new(rts, nrts);
+			xfree(rts);
+		}
+	}
+
+	nt = native_new(nthreads);
+
+	printf("%-6s %-10s %-8s %-10s %10s %10s %10s %8s %8s\n", "size", "stage", "backend", "variant",
+	       "median ms", "p95 ms", "MP/s", "GB/s", "mismatch");
+
+	for (i = 0; i < nsizes; i++)
+		bench_size(&sizes[i], rt, nt, warmup, iters);
+
+	if (rt != NULL) {
+		bench_stream(rt, nsizes, iters);
+		clrt_destroy(rt);
+	}
+
+	if (sched != NULL) {
+		bench_sched(sched, nsizes, iters);
+		xcl_sched_destroy(sched);
+	}
+
+	native_destroy(nt);
+
+	if (mismatches > 0) {
+		fprintf(stderr, "error: %ld pixels differ from the reference\n", mismatches);
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -1,15 +0,0 @@
-#ifndef GAUSS_H_
-#define GAUSS_H_
-
-int gauss[] = {
-	1,4,7,4,1,
-	4,20,33,20,4,
-	7,33,55,33,7,
-	4,20,33,20,4,
-	1,4,7,4,1
-};
-
-int gauss_sum = 331;
-int gauss_dim = 5;
-
-#endif /* GAUSS_H_ */
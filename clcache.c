@@ -0,0 +1,277 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <CL/cl.h>
+
+#include "common.h"
+#include "clcache.h"
+#include "clrt.h"
+#include "xmalloc.h"
+
+/*
+ * On-disk cache of CL_PROGRAM_BINARIES. A cache file is
+ *
+ *	CLCACHE_MAGIC key '\0' binary
+ *
+ * and is named after a hash of the key. The key holds everything that
+ * can make a binary stale (device, driver, build options, source), it
+ * is compared in full on load so a hash collision is just a miss.
+ */
+#define CLCACHE_MAGIC "imgalg-opencl binary 1\n"
+
+static unsigned long long fnv1a(const void *data, size_t len, unsigned long long h)
+{
+	const unsigned char *p;
+	size_t i;
+
+	p = data;
+	for (i = 0; i < len; i++) {
+		h ^= p[i];
+		h *= 0x100000001b3ULL;
+	}
+
+	return h;
+}
+
+#define FNV1A_INIT 0xcbf29ce484222325ULL
+
+char *clcache_default_dir(void)
+{
+	char *base, *dir;
+	size_t len;
+
+	base = getenv("XDG_CACHE_HOME");
+	if (base != NULL && base[0] != '\0') {
+		len = strlen(base) + sizeof("/imgalg-opencl");
+		dir = xmalloc(len);
+		snprintf(dir, len, "%s/imgalg-opencl", base);
+		return dir;
+	}
+
+	base = getenv("HOME");
+	if (base == NULL || base[0] == '\0')
+		return NULL;
+
+	len = strlen(base) + sizeof("/.cache/imgalg-opencl");
+	dir = xmalloc(len);
+	snprintf(dir, len, "%s/.cache/imgalg-opencl", base);
+
+	return dir;
+}
+
+/* what identifies the device and its compiler, one "name=value" line each */
+char *clcache_device_key(cl_device_id device)
+{
+	char *name, *driver, *version, *key;
+	size_t size;
+
+	name = cl_device_str(device, CL_DEVICE_NAME);
+	driver = cl_device_str(device, CL_DRIVER_VERSION);
+	version = cl_device_str(device, CL_DEVICE_VERSION);
+
+	size = strlen(name) + strlen(driver) + strlen(version) + 32;
+	key = xmalloc(size);
+	snprintf(key, size, "device=%s\ndriver=%s\nversion=%s\n", name, driver, version);
+
+	xfree(name);
+	xfree(driver);
+	xfree(version);
+
+	return key;
+}
+
+char *clcache_key(cl_device_id device, const char *src, size_t len, const char *options)
+{
+	char *dev, *key;
+	size_t size;
+
+	assert(src != NULL);
+
+	dev = clcache_device_key(device);
+
+	if (options == NULL)
+		options = "";
+
+	size = strlen(dev) + strlen(options) + 64;
+	key = xmalloc(size);
+	snprintf(key, size, "%soptions=%s\nsource=%016llx\n", dev, options, fnv1a(src, len, FNV1A_INIT));
+
+	xfree(dev);
+
+	return key;
+}
+
+/* `dir'/<hash of key>.`ext' */
+char *clcache_path(const char *dir, const char *key, const char *ext)
+{
+	char *path;
+	size_t size;
+
+	size = strlen(dir) + strlen(ext) + 32;
+	path = xmalloc(size);
+	snprintf(path, size, "%s/%016llx.%s", dir, fnv1a(key, strlen(key), FNV1A_INIT), ext);
+
+	return path;
+}
+
+/* create `dir' and its missing parents */
+int clcache_mkdir(const char *dir)
+{
+	char *path, *p;
+	int ret;
+
+	path = xstrdup(dir);
+	ret = 0;
+
+	for (p = path + 1; ; p++) {
+		if (*p != '/' && *p != '\0')
+			continue;
+
+		ret = *p;
+		*p = '\0';
+		if (mkdir(path, 0755) == -1 && errno != EEXIST) {
+			xfree(path);
+			return RET_ERR;
+		}
+		if (ret == '\0')
+			break;
+		*p = '/';
+	}
+
+	xfree(path);
+
+	return RET_OK;
+}
+
+/* returns a built program or NULL if there is no usable binary */
+cl_program clcache_load(cl_context context, cl_device_id device, const char *dir, const char *key)
+{
+	cl_program program;
+	cl_int err, status;
+	unsigned char *data;
+	const unsigned char *bin;
+	size_t size, hdr, bin_size;
+	struct stat sb;
+	char *path;
+	FILE *file;
+
+	assert(dir != NULL);
+	assert(key != NULL);
+
+	path = clcache_path(dir, key, "bin");
+	file = fopen(path, "rb");
+	xfree(path);
+
+	if (file == NULL)
+		return NULL;
+
+	if (fstat(fileno(file), &sb) == -1) {
+		fclose(file);
+		return NULL;
+	}
+
+	size = sb.st_size;
+	hdr = strlen(CLCACHE_MAGIC) + strlen(key) + 1;
+
+	if (size <= hdr) {
+		fclose(file);
+		return NULL;
+	}
+
+	data = xmalloc(size);
+	if (fread(data, 1, size, file) != size) {
+		fclose(file);
+		xfree(data);
+		return NULL;
+	}
+	fclose(file);
+
+	/* stale binary: driver update, other options or edited source */
+	if (memcmp(data, CLCACHE_MAGIC, strlen(CLCACHE_MAGIC)) != 0 ||
+	    strcmp((char *)data + strlen(CLCACHE_MAGIC), key) != 0) {
+		xfree(data);
+		return NULL;
+	}
+
+	bin = data + hdr;
+	bin_size = size - hdr;
+
+	program = clCreateProgramWithBinary(context, 1, &device, &bin_size, &bin, &status, &err);
+	xfree(data);
+
+	if (err != CL_SUCCESS || status != CL_SUCCESS)
+		return NULL;
+
+	/* a binary still has to be built, but there is nothing to compile */
+	err = clBuildProgram(program, 1, &device, NULL, NULL, NULL);
+	if (err != CL_SUCCESS) {
+		clReleaseProgram(program);
+		return NULL;
+	}
+
+	return program;
+}
+
+void clcache_store(cl_program program, const char *dir, const char *key)
+{
+	unsigned char *bin;
+	size_t bin_size;
+	char *path, *tmp;
+	cl_int err;
+	FILE *file;
+	int ok;
+
+	assert(dir != NULL);
+	assert(key != NULL);
+
+	/* the program is built for exactly one device */
+	err = clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, sizeof(bin_size), &bin_size, NULL);
+	if (err != CL_SUCCESS || bin_size == 0)
+		return;
+
+	bin = xmalloc(bin_size);
+	err = clGetProgramInfo(program, CL_PROGRAM_BINARIES, sizeof(bin), &bin, NULL);
+	if (err != CL_SUCCESS) {
+		xfree(bin);
+		return;
+	}
+
+	if (clcache_mkdir(dir) != RET_OK) {
+		fprintf(stderr, "warning: unable to create cache directory %s: %s\n", dir, strerror(errno));
+		xfree(bin);
+		return;
+	}
+
+	path = clcache_path(dir, key, "bin");
+	tmp = xmalloc(strlen(path) + 16);
+	sprintf(tmp, "%s.%d", path, (int)getpid());
+
+	file = fopen(tmp, "wb");
+	if (file == NULL) {
+		fprintf(stderr, "warning: unable to write %s: %s\n", tmp, strerror(errno));
+		xfree(bin);
+		xfree(path);
+		xfree(tmp);
+		return;
+	}
+
+	ok = fwrite(CLCACHE_MAGIC, strlen(CLCACHE_MAGIC), 1, file) == 1;
+	ok &= fwrite(key, strlen(key) + 1, 1, file) == 1;
+	ok &= fwrite(bin, bin_size, 1, file) == 1;
+	ok &= fclose(file) == 0;
+
+	/* concurrent jobs may race here, rename() keeps the file whole */
+	if (!ok || rename(tmp, path) == -1)
+		unlink(tmp);
+
+	xfree(bin);
+	xfree(path);
+	xfree(tmp);
+}
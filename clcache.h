@@ -0,0 +1,15 @@
+#ifndef CL_CACHE_H_
+#define CL_CACHE_H_
+
+#include <CL/cl.h>
+
+char *clcache_default_dir(void);
+char *clcache_device_key(cl_device_id device);
+char *clcache_key(cl_device_id device, const char *src, size_t len, const char *options);
+cl_program clcache_load(cl_context context, cl_device_id device, const char *dir, const char *key);
+void clcache_store(cl_program program, const char *dir, const char *key);
+
+char *clcache_path(const char *dir, const char *key, const char *ext);
+int clcache_mkdir(const char *dir);
+
+#endif /* CL_CACHE_H_ */
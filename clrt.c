@@ -0,0 +1,631 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include <CL/cl.h>
+
+#include "common.h"
+#include "clrt.h"
+#include "clcache.h"
+#include "cltune.h"
+#include "clerr.h"
+#include "xmalloc.h"
+
+cl_mem create_buffer(cl_context context,
+		     cl_mem_flags flags,
+		     size_t size,
+		     void *host_ptr)
+{
+	cl_mem buf;
+	cl_int err;
+
+	buf = clCreateBuffer(context, flags, size, host_ptr, &err);
+
+	if (err != CL_SUCCESS) {
+		fprintf(stderr, "error: clCreateBuffer() %d %s\n", err, cl_strerror(err));
+		exit(EXIT_FAILURE);
+	}
+
+	return buf;
+}
+
+void build_program(cl_program program,
+		   cl_uint num_devices,
+		   const cl_device_id *device,
+		   const char *options,
+		   void (*pfn_notify)(cl_program, void *user_data),
+		   void *user_data)
+{
+	cl_int err;
+	size_t log_size;
+	char *log;
+
+	/* building program */
+	err = clBuildProgram(program, num_devices, device, options, pfn_notify, user_data);
+	if (err != CL_SUCCESS) {
+		/* determine size of compiler log */
+		clGetProgramBuildInfo(program, *device, CL_PROGRAM_BUILD_LOG, 0, NULL, &log_size);
+		log = malloc(log_size + 1);
+		log[log_size] = '\0';
+		/* store compiler output to buffer */
+		clGetProgramBuildInfo(program, *device, CL_PROGRAM_BUILD_LOG, log_size, log, NULL);
+		fprintf(stderr, "error: clBuildProgram() %d %s\n", err, cl_strerror(err));
+		fprintf(stderr, "%s\n", log);
+		exit(EXIT_FAILURE);
+	}
+}
+
+cl_kernel create_kernel(cl_program  program, const char *kernel_name)
+{
+	cl_kernel kernel;
+	cl_int err;
+
+	kernel = clCreateKernel(program, kernel_name, &err);
+	if (err != CL_SUCCESS) {
+		fprintf(stderr, "error: clCreateKerne() %d %s\n", err, cl_strerror(err));
+		exit(EXIT_FAILURE);
+	}
+
+	return kernel;
+}
+
+/* images are optional in OpenCL 1.2, single channel formats more so */
+static int images_supported(struct clrt *rt)
+{
+	cl_image_format *formats;
+	cl_bool images;
+	cl_uint i, n;
+	cl_int err;
+	int found;
+
+	err = clGetDeviceInfo(rt->device, CL_DEVICE_IMAGE_SUPPORT, sizeof(images), &images, NULL);
+	if (err != CL_SUCCESS || !images)
+		return FALSE;
+
+	err = clGetSupportedImageFormats(rt->context, CL_MEM_READ_ONLY, CL_MEM_OBJECT_IMAGE2D, 0, NULL, &n);
+	if (err != CL_SUCCESS || n == 0)
+		return FALSE;
+
+	formats = xmalloc(n*sizeof(*formats));
+	err = clGetSupportedImageFormats(rt->context, CL_MEM_READ_ONLY, CL_MEM_OBJECT_IMAGE2D, n, formats, NULL);
+
+	found = FALSE;
+	for (i = 0; err == CL_SUCCESS && i < n; i++) {
+		if (formats[i].image_channel_order == CL_R && formats[i].image_channel_data_type == CL_UNORM_INT8)
+			found = TRUE;
+	}
+
+	xfree(formats);
+
+	return found;
+}
+
+/* context and queues on `device', `subdevice' hands its release to the runtime */
+struct clrt *clrt_new_device(cl_platform_id platform, cl_device_id device, int profile, int subdevice)
+{
+	struct clrt *rt;
+	cl_device_fp_config fp64;
+	cl_device_type dev_type;
+	cl_bool unified;
+	cl_command_queue_properties props;
+	cl_int err;
+
+	rt = xmalloc0(sizeof(*rt));
+	rt->platform = platform;
+	rt->device = device;
+	rt->subdevice = subdevice;
+
+	err = clGetDeviceInfo(rt->device, CL_DEVICE_DOUBLE_FP_CONFIG, sizeof(fp64), &fp64, NULL);
+	rt->fp64 = err == CL_SUCCESS && fp64 != 0;
+
+	err = clGetDeviceInfo(rt->device, CL_DEVICE_PREFERRED_VECTOR_WIDTH_CHAR, sizeof(rt->vec_char),
+			      &rt->vec_char, NULL);
+	if (err != CL_SUCCESS)
+		rt->vec_char = 1;
+
+	err = clGetDeviceInfo(rt->device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(rt->ncu), &rt->ncu, NULL);
+	if (err != CL_SUCCESS || rt->ncu == 0)
+		rt->ncu = 1;
+
+	err = clGetDeviceInfo(rt->device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(rt->max_alloc),
+			      &rt->max_alloc, NULL);
+	err |= clGetDeviceInfo(rt->device, CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(rt->global_mem),
+			       &rt->global_mem, NULL);
+	err |= clGetDeviceInfo(rt->device, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(rt->local_mem),
+			       &rt->local_mem, NULL);
+	err |= clGetDeviceInfo(rt->device, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(rt->max_wg),
+			       &rt->max_wg, NULL);
+	if (err != CL_SUCCESS) {
+		fprintf(stderr, "error: clGetDeviceInfo() %d %s\n", err, cl_strerror(err));
+		exit(EXIT_FAILURE);
+	}
+
+	/* CPUs and integrated GPUs can work on image memory in place */
+	err = clGetDeviceInfo(rt->device, CL_DEVICE_TYPE, sizeof(dev_type), &dev_type, NULL);
+	err |= clGetDeviceInfo(rt->device, CL_DEVICE_HOST_UNIFIED_MEMORY, sizeof(unified), &unified, NULL);
+	rt->zero_copy = err == CL_SUCCESS && ((dev_type & CL_DEVICE_TYPE_CPU) || unified);
+
+	/* create context */
+	rt->context = clCreateContext(NULL, 1, &rt->device, NULL, NULL, &err);
+	if (err != CL_SUCCESS) {
+		fprintf(stderr, "error: clCreateContext() %d %s\n", err, cl_strerror(err));
+		exit(EXIT_FAILURE);
+	}
+
+	/* create comand queue */
+	rt->profile = profile;
+	props = profile ? CL_QUEUE_PROFILING_ENABLE : 0;
+
+	rt->queue = clCreateCommandQueue(rt->context, rt->device, props, &err);
+	if (err != CL_SUCCESS) {
+		fprintf(stderr, "error: clCreateCommandQueue() %d %s\n", err, cl_strerror(err));
+		exit(EXIT_FAILURE);
+	}
+
+	rt->queue2 = clCreateCommandQueue(rt->context, rt->device, props, &err);
+	if (err != CL_SUCCESS) {
+		fprintf(stderr, "error: clCreateCommandQueue() %d %s\n", err, cl_strerror(err));
+		exit(EXIT_FAILURE);
+	}
+
+	rt->image_support = images_supported(rt);
+
+	return rt;
+}
+
+/* runtime on the first device of `type' of the first platform */
+struct clrt *clrt_new(cl_device_type type, int profile)
+{
+	cl_platform_id platform;
+	cl_device_id device;
+	cl_int err;
+
+	/* no ICD or no device is not fatal, the caller may fall back */
+	err = clGetPlatformIDs(1, &platform, NULL);
+	if (err != CL_SUCCESS) {
+		fprintf(stderr, "warning: clGetPlatformIDs() errcode %d %s\n", err, cl_strerror(err));
+		return NULL;
+	}
+
+	/* get available device */
+	err = clGetDeviceIDs(platform, type, 1, &device, NULL);
+	if (err != CL_SUCCESS) {
+		fprintf(stderr, "warning: clGetDeviceIDs() %d %s\n", err, cl_strerror(err));
+		return NULL;
+	}
+
+	return clrt_new_device(platform, device, profile, FALSE);
+}
+
+/* sub-devices of `cus' compute units each, NULL if `device' cannot be split so */
+static cl_device_id *device_split(cl_device_id device, int cus, cl_uint *n)
+{
+	cl_device_partition_property props[3];
+	cl_device_id *subs;
+	cl_uint ncu;
+	cl_int err;
+
+	err = clGetDeviceInfo(device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(ncu), &ncu, NULL);
+	if (err != CL_SUCCESS || ncu < 2*(cl_uint)cus)
+		return NULL;
+
+	props[0] = CL_DEVICE_PARTITION_EQUALLY;
+	props[1] = cus;
+	props[2] = 0;
+
+	err = clCreateSubDevices(device, props, 0, NULL, n);
+	if (err != CL_SUCCESS || *n == 0)
+		return NULL;
+
+	subs = xmalloc(*n*sizeof(*subs));
+	err = clCreateSubDevices(device, props, *n, subs, NULL);
+	if (err != CL_SUCCESS) {
+		xfree(subs);
+		return NULL;
+	}
+
+	return subs;
+}
+
+/*
+ * A runtime for every device of `type' on every platform, in platform
+ * order. With `cus' > 0 devices that can be partitioned are split into
+ * sub-devices of that many compute units, each with its own runtime.
+ * Returns NULL and `*n' 0 if there is none.
+ */
+struct clrt **clrt_all(cl_device_type type, int profile, int cus, int *n)
+{
+	cl_platform_id *platforms;
+	cl_device_id *devices, *subs;
+	cl_uint nplatforms, ndevices, nsubs, i, j, k;
+	struct clrt **rts;
+	cl_int err;
+	int count;
+
+	assert(n != NULL);
+
+	rts = NULL;
+	count = 0;
+
+	err = clGetPlatformIDs(0, NULL, &nplatforms);
+	if (err != CL_SUCCESS || nplatforms == 0) {
+		fprintf(stderr, "warning: clGetPlatformIDs() errcode %d %s\n", err, cl_strerror(err));
+		*n = 0;
+		return NULL;
+	}
+
+	platforms = xmalloc(nplatforms*sizeof(*platforms));
+	clGetPlatformIDs(nplatforms, platforms, NULL);
+
+	for (i = 0; i < nplatforms; i++) {
+		/* CL_DEVICE_NOT_FOUND only means none of this type here */
+		err = clGetDeviceIDs(platforms[i], type, 0, NULL, &ndevices);
+		if (err != CL_SUCCESS || ndevices == 0)
+			continue;
+
+		devices = xmalloc(ndevices*sizeof(*devices));
+		clGetDeviceIDs(platforms[i], type, ndevices, devices, NULL);
+
+		for (j = 0; j < ndevices; j++) {
+			subs = cus > 0 ? device_split(devices[j], cus, &nsubs) : NULL;
+			if (subs == NULL) {
+				rts = xrealloc(rts, (count + 1)*sizeof(*rts));
+				rts[count++] = clrt_new_device(platforms[i], devices[j], profile, FALSE);
+				continue;
+			}
+
+			rts = xrealloc(rts, (count + nsubs)*sizeof(*rts));
+			for (k = 0; k < nsubs; k++)
+				rts[count++] = clrt_new_device(platforms[i], subs[k], profile, TRUE);
+			xfree(subs);
+		}
+
+		xfree(devices);
+	}
+
+	xfree(platforms);
+	*n = count;
+
+	return rts;
+}
+
+/* string valued device property, e.g. CL_DEVICE_NAME */
+char *cl_device_str(cl_device_id device, cl_device_info param)
+{
+	size_t size;
+	char *str;
+	cl_int err;
+
+	err = clGetDeviceInfo(device, param, 0, NULL, &size);
+	if (err != CL_SUCCESS) {
+		fprintf(stderr, "error: clGetDeviceInfo() %d %s\n", err, cl_strerror(err));
+		exit(EXIT_FAILURE);
+	}
+
+	str = xmalloc(size + 1);
+	clGetDeviceInfo(device, param, size, str, NULL);
+	str[size] = '\0';
+
+	return str;
+}
+
+/*
+ * Build the program from source unless `cache_dir' holds a binary for
+ * this device, driver, options and source. Pass NULL to always compile.
+ */
+void clrt_build(struct clrt *rt, const char *src, size_t len, const char *options,
+		const char *cache_dir)
+{
+	cl_int err;
+	char *key;
+
+	assert(rt != NULL);
+	assert(src != NULL);
+
+	key = NULL;
+
+	if (cache_dir != NULL) {
+		key = clcache_key(rt->device, src, len, options);
+		rt->program = clcache_load(rt->context, rt->device, cache_dir, key);
+		if (rt->program != NULL) {
+			xfree(key);
+			return;
+		}
+	}
+
+	/* create program source */
+	rt->program = clCreateProgramWithSource(rt->context, 1, &src, &len, &err);
+	if (err != CL_SUCCESS) {
+		fprintf(stderr, "error: clCreateProgramWithSource() %d %s\n", err, cl_strerror(err));
+		exit(EXIT_FAILURE);
+	}
+
+	build_program(rt->program, 1, &rt->device, options, NULL, NULL);
+
+	if (key != NULL) {
+		clcache_store(rt->program, cache_dir, key);
+		xfree(key);
+	}
+}
+
+void clrt_destroy(struct clrt *rt)
+{
+	int i;
+
+	assert(rt != NULL);
+
+	for (i = 0; i < rt->nkernels; i++) {
+		clReleaseKernel(rt->kernels[i].kernel);
+		xfree(rt->kernels[i].name);
+	}
+
+	for (i = 0; i < rt->nbufs; i++)
+		clReleaseMemObject(rt->bufs[i].mem);
+
+	for (i = 0; i < rt->nimages; i++)
+		clReleaseMemObject(rt->images[i].mem);
+
+	for (i = 0; i < rt->nsamplers; i++)
+		clReleaseSampler(rt->samplers[i].sampler);
+
+	for (i = 0; i < rt->nconsts; i++) {
+		clReleaseMemObject(rt->consts[i].mem);
+		xfree(rt->consts[i].name);
+	}
+
+	if (rt->kernels != NULL)
+		xfree(rt->kernels);
+	if (rt->bufs != NULL)
+		xfree(rt->bufs);
+	if (rt->images != NULL)
+		xfree(rt->images);
+	if (rt->samplers != NULL)
+		xfree(rt->samplers);
+	if (rt->consts != NULL)
+		xfree(rt->consts);
+
+	if (rt->tune != NULL)
+		cltune_destroy(rt->tune);
+
+	if (rt->program != NULL)
+		clReleaseProgram(rt->program);
+	clReleaseCommandQueue(rt->queue);
+	clReleaseCommandQueue(rt->queue2);
+	clReleaseContext(rt->context);
+	if (rt->subdevice)
+		clReleaseDevice(rt->device);
+
+	xfree(rt);
+}
+
+/* look up a kernel by name, creating it on first use */
+cl_kernel clrt_kernel(struct clrt *rt, const char *name)
+{
+	struct clrt_kernel *k;
+	int i;
+
+	assert(rt != NULL);
+	assert(name != NULL);
+
+	for (i = 0; i < rt->nkernels; i++) {
+		if (strcmp(rt->kernels[i].name, name) == 0)
+			return rt->kernels[i].kernel;
+	}
+
+	rt->kernels = xrealloc(rt->kernels, (rt->nkernels + 1)*sizeof(*(rt->kernels)));
+	k = &rt->kernels[rt->nkernels++];
+	k->name = xstrdup(name);
+	k->kernel = create_kernel(rt->program, name);
+
+	return k->kernel;
+}
+
+/*
+ * Take a buffer of at least `size' bytes from the pool. The smallest idle
+ * buffer that fits is reused; otherwise an idle buffer that is too small
+ * is replaced so the pool does not grow with every new image size.
+ */
+cl_mem clrt_buf_get(struct clrt *rt, size_t size)
+{
+	struct clrt_buffer *b, *fit, *small;
+	int i;
+
+	assert(rt != NULL);
+	assert(size > 0);
+
+	fit = small = NULL;
+
+	for (i = 0; i < rt->nbufs; i++) {
+		b = &rt->bufs[i];
+		if (b->busy)
+			continue;
+		if (b->size >= size) {
+			if (fit == NULL || b->size < fit->size)
+				fit = b;
+		} else if (small == NULL || b->size > small->size) {
+			small = b;
+		}
+	}
+
+	if (fit != NULL) {
+		fit->busy = TRUE;
+		return fit->mem;
+	}
+
+	if (small != NULL) {
+		clReleaseMemObject(small->mem);
+		b = small;
+	} else {
+		rt->bufs = xrealloc(rt->bufs, (rt->nbufs + 1)*sizeof(*(rt->bufs)));
+		b = &rt->bufs[rt->nbufs++];
+	}
+
+	b->mem = create_buffer(rt->context, CL_MEM_READ_WRITE, size, NULL);
+	b->size = size;
+	b->busy = TRUE;
+
+	return b->mem;
+}
+
+/*
+ * Give a buffer back to the pool. The queue is in-order, so commands
+ * enqueued later cannot overtake the ones still using this buffer.
+ */
+void clrt_buf_put(struct clrt *rt, cl_mem mem)
+{
+	int i;
+
+	assert(rt != NULL);
+
+	for (i = 0; i < rt->nbufs; i++) {
+		if (rt->bufs[i].mem == mem) {
+			assert(rt->bufs[i].busy);
+			rt->bufs[i].busy = FALSE;
+			return;
+		}
+	}
+
+	fprintf(stderr, "error: buffer is not from the pool\n");
+	abort();
+}
+
+/*
+ * Buffer over host memory for zero-copy devices. Not pooled, it belongs
+ * to one image and the caller releases it.
+ */
+cl_mem clrt_buf_wrap(struct clrt *rt, void *ptr, size_t size)
+{
+	assert(rt != NULL);
+	assert(ptr != NULL);
+
+	return create_buffer(rt->context, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR, size, ptr);
+}
+
+/* read-only data (filter masks, weights) uploaded once per runtime */
+cl_mem clrt_const(struct clrt *rt, const char *name, const void *data, size_t size)
+{
+	struct clrt_const *c;
+	int i;
+
+	assert(rt != NULL);
+	assert(name != NULL);
+
+	for (i = 0; i < rt->nconsts; i++) {
+		if (strcmp(rt->consts[i].name, name) == 0)
+			return rt->consts[i].mem;
+	}
+
+	rt->consts = xrealloc(rt->consts, (rt->nconsts + 1)*sizeof(*(rt->consts)));
+	c = &rt->consts[rt->nconsts++];
+	c->name = xstrdup(name);
+	c->mem = create_buffer(rt->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+			       size, (void *)data);
+
+	return c->mem;
+}
+
+/*
+ * Take a `w' x `h' single channel image from the pool, one of another
+ * size that is idle is replaced. Only for devices with `images' set.
+ */
+cl_mem clrt_image_get(struct clrt *rt, size_t w, size_t h)
+{
+	struct clrt_image *im, *idle;
+	cl_image_format format;
+	cl_image_desc desc;
+	cl_int err;
+	int i;
+
+	assert(rt != NULL);
+	assert(rt->image_support);
+
+	idle = NULL;
+
+	for (i = 0; i < rt->nimages; i++) {
+		im = &rt->images[i];
+		if (im->busy)
+			continue;
+		if (im->w == w && im->h == h) {
+			im->busy = TRUE;
+			return im->mem;
+		}
+		idle = im;
+	}
+
+	if (idle != NULL) {
+		clReleaseMemObject(idle->mem);
+		im = idle;
+	} else {
+		rt->images = xrealloc(rt->images, (rt->nimages + 1)*sizeof(*(rt->images)));
+		im = &rt->images[rt->nimages++];
+	}
+
+	format.image_channel_order = CL_R;
+	format.image_channel_data_type = CL_UNORM_INT8;
+
+	memset(&desc, 0, sizeof(desc));
+	desc.image_type = CL_MEM_OBJECT_IMAGE2D;
+	desc.image_width = w;
+	desc.image_height = h;
+
+	im->mem = clCreateImage(rt->context, CL_MEM_READ_ONLY, &format, &desc, NULL, &err);
+	if (err != CL_SUCCESS) {
+		fprintf(stderr, "error: clCreateImage() %d %s\n", err, cl_strerror(err));
+		exit(EXIT_FAILURE);
+	}
+
+	im->w = w;
+	im->h = h;
+	im->busy = TRUE;
+
+	return im->mem;
+}
+
+/* give an image back to the pool, see clrt_buf_put() */
+void clrt_image_put(struct clrt *rt, cl_mem mem)
+{
+	int i;
+
+	assert(rt != NULL);
+
+	for (i = 0; i < rt->nimages; i++) {
+		if (rt->images[i].mem == mem) {
+			assert(rt->images[i].busy);
+			rt->images[i].busy = FALSE;
+			return;
+		}
+	}
+
+	fprintf(stderr, "error: image is not from the pool\n");
+	abort();
+}
+
+/*
+ * Sampler reading pixels past the edges as `mode' says. The repeating
+ * modes need normalized coordinates, so all samplers use them.
+ */
+cl_sampler clrt_sampler(struct clrt *rt, cl_addressing_mode mode)
+{
+	struct clrt_sampler *s;
+	cl_int err;
+	int i;
+
+	assert(rt != NULL);
+
+	for (i = 0; i < rt->nsamplers; i++) {
+		if (rt->samplers[i].mode == mode)
+			return rt->samplers[i].sampler;
+	}
+
+	rt->samplers = xrealloc(rt->samplers, (rt->nsamplers + 1)*sizeof(*(rt->samplers)));
+	s = &rt->samplers[rt->nsamplers++];
+	s->mode = mode;
+	s->sampler = clCreateSampler(rt->context, CL_TRUE, mode, CL_FILTER_NEAREST, &err);
+	if (err != CL_SUCCESS) {
+		fprintf(stderr, "error: clCreateSampler() %d %s\n", err, cl_strerror(err));
+		exit(EXIT_FAILURE);
+	}
+
+	return s->sampler;
+}
@@ -0,0 +1,111 @@
+#ifndef CL_RT_H_
+#define CL_RT_H_
+
+#include <CL/cl.h>
+
+struct cltune;
+
+/* cached kernel handle */
+struct clrt_kernel {
+	char *name;
+	cl_kernel kernel;
+};
+
+/* pooled device buffer */
+struct clrt_buffer {
+	cl_mem mem;
+	size_t size;
+	int busy;
+};
+
+/* pooled CL_R, CL_UNORM_INT8 image, reused for images of the same size */
+struct clrt_image {
+	cl_mem mem;
+	size_t w;
+	size_t h;
+	int busy;
+};
+
+/* normalized coordinates, nearest filter, one per addressing mode */
+struct clrt_sampler {
+	cl_addressing_mode mode;
+	cl_sampler sampler;
+};
+
+/* read-only buffer uploaded once and kept by name */
+struct clrt_const {
+	char *name;
+	cl_mem mem;
+};
+
+/*
+ * OpenCL runtime: everything that outlives a single image. Kernels are
+ * created on first use and buffers are recycled through a size-keyed
+ * pool, so processing the next image of the same or smaller size does
+ * not call clCreateKernel() or clCreateBuffer().
+ */
+struct clrt {
+	cl_platform_id platform;
+	cl_device_id device;
+	cl_context context;
+	cl_command_queue queue;
+	cl_command_queue queue2;	/* lets streamed bands overlap */
+	cl_program program;
+
+	int fp64;		/* device has double precision */
+	cl_uint vec_char;	/* preferred uchar vector width */
+	int zero_copy;		/* device works on host memory in place */
+	int image_support;	/* device reads CL_R, CL_UNORM_INT8 images */
+	cl_uint ncu;		/* compute units */
+	cl_ulong max_alloc;	/* largest single buffer */
+	cl_ulong global_mem;
+	cl_ulong local_mem;
+	size_t max_wg;		/* work-items in a work-group */
+	int profile;		/* queues have CL_QUEUE_PROFILING_ENABLE */
+	int subdevice;		/* device comes from clCreateSubDevices() */
+	struct cltune *tune;	/* local work sizes, NULL derives them */
+
+	struct clrt_kernel *kernels;
+	int nkernels;
+
+	struct clrt_buffer *bufs;
+	int nbufs;
+
+	struct clrt_image *images;
+	int nimages;
+
+	struct clrt_sampler *samplers;
+	int nsamplers;
+
+	struct clrt_const *consts;
+	int nconsts;
+};
+
+cl_mem create_buffer(cl_context context, cl_mem_flags flags, size_t size, void *host_ptr);
+void build_program(cl_program program,
+		   cl_uint num_devices,
+		   const cl_device_id *device,
+		   const char *options,
+		   void (*pfn_notify)(cl_program, void *user_data),
+		   void *user_data);
+cl_kernel create_kernel(cl_program program, const char *kernel_name);
+
+char *cl_device_str(cl_device_id device, cl_device_info param);
+
+struct clrt *clrt_new_device(cl_platform_id platform, cl_device_id device, int profile, int subdevice);
+struct clrt *clrt_new(cl_device_type type, int profile);
+struct clrt **clrt_all(cl_device_type type, int profile, int cus, int *n);
+void clrt_build(struct clrt *rt, const char *src, size_t len, const char *options,
+		const char *cache_dir);
+void clrt_destroy(struct clrt *rt);
+
+cl_kernel clrt_kernel(struct clrt *rt, const char *name);
+cl_mem clrt_buf_get(struct clrt *rt, size_t size);
+void clrt_buf_put(struct clrt *rt, cl_mem mem);
+cl_mem clrt_buf_wrap(struct clrt *rt, void *ptr, size_t size);
+cl_mem clrt_const(struct clrt *rt, const char *name, const void *data, size_t size);
+cl_mem clrt_image_get(struct clrt *rt, size_t w, size_t h);
+void clrt_image_put(struct clrt *rt, cl_mem mem);
+cl_sampler clrt_sampler(struct clrt *rt, cl_addressing_mode mode);
+
+#endif /* CL_RT_H_ */
@@ -0,0 +1,426 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <CL/cl.h>
+
+#include "common.h"
+#include "cltune.h"
+#include "clcache.h"
+#include "clerr.h"
+#include "prof.h"
+#include "xmalloc.h"
+
+/*
+ * A tuning file is
+ *
+ *	CLTUNE_MAGIC key '\n' { kernel ' ' class ' ' local0 ' ' local1 '\n' }
+ *
+ * and is named after a hash of the device key, which is compared in
+ * full on load. A file left by another driver is ignored and replaced
+ * on the next save.
+ */
+#define CLTUNE_MAGIC "imgalg-opencl tune 1\n"
+
+/* work-group bounds of the derived sizes and of the sweep */
+#define TUNE_DEFAULT_GROUP 256
+#define TUNE_MIN_GROUP 16
+#define TUNE_MAX_GROUP 1024
+#define TUNE_MAX_ROWS 16
+
+static struct cltune_entry *tune_get(struct cltune *t, const char *kernel, int sclass)
+{
+	int i;
+
+	for (i = 0; i < t->nentries; i++) {
+		if (t->entries[i].sclass == sclass && strcmp(t->entries[i].kernel, kernel) == 0)
+			return &t->entries[i];
+	}
+
+	return NULL;
+}
+
+static void tune_set(struct cltune *t, const char *kernel, int sclass, const size_t *local)
+{
+	struct cltune_entry *e;
+
+	e = tune_get(t, kernel, sclass);
+	if (e == NULL) {
+		t->entries = xrealloc(t->entries, (t->nentries + 1)*sizeof(*(t->entries)));
+		e = &t->entries[t->nentries++];
+		e->kernel = xstrdup(kernel);
+		e->sclass = sclass;
+	}
+
+	e->local[0] = local[0];
+	e->local[1] = local[1];
+}
+
+static void tune_load(struct cltune *t)
+{
+	char *buf, *p, kernel[128];
+	size_t hlen, klen, local[2];
+	int sclass, n;
+	FILE *file;
+	long size;
+
+	file = fopen(t->path, "r");
+	if (file == NULL)
+		return;
+
+	if (fseek(file, 0, SEEK_END) == -1 || (size = ftell(file)) < 0 || fseek(file, 0, SEEK_SET) == -1) {
+		fclose(file);
+		return;
+	}
+
+	buf = xmalloc(size + 1);
+	size = fread(buf, 1, size, file);
+	buf[size] = '\0';
+	fclose(file);
+
+	hlen = strlen(CLTUNE_MAGIC);
+	klen = strlen(t->key);
+
+	if (strncmp(buf, CLTUNE_MAGIC, hlen) != 0 || strncmp(buf + hlen, t->key, klen) != 0 ||
+	    buf[hlen + klen] != '\n') {
+		xfree(buf);
+		return;
+	}
+
+	p = buf + hlen + klen + 1;
+	while (sscanf(p, "%127s %d %zu %zu%n", kernel, &sclass, &local[0], &local[1], &n) == 4) {
+		tune_set(t, kernel, sclass, local);
+		p += n;
+	}
+
+	xfree(buf);
+}
+
+/*
+ * The device key plus its compute units, so the sub-devices of a
+ * partition and their parent do not share a tuning.
+ */
+static char *tune_key(cl_device_id device)
+{
+	char *dev, *key;
+	cl_uint units;
+	cl_int err;
+	size_t size;
+
+	err = clGetDeviceInfo(device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(units), &units, NULL);
+	if (err != CL_SUCCESS) {
+		fprintf(stderr, "error: clGetDeviceInfo() %d %s\n", err, cl_strerror(err));
+		exit(EXIT_FAILURE);
+	}
+
+	dev = clcache_device_key(device);
+	size = strlen(dev) + 32;
+	key = xmalloc(size);
+	snprintf(key, size, "%sunits=%u\n", dev, units);
+	xfree(dev);
+
+	return key;
+}
+
+/* `dir' NULL keeps the tuning of this run only */
+struct cltune *cltune_new(cl_device_id device, const char *dir, int sweep)
+{
+	struct cltune *t;
+
+	t = xmalloc0(sizeof(*t));
+	t->key = tune_key(device);
+	t->sweep = sweep;
+
+	if (dir != NULL) {
+		t->dir = xstrdup(dir);
+		t->path = clcache_path(dir, t->key, "tune");
+		tune_load(t);
+	}
+
+	return t;
+}
+
+void cltune_save(struct cltune *t)
+{
+	char *tmp;
+	FILE *file;
+	int i, ok;
+
+	assert(t != NULL);
+
+	if (!t->dirty || t->path == NULL)
+		return;
+
+	if (clcache_mkdir(t->dir) != RET_OK) {
+		fprintf(stderr, "warning: unable to create cache directory %s: %s\n", t->dir, strerror(errno));
+		return;
+	}
+
+	tmp = xmalloc(strlen(t->path) + 16);
+	sprintf(tmp, "%s.%d", t->path, (int)getpid());
+
+	file = fopen(tmp, "w");
+	if (file == NULL) {
+		fprintf(stderr, "warning: unable to write %s: %s\n", tmp, strerror(errno));
+		xfree(tmp);
+		return;
+	}
+
+	ok = fprintf(file, "%s%s\n", CLTUNE_MAGIC, t->key) > 0;
+	for (i = 0; i < t->nentries; i++) {
+		ok &= fprintf(file, "%s %d %zu %zu\n", t->entries[i].kernel, t->entries[i].sclass,
+			      t->entries[i].local[0], t->entries[i].local[1]) > 0;
+	}
+	ok &= fclose(file) == 0;
+
+	if (!ok || rename(tmp, t->path) == -1)
+		unlink(tmp);
+	else
+		t->dirty = FALSE;
+
+	xfree(tmp);
+}
+
+void cltune_destroy(struct cltune *t)
+{
+	int i;
+
+	assert(t != NULL);
+
+	cltune_save(t);
+
+	for (i = 0; i < t->nentries; i++)
+		xfree(t->entries[i].kernel);
+	if (t->entries != NULL)
+		xfree(t->entries);
+
+	if (t->dir != NULL)
+		xfree(t->dir);
+	if (t->path != NULL)
+		xfree(t->path);
+	xfree(t->key);
+	xfree(t);
+}
+
+/* images of about the same number of pixels share a tuning */
+static int size_class(cl_uint dim, const size_t *global)
+{
+	size_t n;
+	int c;
+
+	n = dim == 2 ? global[0]*global[1] : global[0];
+	for (c = 0; ((size_t)1 << c) < n; c++)
+		;
+
+	return c;
+}
+
+static void kernel_limits(struct clrt *rt, cl_kernel kernel, size_t *kmax, size_t *pref, size_t *items)
+{
+	size_t dims[16];
+	cl_int err;
+
+	err = clGetKernelWorkGroupInfo(kernel, rt->device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(*kmax), kmax, NULL);
+	err |= clGetKernelWorkGroupInfo(kernel, rt->device, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE,
+					sizeof(*pref), pref, NULL);
+	if (err != CL_SUCCESS) {
+		fprintf(stderr, "error: clGetKernelWorkGroupInfo() %d %s\n", err, cl_strerror(err));
+		exit(EXIT_FAILURE);
+	}
+
+	/* per dimension limits, we use the first two */
+	err = clGetDeviceInfo(rt->device, CL_DEVICE_MAX_WORK_ITEM_SIZES, sizeof(dims), dims, NULL);
+	if (err != CL_SUCCESS)
+		dims[0] = dims[1] = *kmax;
+	items[0] = dims[0];
+	items[1] = dims[1];
+
+	if (*pref == 0 || *pref > *kmax)
+		*pref = 1;
+}
+
+/* `global' rounded up to whole work-groups of `local' */
+static void local_pad(cl_uint dim, size_t *global, const size_t *local)
+{
+	cl_uint i;
+
+	for (i = 0; i < dim; i++)
+		global[i] = (global[i] + local[i] - 1)/local[i]*local[i];
+}
+
+/*
+ * A multiple of the preferred size, spent along x in 2D where rows are
+ * contiguous, up to TUNE_DEFAULT_GROUP work-items.
+ */
+static void local_default(size_t kmax, size_t pref, const size_t *items, cl_uint dim, size_t *local)
+{
+	size_t max, lx;
+
+	max = kmax < TUNE_DEFAULT_GROUP ? kmax : TUNE_DEFAULT_GROUP;
+
+	if (dim == 1) {
+		local[0] = max >= pref ? max/pref*pref : pref;
+		if (local[0] > items[0])
+			local[0] = items[0];
+		local[1] = 0;
+		return;
+	}
+
+	lx = pref;
+	while (lx < TUNE_MIN_GROUP && 2*lx <= max)
+		lx *= 2;
+	if (lx > items[1])
+		lx = items[1];
+
+	local[1] = lx;
+	local[0] = max/lx > 0 ? max/lx : 1;
+	if (local[0] > items[0])
+		local[0] = items[0];
+}
+
+/* {0, 0} (implementation's choice) first, then multiples of `pref' */
+static int local_candidates(size_t kmax, size_t pref, const size_t *items, cl_uint dim,
+			    size_t cand[][2])
+{
+	size_t l, lx, ly;
+	int n;
+
+	n = 0;
+	cand[n][0] = cand[n][1] = 0;
+	n++;
+
+	if (dim == 1) {
+		for (l = pref; l <= kmax && l <= items[0] && n < CLTUNE_MAX_CANDIDATES; l *= 2) {
+			cand[n][0] = l;
+			cand[n][1] = 0;
+			n++;
+		}
+		return n;
+	}
+
+	lx = pref;
+	while (lx < 4)
+		lx *= 2;
+
+	for (; lx <= kmax && lx <= items[1]; lx *= 2) {
+		for (ly = 1; ly <= TUNE_MAX_ROWS && ly <= items[0]; ly *= 2) {
+			if (lx*ly < TUNE_MIN_GROUP || lx*ly > kmax || lx*ly > TUNE_MAX_GROUP)
+				continue;
+			if (n == CLTUNE_MAX_CANDIDATES)
+				return n;
+			cand[n][0] = ly;
+			cand[n][1] = lx;
+			n++;
+		}
+	}
+
+	return n;
+}
+
+/*
+ * Time every candidate and leave the fastest in `best'. The kernels
+ * give the same result when run again, their arguments are all set.
+ */
+static void local_sweep(cl_command_queue queue, cl_kernel kernel, cl_uint dim, const size_t *global,
+			size_t cand[][2], int n, size_t *best)
+{
+	size_t g[2];
+	double t0, t, tbest;
+	cl_int err;
+	int i, r;
+
+	/* the inputs of the kernel have to be ready */
+	err = clFinish(queue);
+	if (err != CL_SUCCESS) {
+		fprintf(stderr, "error: clFinish() %d %s\n", err, cl_strerror(err));
+		exit(EXIT_FAILURE);
+	}
+
+	best[0] = best[1] = 0;
+	tbest = -1;
+
+	for (i = 0; i < n; i++) {
+		t = -1;
+
+		for (r = 0; r < CLTUNE_REPS; r++) {
+			g[0] = global[0];
+			g[1] = dim == 2 ? global[1] : 0;
+			if (cand[i][0] != 0)
+				local_pad(dim, g, cand[i]);
+
+			t0 = prof_now();
+			err = clEnqueueNDRangeKernel(queue, kernel, dim, NULL, g, cand[i][0] != 0 ? cand[i] : NULL,
+						     0, NULL, NULL);
+			if (err == CL_SUCCESS)
+				err = clFinish(queue);
+			/* e.g. not enough registers or local memory for this size */
+			if (err != CL_SUCCESS)
+				break;
+
+			t0 = prof_now() - t0;
+			if (t < 0 || t0 < t)
+				t = t0;
+		}
+
+		if (err != CL_SUCCESS)
+			continue;
+
+		if (tbest < 0 || t < tbest) {
+			tbest = t;
+			best[0] = cand[i][0];
+			best[1] = cand[i][1];
+		}
+	}
+}
+
+/*
+ * Local size of `kernel' (called `name') over `global': the tuned one,
+ * the fastest of a sweep when tuning, or with `pick' one derived from
+ * the kernel and device limits. NULL lets the implementation choose.
+ * Otherwise `global' is padded to whole work-groups, the kernel has to
+ * skip work-items outside the image. `local' holds two sizes.
+ */
+const size_t *cltune_local(struct clrt *rt, cl_command_queue queue, cl_kernel kernel, const char *name,
+			   cl_uint dim, size_t *global, size_t *local, int pick)
+{
+	size_t kmax, pref, items[2], cand[CLTUNE_MAX_CANDIDATES][2];
+	struct cltune_entry *e;
+	struct cltune *t;
+	int sclass, n;
+
+	assert(rt != NULL);
+	assert(dim == 1 || dim == 2);
+
+	t = rt->tune;
+	sclass = size_class(dim, global);
+	kernel_limits(rt, kernel, &kmax, &pref, items);
+
+	e = t != NULL ? tune_get(t, name, sclass) : NULL;
+	/* from a build with other limits, tune again */
+	if (e != NULL && e->local[0]*(dim == 2 ? e->local[1] : 1) > kmax)
+		e = NULL;
+
+	if (e != NULL) {
+		local[0] = e->local[0];
+		local[1] = e->local[1];
+	} else if (t != NULL && t->sweep) {
+		n = local_candidates(kmax, pref, items, dim, cand);
+		local_sweep(queue, kernel, dim, global, cand, n, local);
+		tune_set(t, name, sclass, local);
+		t->dirty = TRUE;
+	} else if (pick) {
+		local_default(kmax, pref, items, dim, local);
+	} else {
+		return NULL;
+	}
+
+	if (local[0] == 0)
+		return NULL;
+
+	local_pad(dim, global, local);
+
+	return local;
+}
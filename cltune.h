@@ -0,0 +1,41 @@
+#ifndef CL_TUNE_H_
+#define CL_TUNE_H_
+
+#include <CL/cl.h>
+
+#include "clrt.h"
+
+#define CLTUNE_MAX_CANDIDATES 32
+#define CLTUNE_REPS 3
+
+/* fastest local size of a kernel for one class of global sizes */
+struct cltune_entry {
+	char *kernel;
+	int sclass;		/* ceil(log2(work-items)) */
+	size_t local[2];	/* local[0] == 0: the implementation picks */
+};
+
+/*
+ * Local work sizes per device, driver and kernel. Entries are read from
+ * and written to a file next to the cached program binaries; with
+ * `sweep' set the missing ones are timed on first use.
+ */
+struct cltune {
+	char *key;		/* clcache_device_key() */
+	char *dir;
+	char *path;		/* NULL: kept in memory only */
+	int sweep;
+	int dirty;
+
+	struct cltune_entry *entries;
+	int nentries;
+};
+
+struct cltune *cltune_new(cl_device_id device, const char *dir, int sweep);
+void cltune_save(struct cltune *t);
+void cltune_destroy(struct cltune *t);
+
+const size_t *cltune_local(struct clrt *rt, cl_command_queue queue, cl_kernel kernel, const char *name,
+			   cl_uint dim, size_t *global, size_t *local, int pick);
+
+#endif /* CL_TUNE_H_ */
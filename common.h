@@ -10,14 +10,32 @@
 #define TRUE !(FALSE)
 #endif
 
+/* luma weights 0.229, 0.587, 0.114 in 16.16 fixed point */
+#define GRAY_WR 15008
+#define GRAY_WG 38470
+#define GRAY_WB 7471
+#define GRAY_SHIFT 16
+
+#define GRAY_FIXED(r, g, b) \
+	((GRAY_WR*(unsigned int)(r) + GRAY_WG*(unsigned int)(g) + GRAY_WB*(unsigned int)(b)) >> GRAY_SHIFT)
+
 #define TAN_22 0.41421356237	/* 22.5  */
 #define TAN_67 2.41421356237	/* 67.5 */
 #define	TAN_112 -2.41421356237	/* 112.5 */
 #define	TAN_157 -0.41421356237	/* 157.5 */
 
+/* tangents in 16.16 fixed point, for integer direction tests */
+#define TAN_Q16(t) ((int)((t)*65536))
+
+/* values of a canny edge map */
+#define EDGE_NONE	0
+#define EDGE_WEAK	128
+#define EDGE_STRONG	255
+
 typedef enum {
 	TYPE_RGB,
-	TYPE_GRAY
+	TYPE_GRAY,
+	TYPE_PACKED	/* interleaved RGB or RGBA rows, e.g. pixbuf memory */
 } img_type_t;
 
 typedef enum {
@@ -28,6 +46,14 @@ typedef enum {
 	DIR_NEGATIVE_DIAG	/* 4 */
 } dir_type_t;
 
+/* pixels outside the image as the 5x5 blur sees them */
+typedef enum {
+	BORDER_COPY = 0,	/* border pixels keep their value */
+	BORDER_CLAMP,		/* edge repeated: aaa|abcd|ddd */
+	BORDER_MIRROR,		/* reflected with the edge: cba|abcd|dcb */
+	BORDER_WRAP		/* opposite edge: bcd|abcd|abc */
+} border_type_t;
+
 typedef enum {
 	RET_ERR = -1,
 	RET_OK = 0,
@@ -0,0 +1,369 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "conv.h"
+#include "xmalloc.h"
+
+/* made by gaussian.sh -n 5, shared by the OpenCL and the native backend */
+const int conv_gauss5[CONV_GAUSS5_DIM*CONV_GAUSS5_DIM] = {
+	1,4,7,4,1,
+	4,20,33,20,4,
+	7,33,55,33,7,
+	4,20,33,20,4,
+	1,4,7,4,1
+};
+
+static const int box3[] = {
+	1,1,1,
+	1,1,1,
+	1,1,1
+};
+
+static const int box5[] = {
+	1,1,1,1,1,
+	1,1,1,1,1,
+	1,1,1,1,1,
+	1,1,1,1,1,
+	1,1,1,1,1
+};
+
+static const int sharpen[] = {
+	0,-1,0,
+	-1,5,-1,
+	0,-1,0
+};
+
+static const int laplacian[] = {
+	0,1,0,
+	1,-4,1,
+	0,1,0
+};
+
+static const int emboss[] = {
+	-2,-1,0,
+	-1,1,1,
+	0,1,2
+};
+
+struct conv_builtin {
+	const char *name;
+	const int *wt;
+	int dim;
+	int div;
+};
+
+static const struct conv_builtin builtins[] = {
+	{ "gauss5", conv_gauss5, CONV_GAUSS5_DIM, CONV_GAUSS5_SUM },
+	{ "box3", box3, 3, 9 },
+	{ "box5", box5, 5, 25 },
+	{ "sharpen", sharpen, 3, 1 },
+	{ "laplacian", laplacian, 3, 1 },
+	{ "emboss", emboss, 3, 1 },
+};
+
+#define NBUILTINS (sizeof(builtins)/sizeof(builtins[0]))
+
+/* weights above this in total could round a partial sum of 8 bit pixels */
+#define CONV_EXACT_MAX ((1 << 24)/255)
+
+static int gcd(int a, int b)
+{
+	int t;
+
+	while (b != 0) {
+		t = a%b;
+		a = b;
+		b = t;
+	}
+
+	return a;
+}
+
+/*
+ * Rank one factorisation around the largest weight. Integer masks get
+ * integer factors, a row divided by its gcd, so the two passes give the
+ * same sums as the 2D mask; float ones are checked to a relative error.
+ */
+static void conv_separate(struct conv *c)
+{
+	float max, v;
+	int i, j, r, k, g;
+
+	if (c->w == 1 || c->h == 1)
+		return;
+
+	max = 0;
+	r = k = 0;
+	for (j = 0; j < c->h; j++) {
+		for (i = 0; i < c->w; i++) {
+			if (fabsf(c->wt[j*c->w + i]) > max) {
+				max = fabsf(c->wt[j*c->w + i]);
+				r = j;
+				k = i;
+			}
+		}
+	}
+
+	if (max == 0)
+		return;
+
+	if (c->div > 0) {
+		g = 0;
+		for (i = 0; i < c->w; i++)
+			g = gcd(g, abs((int)c->wt[r*c->w + i]));
+		for (i = 0; i < c->w; i++)
+			c->row[i] = (int)c->wt[r*c->w + i]/g;
+		for (j = 0; j < c->h; j++) {
+			if ((int)c->wt[j*c->w + k]%(int)c->row[k] != 0)
+				return;
+			c->col[j] = (int)c->wt[j*c->w + k]/(int)c->row[k];
+		}
+	} else {
+		for (i = 0; i < c->w; i++)
+			c->row[i] = c->wt[r*c->w + i]/c->wt[r*c->w + k];
+		for (j = 0; j < c->h; j++)
+			c->col[j] = c->wt[j*c->w + k];
+	}
+
+	for (j = 0; j < c->h; j++) {
+		for (i = 0; i < c->w; i++) {
+			v = c->col[j]*c->row[i];
+			if (c->div > 0 ? v != c->wt[j*c->w + i] : fabsf(v - c->wt[j*c->w + i]) > 1e-6f*max)
+				return;
+		}
+	}
+
+	c->separable = TRUE;
+}
+
+/* FNV-1a of the mask, so equal masks share their uploaded weights */
+static unsigned int conv_hash(const struct conv *c)
+{
+	const unsigned char *p;
+	unsigned int h;
+	size_t i, len;
+
+	h = 2166136261U;
+	p = (const unsigned char *)c->wt;
+	len = c->w*c->h*sizeof(*(c->wt));
+
+	for (i = 0; i < len; i++)
+		h = (h ^ p[i])*16777619U;
+
+	return h ^ (c->w << 16) ^ (c->h << 8) ^ c->div;
+}
+
+/*
+ * A mask of `w' x `h' weights, both odd. `div' > 0 makes an integer
+ * mask, its weights have to be whole numbers.
+ */
+struct conv *conv_new(const char *name, int w, int h, const float *wt, int div)
+{
+	struct conv *c;
+	float total;
+	int i;
+
+	if (w < 1 || h < 1 || w > CONV_MAX_DIM || h > CONV_MAX_DIM || w%2 == 0 || h%2 == 0) {
+		fprintf(stderr, "error: mask %s is %dx%d, edges must be odd and at most %d\n",
+			name, w, h, CONV_MAX_DIM);
+		return NULL;
+	}
+
+	if (div < 0) {
+		fprintf(stderr, "error: mask %s has a negative divisor\n", name);
+		return NULL;
+	}
+
+	total = 0;
+	for (i = 0; i < w*h; i++) {
+		if (div > 0 && wt[i] != floorf(wt[i])) {
+			fprintf(stderr, "error: integer mask %s has weight %g\n", name, wt[i]);
+			return NULL;
+		}
+		total += fabsf(wt[i]);
+	}
+
+	if (div > 0 && total > CONV_EXACT_MAX) {
+		fprintf(stderr, "error: weights of mask %s add up to more than %d\n", name, CONV_EXACT_MAX);
+		return NULL;
+	}
+
+	c = xmalloc0(sizeof(*c));
+	snprintf(c->name, sizeof(c->name), "%s", name);
+	c->w = w;
+	c->h = h;
+	c->div = div;
+	memcpy(c->wt, wt, w*h*sizeof(*wt));
+
+	conv_separate(c);
+	snprintf(c->key, sizeof(c->key), "conv:%08x", conv_hash(c));
+
+	return c;
+}
+
+/* gauss5, box3, box5, sharpen, laplacian or emboss, NULL if unknown */
+struct conv *conv_builtin(const char *name)
+{
+	const struct conv_builtin *b;
+	float wt[CONV_MAX_DIM*CONV_MAX_DIM];
+	size_t i;
+	int j;
+
+	for (i = 0; i < NBUILTINS; i++) {
+		b = &builtins[i];
+		if (strcmp(b->name, name) != 0)
+			continue;
+
+		for (j = 0; j < b->dim*b->dim; j++)
+			wt[j] = b->wt[j];
+
+		return conv_new(b->name, b->dim, b->dim, wt, b->div);
+	}
+
+	return NULL;
+}
+
+/*
+ * Rows of weights end at a newline or `;', weights are separated by
+ * blanks or `,' and `#' starts a comment. `/ d' divides the mask. Whole
+ * weights make an integer mask, divided by their sum unless given.
+ */
+static struct conv *conv_read(const char *name, const char *text)
+{
+	float wt[CONV_MAX_DIM*CONV_MAX_DIM], v, d, total;
+	const char *p;
+	char *end;
+	int i, w, h, n, integer;
+
+	w = h = n = 0;
+	d = 0;
+	integer = TRUE;
+
+	for (p = text;; p++) {
+		if (*p == '#') {
+			while (*p != '\0' && *p != '\n')
+				p++;
+		}
+
+		if (*p == '\0' || *p == '\n' || *p == ';') {
+			if (n > 0) {
+				if (w == 0)
+					w = n;
+				if (n != w) {
+					fprintf(stderr, "error: mask %s: row %d has %d weights, not %d\n",
+						name, h + 1, n, w);
+					return NULL;
+				}
+				h++;
+				n = 0;
+			}
+			if (*p == '\0')
+				break;
+			continue;
+		}
+
+		if (isspace((unsigned char)*p) || *p == ',')
+			continue;
+
+		if (*p == '/') {
+			d = strtof(p + 1, &end);
+			if (end == p + 1 || d <= 0) {
+				fprintf(stderr, "error: mask %s: divisor must be positive\n", name);
+				return NULL;
+			}
+			integer &= d == floorf(d);
+			p = end - 1;
+			continue;
+		}
+
+		v = strtof(p, &end);
+		if (end == p) {
+			fprintf(stderr, "error: mask %s: unexpected `%c'\n", name, *p);
+			return NULL;
+		}
+
+		if (h >= CONV_MAX_DIM || n >= CONV_MAX_DIM) {
+			fprintf(stderr, "error: mask %s is larger than %dx%d\n", name, CONV_MAX_DIM, CONV_MAX_DIM);
+			return NULL;
+		}
+
+		wt[h*CONV_MAX_DIM + n++] = v;
+		integer &= v == floorf(v);
+		p = end - 1;
+	}
+
+	if (h == 0) {
+		fprintf(stderr, "error: mask %s has no weights\n", name);
+		return NULL;
+	}
+
+	/* rows were stored CONV_MAX_DIM apart */
+	total = 0;
+	for (i = 0; i < w*h; i++) {
+		wt[i] = wt[i/w*CONV_MAX_DIM + i%w];
+		total += wt[i];
+	}
+
+	if (integer)
+		return conv_new(name, w, h, wt, d > 0 ? (int)d : (total > 0 ? (int)total : 1));
+
+	for (i = 0; d > 0 && i < w*h; i++)
+		wt[i] /= d;
+
+	return conv_new(name, w, h, wt, 0);
+}
+
+struct conv *conv_load(const char *fname)
+{
+	struct conv *c;
+	FILE *file;
+	char *buf;
+	long size;
+
+	file = fopen(fname, "r");
+	if (file == NULL) {
+		fprintf(stderr, "error: unable to open %s\n", fname);
+		return NULL;
+	}
+
+	if (fseek(file, 0, SEEK_END) == -1 || (size = ftell(file)) < 0 || fseek(file, 0, SEEK_SET) == -1) {
+		fprintf(stderr, "error: unable to read %s\n", fname);
+		fclose(file);
+		return NULL;
+	}
+
+	buf = xmalloc(size + 1);
+	size = fread(buf, 1, size, file);
+	buf[size] = '\0';
+	fclose(file);
+
+	c = conv_read(fname, buf);
+	xfree(buf);
+
+	return c;
+}
+
+/* a built-in name, a mask file or the weights themselves, e.g. "1,2,1;2,4,2;1,2,1" */
+struct conv *conv_parse(const char *spec)
+{
+	struct conv *c;
+
+	c = conv_builtin(spec);
+	if (c != NULL)
+		return c;
+
+	if (access(spec, R_OK) == 0)
+		return conv_load(spec);
+
+	return conv_read("inline", spec);
+}
+
+void conv_destroy(struct conv *c)
+{
+	xfree(c);
+}
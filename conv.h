@@ -0,0 +1,56 @@
+#ifndef CONV_H_
+#define CONV_H_
+
+/* largest mask edge, odd */
+#define CONV_MAX_DIM 31
+
+/* more weights than this are convolved from local memory tiles */
+#define CONV_CONST_MAX 49
+
+/* the 5x5 gaussian of the fixed blur stage */
+#define CONV_GAUSS5_DIM 5
+#define CONV_GAUSS5_SUM 331
+
+extern const int conv_gauss5[CONV_GAUSS5_DIM*CONV_GAUSS5_DIM];
+
+/*
+ * A w x h convolution mask. Integer masks (`div' > 0) give sum/div
+ * truncated, float masks (`div' == 0) the sum rounded; both clamped to
+ * 0..255. Integer weights are kept as floats too: every partial sum is
+ * an integer below 2^24 and exact, on the host and on the device alike.
+ */
+struct conv {
+	char name[32];
+	char key[32];		/* names the uploaded weights */
+	int w;
+	int h;
+	int div;
+	float wt[CONV_MAX_DIM*CONV_MAX_DIM];
+
+	/* rank one masks: wt[j*w + i] == col[j]*row[i] */
+	int separable;
+	float row[CONV_MAX_DIM];
+	float col[CONV_MAX_DIM];
+};
+
+struct conv *conv_new(const char *name, int w, int h, const float *wt, int div);
+struct conv *conv_builtin(const char *name);
+struct conv *conv_load(const char *fname);
+struct conv *conv_parse(const char *spec);
+void conv_destroy(struct conv *c);
+
+/* truncated sum/div or rounded sum, as conv_result() of img.cl */
+static inline unsigned char conv_result(float summ, int div)
+{
+	int v;
+
+	if (div > 0) {
+		v = (int)summ/div;
+		return v < 0 ? 0 : (v > 255 ? 255 : v);
+	}
+
+	summ += 0.5f;
+	return summ <= 0.0f ? 0 : (summ >= 255.0f ? 255 : (unsigned char)summ);
+}
+
+#endif /* CONV_H_ */
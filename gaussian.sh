@@ -1,7 +1,9 @@
 #!/bin/sh
 
 #
-# ./gaussian.sh -n N
+# ./gaussian.sh -n N > gaussN.conv
+#
+# Writes an N x N gaussian mask for `image -K gaussN.conv'.
 #
 
 OCTAVE=$(which octave)
@@ -79,19 +81,13 @@ match($0, /gauss_dim[[:space:]]+([[:digit:]]+)$/, arr) {
 }
 
 END {
-	printf("#ifndef GAUSS_H_\n")
-	printf("#define GAUSS_H_\n")
-	printf("\nint gauss[] = {\n")
-	
+	printf("# %dx%d gaussian, made by gaussian.sh\n", dim, dim)
+
 	for (i = 1; i <= length(rows); i++) {
-		gsub(/[[:space:]]/, ",", rows[i])
-		comma = i == length(rows) ? "": ","
-		printf("\t%s%s\n", rows[i], comma)
+		gsub(/^[[:space:]]+|[[:space:]]+$/, "", rows[i])
+		printf("%s\n", rows[i])
 	}
 
-	printf("};\n\n")
-	printf("int gauss_sum = %d;\n", sum)
-	printf("int gauss_dim = %d;\n", dim)
-	printf("\n#endif /* GAUSS_H_ */\n")
+	printf("/ %d\n", sum)
 }
 ' 
@@ -3,67 +3,361 @@
 #include <string.h>
 #include <assert.h>
 #include <unistd.h>
+#include <math.h>
+#include <pthread.h>
 
 #include "xmalloc.h"
 #include "img.h"
 
 struct img_ctx *img_ctx_new(int w, int h, img_type_t type, color_type_t color)
 {
-	struct img_ctx *c;
-	int len;
+	return img_ctx_new_flags(w, h, type, color, 0);
+}
 
-	c = xmalloc(sizeof(*c));
-	
-	c->type = type;
-	c->w = w;
-	c->h = h;
+/* bytes per row of a plane, whole cache lines with IMG_F_PADDED */
+static int img_pitch(int w, img_type_t type, int flags)
+{
+	int row;
+
+	row = type == TYPE_PACKED ? 3*w : w;
+	if (flags & IMG_F_PADDED)
+		row = (row + IMG_ALIGN - 1)/IMG_ALIGN*IMG_ALIGN;
+
+	return row;
+}
 
-	len = w*h;
-		
+/* pixels of `h' rows of `pitch' bytes in one block, RGB planes back to back */
+static size_t img_size(int pitch, int h, img_type_t type)
+{
 	switch (type) {
 	case TYPE_GRAY:
-		c->pix = xmalloc0(len*sizeof(*(c->pix)));
-		/* initialize pixels to spcified color */
-		if (color != C_NONE)
-			memset(c->pix, color, len*sizeof(*(c->pix)));
-		break;
+	case TYPE_PACKED:
+		return (size_t)pitch*h;
 	case TYPE_RGB:
-		c->r = xmalloc(len*sizeof(*(c->r)));
-		c->g = xmalloc(len*sizeof(*(c->g)));
-		c->b = xmalloc(len*sizeof(*(c->b)));
+		return 3*(size_t)pitch*h;
+	default:
+		abort();
+	}
+}
+
+/* whole units of `align', SIMD tails never leave the block */
+static unsigned char *img_alloc(size_t size, size_t align)
+{
+	return xmemalign(align, (size + align - 1)/align*align);
+}
+
+static void img_planes(struct img_ctx *c, unsigned char *pix, int flags)
+{
+	c->pix = pix;
+	c->pitch = img_pitch(c->w, c->type, flags);
+
+	switch (c->type) {
+	case TYPE_RGB:
+		c->g = c->r + (size_t)c->pitch*c->h;
+		c->b = c->g + (size_t)c->pitch*c->h;
+		break;
+	case TYPE_PACKED:
+		c->nchan = 3;
 		break;
 	default:
-		abort();	 
-	}	
+		break;
+	}
+}
+
+/*
+ * The pixels are one block on a cache line, or a page with IMG_F_ALIGNED
+ * so the block can be handed to a CPU OpenCL device with
+ * CL_MEM_USE_HOST_PTR and used there without a copy. IMG_F_NOZERO leaves
+ * them as allocated, for planes that are overwritten anyway, and
+ * IMG_F_PADDED starts every row on a cache line. Packed images have
+ * three channels.
+ */
+struct img_ctx *img_ctx_new_flags(int w, int h, img_type_t type, color_type_t color, int flags)
+{
+	struct img_ctx *c;
+	size_t size;
+
+	c = xmalloc0(sizeof(*c));
+	
+	c->type = type;
+	c->w = w;
+	c->h = h;
+	c->flags = flags & IMG_F_ALIGNED;
+
+	size = img_size(img_pitch(w, type, flags), h, type);
+	img_planes(c, img_alloc(size, flags & IMG_F_ALIGNED ? (size_t)sysconf(_SC_PAGESIZE) : IMG_ALIGN),
+		   flags);
+
+	/* initialize pixels to spcified color */
+	if (color != C_NONE)
+		memset(c->pix, color, size);
+	else if (!(flags & IMG_F_NOZERO))
+		memset(c->pix, 0, size);
 
 	return c;
 }
 
+/*
+ * Rows of `pitch' bytes in memory owned by someone else, e.g. pixbuf
+ * rows with their padding; nothing is copied. One channel makes a gray
+ * image, 3 or 4 an interleaved one.
+ */
+struct img_ctx *img_ctx_wrap(unsigned char *pix, int w, int h, int pitch, int nchan)
+{
+	struct img_ctx *c;
+
+	assert(pix != NULL);
+	assert(nchan == 1 || nchan == 3 || nchan == 4);
+	assert(pitch >= w*nchan);
+
+	c = xmalloc0(sizeof(*c));
+
+	c->type = nchan == 1 ? TYPE_GRAY : TYPE_PACKED;
+	c->w = w;
+	c->h = h;
+	c->flags = IMG_F_FOREIGN;
+	c->nchan = nchan == 1 ? 0 : nchan;
+	c->pitch = pitch;
+	c->pix = pix;
+
+	return c;
+}
+
+/*
+ * The `w' x `h' rectangle at `x', `y' of `src' as an image sharing its
+ * pixels, rows keep the pitch of `src'. Destroying `src' ends it.
+ */
+void img_ctx_roi(struct img_ctx *src, int x, int y, int w, int h, struct img_ctx *roi)
+{
+	size_t off;
+
+	assert(src != NULL);
+	assert(roi != NULL);
+	assert(x >= 0 && w > 0 && x + w <= src->w);
+	assert(y >= 0 && h > 0 && y + h <= src->h);
+
+	*roi = *src;
+	roi->w = w;
+	roi->h = h;
+	roi->flags = IMG_F_FOREIGN;
+	roi->release = NULL;
+	roi->data = NULL;
+
+	off = (size_t)y*src->pitch + (src->type == TYPE_PACKED ? x*src->nchan : x);
+
+	if (src->type == TYPE_RGB) {
+		roi->r = src->r + off;
+		roi->g = src->g + off;
+		roi->b = src->b + off;
+	} else {
+		roi->pix = src->pix + off;
+	}
+}
+
+/* rows [y0, y0 + h) of `src' as an image sharing its pixels */
+void img_ctx_band(struct img_ctx *src, int y0, int h, struct img_ctx *band)
+{
+	assert(src != NULL);
+
+	img_ctx_roi(src, 0, y0, src->w, h, band);
+}
+
+/* pixels of `src' into `dst' of the same size and type, row by row */
+void img_ctx_copy(struct img_ctx *src, struct img_ctx *dst)
+{
+	unsigned char *s[3], *d[3];
+	size_t row;
+	int i, n, y;
+
+	assert(src != NULL);
+	assert(dst != NULL);
+	assert(src->type == dst->type && src->w == dst->w && src->h == dst->h);
+	assert(src->type != TYPE_PACKED || src->nchan == dst->nchan);
+
+	if (src->pix == dst->pix)
+		return;
+
+	if (src->type == TYPE_RGB) {
+		n = 3;
+		s[0] = src->r;
+		s[1] = src->g;
+		s[2] = src->b;
+		d[0] = dst->r;
+		d[1] = dst->g;
+		d[2] = dst->b;
+	} else {
+		n = 1;
+		s[0] = src->pix;
+		d[0] = dst->pix;
+	}
+
+	row = img_row_size(src);
+
+	for (i = 0; i < n; i++) {
+		if (img_compact(src) && img_compact(dst)) {
+			memcpy(d[i], s[i], row*src->h);
+			continue;
+		}
+		for (y = 0; y < src->h; y++)
+			memcpy(d[i] + (size_t)y*dst->pitch, s[i] + (size_t)y*src->pitch, row);
+	}
+}
+
 void img_destroy_ctx(struct img_ctx *ctx)
 {
 	assert(ctx != NULL);
 
-	switch (ctx->type) {
-	case TYPE_GRAY:
-		if (ctx->pix != NULL)
-			xfree(ctx->pix);
-		break;
-	case TYPE_RGB:
-		if (ctx->r != NULL)
-			xfree(ctx->r);
-		if (ctx->g != NULL)
-			xfree(ctx->g);
-		if (ctx->b != NULL)
-			xfree(ctx->b);
-		break;
-	default:
-		fprintf(stderr, "error: uknown type\n");
-		assert(0);
+	if (ctx->flags & IMG_F_FOREIGN) {
+		if (ctx->release != NULL)
+			ctx->release(ctx->data);
+		xfree(ctx);
+		return;
 	}
 
+	/* one block for all planes */
+	xfree(ctx->pix);
 	xfree(ctx);
 }
 
+/* blocks of destroyed images kept for the next ones of the same class */
+struct img_block {
+	struct img_pool *pool;
+	unsigned char *mem;
+	size_t size;
+	size_t align;
+	struct img_block *next;
+};
+
+struct img_pool {
+	pthread_mutex_t lock;
+	struct img_block *free;
+	int nfree;
+	int nout;		/* blocks held by images */
+};
+
+struct img_pool *img_pool_new(void)
+{
+	struct img_pool *pool;
+
+	pool = xmalloc0(sizeof(*pool));
+	pthread_mutex_init(&pool->lock, NULL);
+
+	return pool;
+}
+
+/*
+ * Quarter steps between powers of two, so images a little apart in size
+ * share blocks and at most a fifth of a block goes unused.
+ */
+static size_t pool_class(size_t size)
+{
+	size_t p, q;
+
+	p = IMG_POOL_MIN;
+	while (p < size)
+		p *= 2;
+
+	if (p == IMG_POOL_MIN)
+		return p;
+
+	q = p/8;
+
+	return (size + q - 1)/q*q;
+}
+
+static void pool_release(void *data)
+{
+	struct img_block *b;
+	struct img_pool *pool;
+
+	b = data;
+	pool = b->pool;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->nout--;
+	if (pool->nfree < IMG_POOL_MAX) {
+		b->next = pool->free;
+		pool->free = b;
+		pool->nfree++;
+		b = NULL;
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	if (b != NULL) {
+		xfree(b->mem);
+		xfree(b);
+	}
+}
+
+/*
+ * An image as img_ctx_new_flags() makes, its block taken from `pool'
+ * and given back by img_destroy_ctx(). The pixels are not initialized,
+ * IMG_F_PADDED pads the rows.
+ * Packed images have three channels. Safe to call from several threads.
+ */
+struct img_ctx *img_pool_get(struct img_pool *pool, int w, int h, img_type_t type, int flags)
+{
+	struct img_block *b, **pb;
+	struct img_ctx *c;
+	size_t size, align;
+
+	assert(pool != NULL);
+
+	size = pool_class(img_size(img_pitch(w, type, flags), h, type));
+	align = flags & IMG_F_ALIGNED ? (size_t)sysconf(_SC_PAGESIZE) : IMG_ALIGN;
+
+	pthread_mutex_lock(&pool->lock);
+	for (pb = &pool->free; *pb != NULL; pb = &(*pb)->next) {
+		if ((*pb)->size == size && (*pb)->align >= align)
+			break;
+	}
+	b = *pb;
+	if (b != NULL) {
+		*pb = b->next;
+		pool->nfree--;
+	}
+	pool->nout++;
+	pthread_mutex_unlock(&pool->lock);
+
+	if (b == NULL) {
+		b = xmalloc(sizeof(*b));
+		b->pool = pool;
+		b->mem = img_alloc(size, align);
+		b->size = size;
+		b->align = align;
+	}
+
+	c = xmalloc0(sizeof(*c));
+
+	c->type = type;
+	c->w = w;
+	c->h = h;
+	c->flags = IMG_F_FOREIGN | (flags & IMG_F_ALIGNED);
+	c->release = pool_release;
+	c->data = b;
+	img_planes(c, b->mem, flags);
+
+	return c;
+}
+
+/* every image of the pool has to be destroyed already */
+void img_pool_destroy(struct img_pool *pool)
+{
+	struct img_block *b;
+
+	assert(pool != NULL);
+	assert(pool->nout == 0);
+
+	while ((b = pool->free) != NULL) {
+		pool->free = b->next;
+		xfree(b->mem);
+		xfree(b);
+	}
+
+	pthread_mutex_destroy(&pool->lock);
+	xfree(pool);
+}
+
 /* gradient constructor
  */
 struct img_gradient *img_gradient_new(struct img_ctx *ctx)
@@ -77,7 +371,7 @@ struct img_gradient *img_gradient_new(struct img_ctx *ctx)
 			
 	g->w = ctx->w;
 	g->h = ctx->h;		
-	size = ctx->w*ctx->h;
+	size = (size_t)ctx->w*ctx->h;
 
 	/* magnitude and direction of gradient at every point */
 	g->gmag = xmalloc(size*sizeof(*(g->gmag)));
@@ -97,3 +391,52 @@ void img_gradient_destroy(struct img_gradient *g)
 
 	xfree(g);
 }
+
+/* reference for the fixed point grayscale kernels */
+void img_grayscale_fixed(struct img_ctx *rgb, struct img_ctx *gray)
+{
+	int x, y, i, o;
+
+	assert(rgb != NULL);
+	assert(gray != NULL);
+	assert(rgb->type == TYPE_RGB);
+	assert(gray->type == TYPE_GRAY);
+
+	for (y = 0; y < rgb->h; y++) {
+		i = y*rgb->pitch;
+		o = y*gray->pitch;
+		for (x = 0; x < rgb->w; x++)
+			gray->pix[o + x] = GRAY_FIXED(rgb->r[i + x], rgb->g[i + x], rgb->b[i + x]);
+	}
+}
+
+/* radius covering +-3 sigma, i.e. 99.7% of the distribution */
+int img_gauss_radius(float sigma)
+{
+	assert(sigma > 0);
+
+	return (int)ceil(3*sigma);
+}
+
+/* normalized 1D gaussian of 2*radius + 1 taps, centre at index radius */
+float *img_gauss_kernel1d(float sigma, int radius)
+{
+	float *k, sum;
+	int i;
+
+	assert(sigma > 0);
+	assert(radius >= 0);
+
+	k = xmalloc((2*radius + 1)*sizeof(*k));
+	sum = 0;
+
+	for (i = -radius; i <= radius; i++) {
+		k[i + radius] = expf(-(i*i)/(2*sigma*sigma));
+		sum += k[i + radius];
+	}
+
+	for (i = 0; i < 2*radius + 1; i++)
+		k[i] /= sum;
+
+	return k;
+}
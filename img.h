@@ -3,10 +3,25 @@
 
 #include "common.h"
 
+#define IMG_F_FOREIGN	(1 << 0)	/* pixels are not owned by the context */
+#define IMG_F_ALIGNED	(1 << 1)	/* page aligned, RGB planes contiguous */
+#define IMG_F_NOZERO	(1 << 2)	/* img_ctx_new_flags(): pixels left uninitialized */
+#define IMG_F_PADDED	(1 << 3)	/* img_ctx_new_flags(): rows start on IMG_ALIGN */
+
+/* start of every pixel block and of padded rows, a cache line */
+#define IMG_ALIGN	64
+
+/* img_pool: smallest block and free blocks kept */
+#define IMG_POOL_MIN	4096
+#define IMG_POOL_MAX	16
+
 struct img_ctx {
 	img_type_t type;
 	int w;
 	int h;
+	int flags;
+	int nchan;	/* TYPE_PACKED: channels per pixel, 3 or 4 */
+	int pitch;	/* bytes from a row to the next, of each plane for TYPE_RGB */
 	union {
 		struct {
 			unsigned char *r;
@@ -15,6 +30,9 @@ struct img_ctx {
 		};
 		unsigned char *pix;
 	};
+	/* IMG_F_FOREIGN: lets go of the pixels when the context is destroyed */
+	void (*release)(void *data);
+	void *data;
 };
 
 struct img_gradient {
@@ -24,9 +42,34 @@ struct img_gradient {
 	int *gdir;		/* gradient directions */
 };
 
+struct img_pool;
+
+/* bytes of pixels in a row of one plane */
+static inline int img_row_size(const struct img_ctx *c)
+{
+	return c->type == TYPE_PACKED ? c->w*c->nchan : c->w;
+}
+
+/* rows without padding, each plane is one run of pixels */
+static inline int img_compact(const struct img_ctx *c)
+{
+	return c->pitch == img_row_size(c);
+}
+
 struct img_ctx *img_ctx_new(int w, int h, img_type_t type, color_type_t fill);
+struct img_ctx *img_ctx_new_flags(int w, int h, img_type_t type, color_type_t fill, int flags);
+struct img_ctx *img_ctx_wrap(unsigned char *pix, int w, int h, int pitch, int nchan);
+void img_ctx_band(struct img_ctx *src, int y0, int h, struct img_ctx *band);
+void img_ctx_roi(struct img_ctx *src, int x, int y, int w, int h, struct img_ctx *roi);
+void img_ctx_copy(struct img_ctx *src, struct img_ctx *dst);
 void img_destroy_ctx(struct img_ctx *ctx);
+struct img_pool *img_pool_new(void);
+struct img_ctx *img_pool_get(struct img_pool *pool, int w, int h, img_type_t type, int flags);
+void img_pool_destroy(struct img_pool *pool);
 struct img_gradient *img_gradient_new(struct img_ctx *ctx);
 void img_gradient_destroy(struct img_gradient *g);
+void img_grayscale_fixed(struct img_ctx *rgb, struct img_ctx *gray);
+int img_gauss_radius(float sigma);
+float *img_gauss_kernel1d(float sigma, int radius);
 
 #endif /* IMAGE_H_ */
@@ -0,0 +1,569 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <assert.h>
+#include <unistd.h>
+
+#include <png.h>
+#ifdef HAVE_GDK_PIXBUF
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#endif
+
+#include "common.h"
+#include "img_io.h"
+#include "xmalloc.h"
+
+/* a whole file in memory */
+struct img_map {
+	unsigned char *base;
+	size_t size;
+};
+
+void img_io_init(struct img_io *io)
+{
+	assert(io != NULL);
+
+	io->level = -1;
+	io->bits = 8;
+	io->raw_w = 0;
+	io->raw_h = 0;
+	io->pool = NULL;
+}
+
+/* extension without the dot, "" if there is none */
+static const char *file_ext(const char *fname)
+{
+	const char *p;
+
+	p = strrchr(fname, '.');
+	if (p == NULL || strchr(p, '/') != NULL)
+		return "";
+
+	return p + 1;
+}
+
+static void map_release(void *data)
+{
+	struct img_map *m;
+
+	m = data;
+	munmap(m->base, m->size);
+	xfree(m);
+}
+
+/*
+ * Mapped copy-on-write, so the pixels can be handed to a device with
+ * CL_MEM_USE_HOST_PTR like any other host memory.
+ */
+static struct img_map *map_file(const char *fname)
+{
+	struct img_map *m;
+	struct stat sb;
+	void *base;
+	int fd;
+
+	fd = open(fname, O_RDONLY);
+	if (fd == -1) {
+		fprintf(stderr, "error: %s: %s\n", fname, strerror(errno));
+		return NULL;
+	}
+
+	if (fstat(fd, &sb) == -1) {
+		fprintf(stderr, "error: %s: %s\n", fname, strerror(errno));
+		close(fd);
+		return NULL;
+	}
+
+	if (sb.st_size == 0) {
+		fprintf(stderr, "error: %s: empty file\n", fname);
+		close(fd);
+		return NULL;
+	}
+
+	base = mmap(NULL, sb.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (base == MAP_FAILED) {
+		fprintf(stderr, "error: %s: %s\n", fname, strerror(errno));
+		return NULL;
+	}
+
+	m = xmalloc(sizeof(*m));
+	m->base = base;
+	m->size = sb.st_size;
+
+	return m;
+}
+
+/* image over the mapped pixels, the mapping goes with it */
+static struct img_ctx *map_ctx(struct img_map *m, unsigned char *pix, img_type_t type, int w, int h)
+{
+	struct img_ctx *c;
+
+	c = xmalloc0(sizeof(*c));
+
+	c->type = type;
+	c->w = w;
+	c->h = h;
+	c->flags = IMG_F_FOREIGN;
+	c->pitch = w;
+	c->pix = pix;
+	c->release = map_release;
+	c->data = m;
+
+	/* planes back to back from the start of the mapping */
+	if (type == TYPE_RGB) {
+		c->flags |= IMG_F_ALIGNED;
+		c->g = c->r + (size_t)w*h;
+		c->b = c->g + (size_t)w*h;
+	}
+
+	return c;
+}
+
+/* next header number of a PNM file, comments and blanks skipped */
+static int pnm_int(struct img_map *m, size_t *pos, int *v)
+{
+	const unsigned char *p;
+	size_t i;
+
+	p = m->base;
+	i = *pos;
+
+	for (;;) {
+		while (i < m->size && (p[i] == ' ' || p[i] == '\t' || p[i] == '\r' || p[i] == '\n'))
+			i++;
+		if (i >= m->size || p[i] != '#')
+			break;
+		while (i < m->size && p[i] != '\n')
+			i++;
+	}
+
+	if (i >= m->size || p[i] < '0' || p[i] > '9')
+		return RET_ERR;
+
+	*v = 0;
+	while (i < m->size && p[i] >= '0' && p[i] <= '9') {
+		if (*v > (1 << 24))
+			return RET_ERR;
+		*v = *v*10 + p[i++] - '0';
+	}
+
+	*pos = i;
+
+	return RET_OK;
+}
+
+/* binary PGM (P5) and PPM (P6), the pixels are used where they are mapped */
+static struct img_ctx *read_pnm(const char *fname, struct img_map *m)
+{
+	struct img_ctx *c;
+	size_t pos;
+	int w, h, max, nchan;
+
+	nchan = m->base[1] == '6' ? 3 : 1;
+	pos = 2;
+
+	if (pnm_int(m, &pos, &w) != RET_OK || pnm_int(m, &pos, &h) != RET_OK ||
+	    pnm_int(m, &pos, &max) != RET_OK || w == 0 || h == 0 || pos >= m->size) {
+		fprintf(stderr, "error: %s: bad PNM header\n", fname);
+		map_release(m);
+		return NULL;
+	}
+
+	if (max != 255) {
+		fprintf(stderr, "error: %s: maxval %d, only 8 bit samples are supported\n", fname, max);
+		map_release(m);
+		return NULL;
+	}
+
+	/* a single blank ends the header */
+	pos++;
+
+	if (m->size - pos < (size_t)w*h*nchan) {
+		fprintf(stderr, "error: %s: truncated image\n", fname);
+		map_release(m);
+		return NULL;
+	}
+
+	if (nchan == 1)
+		return map_ctx(m, m->base + pos, TYPE_GRAY, w, h);
+
+	c = img_ctx_wrap(m->base + pos, w, h, w*nchan, nchan);
+	c->release = map_release;
+	c->data = m;
+
+	return c;
+}
+
+/* headerless planes: .gray is one, .rgb three back to back */
+static struct img_ctx *read_raw(const char *fname, struct img_map *m, img_type_t type, int w, int h)
+{
+	size_t len;
+
+	len = (size_t)w*h*(type == TYPE_RGB ? 3 : 1);
+	if (m->size != len) {
+		fprintf(stderr, "error: %s: %zu bytes, a %dx%d image has %zu\n", fname, m->size, w, h, len);
+		map_release(m);
+		return NULL;
+	}
+
+	return map_ctx(m, m->base, type, w, h);
+}
+
+/*
+ * Decoded by libpng into a packed RGB or a gray image. Alpha is composed
+ * onto black, never onto what the pool block held before.
+ */
+static struct img_ctx *read_png(const char *fname, struct img_map *m, struct img_pool *pool)
+{
+	static const png_color black = {0, 0, 0};
+	struct img_ctx *c;
+	img_type_t type;
+	png_image png;
+
+	memset(&png, 0, sizeof(png));
+	png.version = PNG_IMAGE_VERSION;
+
+	if (!png_image_begin_read_from_memory(&png, m->base, m->size)) {
+		fprintf(stderr, "error: %s: %s\n", fname, png.message);
+		map_release(m);
+		return NULL;
+	}
+
+	png.format = png.format & PNG_FORMAT_FLAG_COLOR ? PNG_FORMAT_RGB : PNG_FORMAT_GRAY;
+	type = png.format == PNG_FORMAT_RGB ? TYPE_PACKED : TYPE_GRAY;
+
+	if (pool != NULL)
+		c = img_pool_get(pool, png.width, png.height, type, 0);
+	else
+		c = img_ctx_new_flags(png.width, png.height, type, C_NONE, IMG_F_NOZERO);
+
+	/* the stride counts samples, a byte each */
+	if (!png_image_finish_read(&png, &black, c->pix, c->pitch, NULL)) {
+		fprintf(stderr, "error: %s: %s\n", fname, png.message);
+		png_image_free(&png);
+		img_destroy_ctx(c);
+		c = NULL;
+	}
+
+	map_release(m);
+
+	return c;
+}
+
+#ifdef HAVE_GDK_PIXBUF
+static void pixbuf_release(void *data)
+{
+	g_object_unref(G_OBJECT(data));
+}
+
+/* anything else gdk-pixbuf can load, its rows are used as they are */
+static struct img_ctx *read_pixbuf(const char *fname)
+{
+	GdkPixbuf *pbuf;
+	GError *error = NULL;
+	struct img_ctx *c;
+
+	pbuf = gdk_pixbuf_new_from_file(fname, &error);
+	if (pbuf == NULL) {
+		fprintf(stderr, "error: %s: %s\n", fname, error->message);
+		g_error_free(error);
+		return NULL;
+	}
+
+	c = img_ctx_wrap(gdk_pixbuf_get_pixels(pbuf), gdk_pixbuf_get_width(pbuf),
+			 gdk_pixbuf_get_height(pbuf), gdk_pixbuf_get_rowstride(pbuf),
+			 gdk_pixbuf_get_n_channels(pbuf));
+	c->release = pixbuf_release;
+	c->data = pbuf;
+
+	return c;
+}
+#endif
+
+/*
+ * PGM, PPM and raw planes are mapped and not copied, PNG is decoded by
+ * libpng, other formats need gdk-pixbuf. NULL if the image cannot be
+ * read; gray, packed RGB or planar RGB otherwise.
+ */
+struct img_ctx *img_read(const char *fname, const struct img_io *io)
+{
+	struct img_map *m;
+	const char *ext;
+
+	assert(fname != NULL);
+	assert(io != NULL);
+
+	ext = file_ext(fname);
+
+	if (strcasecmp(ext, "gray") == 0 || strcasecmp(ext, "rgb") == 0) {
+		if (io->raw_w <= 0 || io->raw_h <= 0) {
+			fprintf(stderr, "error: %s: the size of raw images is not given\n", fname);
+			return NULL;
+		}
+		m = map_file(fname);
+		if (m == NULL)
+			return NULL;
+		return read_raw(fname, m, strcasecmp(ext, "rgb") == 0 ? TYPE_RGB : TYPE_GRAY,
+				io->raw_w, io->raw_h);
+	}
+
+	m = map_file(fname);
+	if (m == NULL)
+		return NULL;
+
+	if (m->size > 2 && m->base[0] == 'P' && (m->base[1] == '5' || m->base[1] == '6'))
+		return read_pnm(fname, m);
+
+	if (m->size >= 8 && png_sig_cmp(m->base, 0, 8) == 0)
+		return read_png(fname, m, io->pool);
+
+	map_release(m);
+
+#ifdef HAVE_GDK_PIXBUF
+	return read_pixbuf(fname);
+#else
+	fprintf(stderr, "error: %s: unknown format, PNG, PGM, PPM or raw without gdk-pixbuf\n", fname);
+	return NULL;
+#endif
+}
+
+static int close_file(FILE *file, const char *fname)
+{
+	int err;
+
+	err = ferror(file);
+	if (fclose(file) != 0 || err) {
+		fprintf(stderr, "error: failed to write %s\n", fname);
+		return RET_ERR;
+	}
+
+	return RET_OK;
+}
+
+/*
+ * A bit per pixel, most significant first, set where the pixel is at
+ * least 128; `invert' clears those bits instead. PBM has 1 for black.
+ */
+static void pack_row(const unsigned char *src, int w, unsigned char *dst, int invert)
+{
+	unsigned char byte;
+	int x;
+
+	byte = 0;
+	for (x = 0; x < w; x++) {
+		byte = byte << 1 | (src[x] >> 7);
+		if (x%8 == 7) {
+			*dst++ = invert ? ~byte : byte;
+			byte = 0;
+		}
+	}
+
+	/* pad the last byte on the right */
+	if (w%8 != 0) {
+		byte <<= 8 - w%8;
+		*dst = invert ? ~byte & (0xff << (8 - w%8)) : byte;
+	}
+}
+
+/* 8 bit gray, or 1 bit for images that only hold 0 and 255 */
+static int write_png(struct img_ctx *gray, const char *fname, int level, int bits)
+{
+	png_structp png;
+	png_infop info;
+	unsigned char *row;
+	FILE *file;
+	int y;
+
+	file = fopen(fname, "wb");
+	if (file == NULL) {
+		fprintf(stderr, "error: %s: %s\n", fname, strerror(errno));
+		return RET_ERR;
+	}
+
+	png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+	info = png != NULL ? png_create_info_struct(png) : NULL;
+	if (info == NULL) {
+		fprintf(stderr, "error: unable to create PNG writer\n");
+		png_destroy_write_struct(&png, NULL);
+		fclose(file);
+		return RET_ERR;
+	}
+
+	row = bits == 1 ? xmalloc((gray->w + 7)/8) : NULL;
+
+	if (setjmp(png_jmpbuf(png))) {
+		fprintf(stderr, "error: failed to encode %s\n", fname);
+		png_destroy_write_struct(&png, &info);
+		if (row != NULL)
+			xfree(row);
+		fclose(file);
+		return RET_ERR;
+	}
+
+	png_init_io(png, file);
+
+	if (level >= 0)
+		png_set_compression_level(png, level);
+	/* stored rows gain nothing from filtering */
+	if (level == 0)
+		png_set_filter(png, PNG_FILTER_TYPE_BASE, PNG_FILTER_NONE);
+
+	png_set_IHDR(png, info, gray->w, gray->h, bits, PNG_COLOR_TYPE_GRAY, PNG_INTERLACE_NONE,
+		     PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+	png_write_info(png, info);
+
+	for (y = 0; y < gray->h; y++) {
+		if (row != NULL) {
+			pack_row(gray->pix + y*gray->pitch, gray->w, row, FALSE);
+			png_write_row(png, row);
+		} else {
+			png_write_row(png, gray->pix + y*gray->pitch);
+		}
+	}
+
+	png_write_end(png, NULL);
+	png_destroy_write_struct(&png, &info);
+	if (row != NULL)
+		xfree(row);
+
+	return close_file(file, fname);
+}
+
+/* binary PGM, or only the plane for .gray */
+static int write_pgm(struct img_ctx *gray, const char *fname, int header)
+{
+	FILE *file;
+	int y;
+
+	file = fopen(fname, "wb");
+	if (file == NULL) {
+		fprintf(stderr, "error: %s: %s\n", fname, strerror(errno));
+		return RET_ERR;
+	}
+
+	if (header)
+		fprintf(file, "P5\n%d %d\n255\n", gray->w, gray->h);
+
+	if (img_compact(gray)) {
+		fwrite(gray->pix, 1, (size_t)gray->w*gray->h, file);
+	} else {
+		for (y = 0; y < gray->h; y++)
+			fwrite(gray->pix + y*gray->pitch, 1, gray->w, file);
+	}
+
+	return close_file(file, fname);
+}
+
+/* binary PBM, pixels from 128 on are white */
+static int write_pbm(struct img_ctx *gray, const char *fname)
+{
+	unsigned char *row;
+	FILE *file;
+	int y, len;
+
+	file = fopen(fname, "wb");
+	if (file == NULL) {
+		fprintf(stderr, "error: %s: %s\n", fname, strerror(errno));
+		return RET_ERR;
+	}
+
+	len = (gray->w + 7)/8;
+	row = xmalloc(len);
+
+	fprintf(file, "P4\n%d %d\n", gray->w, gray->h);
+	for (y = 0; y < gray->h; y++) {
+		pack_row(gray->pix + y*gray->pitch, gray->w, row, TRUE);
+		fwrite(row, 1, len, file);
+	}
+
+	xfree(row);
+
+	return close_file(file, fname);
+}
+
+#ifdef HAVE_GDK_PIXBUF
+/* the gray value expanded to an RGB pixbuf, gdk-pixbuf has no gray images */
+static int write_pixbuf(struct img_ctx *gray, const char *fname, const char *ext)
+{
+	GdkPixbuf *pbuf;
+	GError *error = NULL;
+	unsigned char *row, *p, *q;
+	int x, y;
+
+	pbuf = gdk_pixbuf_new(GDK_COLORSPACE_RGB, FALSE, 8, gray->w, gray->h);
+	if (pbuf == NULL) {
+		fprintf(stderr, "error: unable to create pixbuf\n");
+		return RET_ERR;
+	}
+
+	row = gdk_pixbuf_get_pixels(pbuf);
+	for (y = 0; y < gray->h; y++) {
+		p = row;
+		q = gray->pix + y*gray->pitch;
+		for (x = 0; x < gray->w; x++) {
+			p[0] = p[1] = p[2] = q[x];
+			p += 3;
+		}
+		row += gdk_pixbuf_get_rowstride(pbuf);
+	}
+
+	if (!gdk_pixbuf_save(pbuf, fname, ext, &error, NULL)) {
+		fprintf(stderr, "error: failed to save image %s: %s\n", fname, error->message);
+		g_error_free(error);
+		g_object_unref(G_OBJECT(pbuf));
+		return RET_ERR;
+	}
+
+	g_object_unref(G_OBJECT(pbuf));
+
+	return RET_OK;
+}
+#endif
+
+/*
+ * Format by extension: .png (also without one) goes through libpng at
+ * io->level, with a bit per pixel if io->bits is 1. .pbm is always one
+ * bit, .pgm and .pnm are binary PGM, .gray the bare plane. Others need
+ * gdk-pixbuf, which has no gray images and gets three equal channels.
+ */
+int img_write(struct img_ctx *gray, const char *fname, const struct img_io *io)
+{
+	const char *ext;
+
+	assert(gray != NULL);
+	assert(fname != NULL);
+	assert(io != NULL);
+	assert(io->bits == 1 || io->bits == 8);
+
+	if (gray->type != TYPE_GRAY) {
+		fprintf(stderr, "error: only gray images are written\n");
+		return RET_ERR;
+	}
+
+	ext = file_ext(fname);
+
+	if (*ext == '\0' || strcasecmp(ext, "png") == 0)
+		return write_png(gray, fname, io->level, io->bits);
+	if (strcasecmp(ext, "pbm") == 0)
+		return write_pbm(gray, fname);
+	if (strcasecmp(ext, "pgm") == 0 || strcasecmp(ext, "pnm") == 0)
+		return write_pgm(gray, fname, TRUE);
+	if (strcasecmp(ext, "gray") == 0)
+		return write_pgm(gray, fname, FALSE);
+
+#ifdef HAVE_GDK_PIXBUF
+	return write_pixbuf(gray, fname, ext);
+#else
+	fprintf(stderr, "error: %s: unknown format, PNG, PGM or raw without gdk-pixbuf\n", fname);
+	return RET_ERR;
+#endif
+}
@@ -0,0 +1,19 @@
+#ifndef IMG_IO_H_
+#define IMG_IO_H_
+
+#include "img.h"
+
+/* how images are read and written */
+struct img_io {
+	int level;	/* zlib level of PNG output 0..9, -1 is the libpng default */
+	int bits;	/* 1 packs PNG output of images that only hold 0 and 255, or 8 */
+	int raw_w;	/* size of headerless .gray and .rgb input */
+	int raw_h;
+	struct img_pool *pool;	/* decoded images come from it, if set */
+};
+
+void img_io_init(struct img_io *io);
+struct img_ctx *img_read(const char *fname, const struct img_io *io);
+int img_write(struct img_ctx *gray, const char *fname, const struct img_io *io);
+
+#endif /* IMG_IO_H_ */
@@ -0,0 +1,601 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SIMD_X86
+#elif defined(__aarch64__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define SIMD_ARM
+#endif
+
+#include "common.h"
+#include "img_simd.h"
+#include "conv.h"
+
+/*
+ * 5x5 blur: x/331 == (x*DIV331_M) >> 24 for every x <= 255*331, checked
+ * exhaustively. x*DIV331_M < 2^32, so the high 16 bits of the product
+ * are enough and the shift becomes >> 8 on them.
+ */
+#define DIV331_M 50687
+
+/* madd takes signed 16 bit weights */
+#if GRAY_WR > 32767 || GRAY_WB > 32767 || GRAY_WG > 65535 || GRAY_SHIFT != 16
+#error "grayscale weights do not fit the vector kernels"
+#endif
+
+static pthread_once_t simd_once = PTHREAD_ONCE_INIT;
+static simd_level_t simd_max;
+static simd_level_t simd_cur;
+static int blur5_ok;
+
+/*
+ * The blur keeps rows 0+2+4 and rows 1+3 of the mask in 16 bit sums,
+ * which holds for conv_gauss5; any other mask uses scalar code.
+ */
+static void simd_check_mask(void)
+{
+	int j, i, rows[5];
+
+	if (CONV_GAUSS5_DIM != 5 || CONV_GAUSS5_SUM != 331)
+		return;
+
+	for (j = 0; j < 5; j++) {
+		rows[j] = 0;
+		for (i = 0; i < 5; i++)
+			rows[j] += conv_gauss5[j*5 + i];
+	}
+
+	blur5_ok = 255*(rows[0] + rows[2] + rows[4]) <= 0xffff &&
+		   255*(rows[1] + rows[3]) <= 0xffff;
+}
+
+/* `level' runs on this CPU, simd_max is set */
+static int simd_has(simd_level_t level)
+{
+	if (level == SIMD_NONE)
+		return 1;
+#ifdef SIMD_X86
+	return level != SIMD_NEON && level <= simd_max;
+#else
+	return level == simd_max;
+#endif
+}
+
+static void simd_init(void)
+{
+	simd_level_t level;
+	char *env;
+
+	simd_max = SIMD_NONE;
+
+#ifdef SIMD_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse2"))
+		simd_max = SIMD_SSE2;
+	if (__builtin_cpu_supports("avx2"))
+		simd_max = SIMD_AVX2;
+#elif defined(SIMD_ARM)
+	simd_max = SIMD_NEON;
+#endif
+
+	/* IMG_SIMD=scalar|sse2|avx2|neon caps the level, e.g. to compare */
+	simd_cur = simd_max;
+	env = getenv("IMG_SIMD");
+	for (level = SIMD_NONE; env != NULL && level <= SIMD_NEON; level++) {
+		if (strcmp(env, img_simd_name(level)) == 0)
+			break;
+	}
+
+	if (env != NULL && level > SIMD_NEON)
+		fprintf(stderr, "warning: unknown IMG_SIMD value %s, using %s\n", env, img_simd_name(simd_max));
+	else if (env != NULL && !simd_has(level))
+		fprintf(stderr, "warning: IMG_SIMD=%s is not supported by this CPU, using %s\n", env,
+			img_simd_name(simd_max));
+	else if (env != NULL)
+		simd_cur = level;
+
+	simd_check_mask();
+}
+
+simd_level_t img_simd_level(void)
+{
+	pthread_once(&simd_once, simd_init);
+
+	return simd_cur;
+}
+
+int img_simd_has(simd_level_t level)
+{
+	pthread_once(&simd_once, simd_init);
+
+	return simd_has(level);
+}
+
+/* cap the level at `level', never above what the CPU has */
+simd_level_t img_simd_set(simd_level_t level)
+{
+	simd_level_t old;
+
+	pthread_once(&simd_once, simd_init);
+
+	old = simd_cur;
+	simd_cur = level < simd_max ? level : simd_max;
+
+	return old;
+}
+
+const char *img_simd_name(simd_level_t level)
+{
+	switch (level) {
+	case SIMD_NONE:
+		return "scalar";
+	case SIMD_SSE2:
+		return "sse2";
+	case SIMD_AVX2:
+		return "avx2";
+	case SIMD_NEON:
+		return "neon";
+	}
+
+	return "unknown";
+}
+
+#ifdef SIMD_X86
+
+/*
+ * Weight pair for madd, WR on r and WG on g. madd reads a WG above 32767
+ * as WG - 65536, adding g << 16 makes up for it.
+ */
+#define GRAY_RG_PAIR ((int)((unsigned int)GRAY_WG << 16 | GRAY_WR))
+#define GRAY_WG_FIX (GRAY_WG > 32767)
+
+__attribute__((target("sse2")))
+static inline __m128i gray4_sse2(__m128i rg, __m128i g_hi, __m128i b)
+{
+	__m128i acc;
+
+	acc = _mm_madd_epi16(rg, _mm_set1_epi32(GRAY_RG_PAIR));
+	if (GRAY_WG_FIX)
+		acc = _mm_add_epi32(acc, g_hi);
+	acc = _mm_add_epi32(acc, _mm_madd_epi16(b, _mm_set1_epi32(GRAY_WB)));
+
+	return _mm_srli_epi32(acc, GRAY_SHIFT);
+}
+
+/* 8 pixels from 16 bit lanes */
+__attribute__((target("sse2")))
+static inline __m128i gray8_sse2(__m128i r, __m128i g, __m128i b)
+{
+	__m128i zero, lo, hi;
+
+	zero = _mm_setzero_si128();
+
+	lo = gray4_sse2(_mm_unpacklo_epi16(r, g), _mm_unpacklo_epi16(zero, g), _mm_unpacklo_epi16(b, zero));
+	hi = gray4_sse2(_mm_unpackhi_epi16(r, g), _mm_unpackhi_epi16(zero, g), _mm_unpackhi_epi16(b, zero));
+
+	return _mm_packs_epi32(lo, hi);
+}
+
+__attribute__((target("sse2")))
+static int gray_planar_sse2(const unsigned char *r, const unsigned char *g, const unsigned char *b,
+			    unsigned char *dst, int n)
+{
+	__m128i zero, vr, vg, vb, lo, hi;
+	int i;
+
+	zero = _mm_setzero_si128();
+
+	for (i = 0; i + 16 <= n; i += 16) {
+		vr = _mm_loadu_si128((const __m128i *)(r + i));
+		vg = _mm_loadu_si128((const __m128i *)(g + i));
+		vb = _mm_loadu_si128((const __m128i *)(b + i));
+
+		lo = gray8_sse2(_mm_unpacklo_epi8(vr, zero), _mm_unpacklo_epi8(vg, zero),
+				_mm_unpacklo_epi8(vb, zero));
+		hi = gray8_sse2(_mm_unpackhi_epi8(vr, zero), _mm_unpackhi_epi8(vg, zero),
+				_mm_unpackhi_epi8(vb, zero));
+
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(lo, hi));
+	}
+
+	return i;
+}
+
+/* RGBA only, a pixel is one 32 bit lane */
+__attribute__((target("sse2")))
+static int gray_packed_sse2(const unsigned char *pix, int nchan, unsigned char *dst, int n)
+{
+	__m128i px[4], m8, g_hi, out[4];
+	int i, k;
+
+	if (nchan != 4)
+		return 0;
+
+	m8 = _mm_set1_epi32(0xff);
+
+	for (i = 0; i + 16 <= n; i += 16) {
+		for (k = 0; k < 4; k++) {
+			px[k] = _mm_loadu_si128((const __m128i *)(pix + 4*(i + 4*k)));
+			g_hi = _mm_and_si128(_mm_slli_epi32(px[k], 8), _mm_set1_epi32(0xff0000));
+			out[k] = gray4_sse2(_mm_or_si128(_mm_and_si128(px[k], m8), g_hi), g_hi,
+					    _mm_and_si128(_mm_srli_epi32(px[k], 16), m8));
+		}
+
+		out[0] = _mm_packs_epi32(out[0], out[1]);
+		out[2] = _mm_packs_epi32(out[2], out[3]);
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(out[0], out[2]));
+	}
+
+	return i;
+}
+
+/*
+ * x = t + s, both below 2^16, as 17 bits: low half in `x', carry in
+ * `c'. Returns x/331.
+ */
+__attribute__((target("sse2")))
+static inline __m128i div331_sse2(__m128i t, __m128i s)
+{
+	__m128i x, c, m;
+
+	m = _mm_set1_epi16((short)DIV331_M);
+	x = _mm_add_epi16(t, s);
+	/* carry iff s > 0xffff - t */
+	c = _mm_subs_epu16(s, _mm_xor_si128(t, _mm_set1_epi16(-1)));
+	c = _mm_andnot_si128(_mm_cmpeq_epi16(c, _mm_setzero_si128()), m);
+
+	return _mm_srli_epi16(_mm_add_epi16(_mm_mulhi_epu16(x, m), c), 8);
+}
+
+/* 16 pixels per iteration, 16 bit accumulators */
+__attribute__((target("sse2")))
+static int blur5_sse2(const unsigned char *src, int pitch, unsigned char *dst, int x0, int x1)
+{
+	__m128i zero, v, lo[5], hi[5], wt, t_lo, t_hi;
+	const unsigned char *row;
+	int x, i, j;
+
+	zero = _mm_setzero_si128();
+
+	for (x = x0; x + 16 <= x1; x += 16) {
+		for (j = 0; j < 5; j++) {
+			row = src + (j - 2)*pitch + x - 2;
+			lo[j] = hi[j] = zero;
+			for (i = 0; i < 5; i++) {
+				v = _mm_loadu_si128((const __m128i *)(row + i));
+				wt = _mm_set1_epi16(conv_gauss5[j*5 + i]);
+				lo[j] = _mm_add_epi16(lo[j], _mm_mullo_epi16(_mm_unpacklo_epi8(v, zero), wt));
+				hi[j] = _mm_add_epi16(hi[j], _mm_mullo_epi16(_mm_unpackhi_epi8(v, zero), wt));
+			}
+		}
+
+		t_lo = _mm_add_epi16(_mm_add_epi16(lo[0], lo[4]), lo[2]);
+		t_hi = _mm_add_epi16(_mm_add_epi16(hi[0], hi[4]), hi[2]);
+
+		_mm_storeu_si128((__m128i *)(dst + x),
+				 _mm_packus_epi16(div331_sse2(t_lo, _mm_add_epi16(lo[1], lo[3])),
+						  div331_sse2(t_hi, _mm_add_epi16(hi[1], hi[3]))));
+	}
+
+	return x;
+}
+
+__attribute__((target("avx2")))
+static inline __m256i gray8_avx2(__m256i rg, __m256i g_hi, __m256i b)
+{
+	__m256i acc;
+
+	acc = _mm256_madd_epi16(rg, _mm256_set1_epi32(GRAY_RG_PAIR));
+	if (GRAY_WG_FIX)
+		acc = _mm256_add_epi32(acc, g_hi);
+	acc = _mm256_add_epi32(acc, _mm256_madd_epi16(b, _mm256_set1_epi32(GRAY_WB)));
+
+	return _mm256_srli_epi32(acc, GRAY_SHIFT);
+}
+
+/* 16 pixels from 16 bit lanes, unpack and pack stay within 128 bit lanes */
+__attribute__((target("avx2")))
+static inline __m256i gray16_avx2(__m256i r, __m256i g, __m256i b)
+{
+	__m256i zero, lo, hi;
+
+	zero = _mm256_setzero_si256();
+
+	lo = gray8_avx2(_mm256_unpacklo_epi16(r, g), _mm256_unpacklo_epi16(zero, g),
+			_mm256_unpacklo_epi16(b, zero));
+	hi = gray8_avx2(_mm256_unpackhi_epi16(r, g), _mm256_unpackhi_epi16(zero, g),
+			_mm256_unpackhi_epi16(b, zero));
+
+	return _mm256_packs_epi32(lo, hi);
+}
+
+__attribute__((target("avx2")))
+static int gray_planar_avx2(const unsigned char *r, const unsigned char *g, const unsigned char *b,
+			    unsigned char *dst, int n)
+{
+	__m256i zero, vr, vg, vb, lo, hi;
+	int i;
+
+	zero = _mm256_setzero_si256();
+
+	for (i = 0; i + 32 <= n; i += 32) {
+		vr = _mm256_loadu_si256((const __m256i *)(r + i));
+		vg = _mm256_loadu_si256((const __m256i *)(g + i));
+		vb = _mm256_loadu_si256((const __m256i *)(b + i));
+
+		lo = gray16_avx2(_mm256_unpacklo_epi8(vr, zero), _mm256_unpacklo_epi8(vg, zero),
+				 _mm256_unpacklo_epi8(vb, zero));
+		hi = gray16_avx2(_mm256_unpackhi_epi8(vr, zero), _mm256_unpackhi_epi8(vg, zero),
+				 _mm256_unpackhi_epi8(vb, zero));
+
+		_mm256_storeu_si256((__m256i *)(dst + i), _mm256_packus_epi16(lo, hi));
+	}
+
+	return i;
+}
+
+/*
+ * RGB or RGBA: pshufb spreads 4 pixels of each 128 bit lane into the
+ * r | g << 16, g << 16 and b lanes the madd needs.
+ */
+__attribute__((target("avx2")))
+static int gray_packed_avx2(const unsigned char *pix, int nchan, unsigned char *dst, int n)
+{
+	__m256i px, rg_idx, g_idx, b_idx, out[4];
+	int i, k, s, stop;
+
+	if (nchan != 3 && nchan != 4)
+		return 0;
+
+	s = nchan;
+	rg_idx = _mm256_broadcastsi128_si256(_mm_setr_epi8(0, -1, 1, -1, s, -1, s + 1, -1,
+							   2*s, -1, 2*s + 1, -1, 3*s, -1, 3*s + 1, -1));
+	g_idx = _mm256_broadcastsi128_si256(_mm_setr_epi8(-1, -1, 1, -1, -1, -1, s + 1, -1,
+							  -1, -1, 2*s + 1, -1, -1, -1, 3*s + 1, -1));
+	b_idx = _mm256_broadcastsi128_si256(_mm_setr_epi8(2, -1, -1, -1, s + 2, -1, -1, -1,
+							  2*s + 2, -1, -1, -1, 3*s + 2, -1, -1, -1));
+
+	/* every load reads 16 bytes for 4 pixels, stay inside the row */
+	stop = nchan == 4 ? n : n - 2;
+
+	for (i = 0; i + 32 <= stop; i += 32) {
+		for (k = 0; k < 4; k++) {
+			px = _mm256_inserti128_si256(
+				_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(pix + nchan*(i + 8*k)))),
+				_mm_loadu_si128((const __m128i *)(pix + nchan*(i + 8*k + 4))), 1);
+			out[k] = gray8_avx2(_mm256_shuffle_epi8(px, rg_idx), _mm256_shuffle_epi8(px, g_idx),
+					    _mm256_shuffle_epi8(px, b_idx));
+		}
+
+		/* lanes hold pixels 0-3|4-7, 8-11|12-15, ..., packs interleave them */
+		out[0] = _mm256_packs_epi32(out[0], out[1]);
+		out[2] = _mm256_packs_epi32(out[2], out[3]);
+		out[0] = _mm256_packus_epi16(out[0], out[2]);
+		out[0] = _mm256_permutevar8x32_epi32(out[0], _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+		_mm256_storeu_si256((__m256i *)(dst + i), out[0]);
+	}
+
+	return i;
+}
+
+__attribute__((target("avx2")))
+static inline __m256i div331_avx2(__m256i t, __m256i s)
+{
+	__m256i x, c, m;
+
+	m = _mm256_set1_epi16((short)DIV331_M);
+	x = _mm256_add_epi16(t, s);
+	c = _mm256_subs_epu16(s, _mm256_xor_si256(t, _mm256_set1_epi16(-1)));
+	c = _mm256_andnot_si256(_mm256_cmpeq_epi16(c, _mm256_setzero_si256()), m);
+
+	return _mm256_srli_epi16(_mm256_add_epi16(_mm256_mulhi_epu16(x, m), c), 8);
+}
+
+/* 32 pixels per iteration */
+__attribute__((target("avx2")))
+static int blur5_avx2(const unsigned char *src, int pitch, unsigned char *dst, int x0, int x1)
+{
+	__m256i zero, v, lo[5], hi[5], wt, t_lo, t_hi;
+	const unsigned char *row;
+	int x, i, j;
+
+	zero = _mm256_setzero_si256();
+
+	for (x = x0; x + 32 <= x1; x += 32) {
+		for (j = 0; j < 5; j++) {
+			row = src + (j - 2)*pitch + x - 2;
+			lo[j] = hi[j] = zero;
+			for (i = 0; i < 5; i++) {
+				v = _mm256_loadu_si256((const __m256i *)(row + i));
+				wt = _mm256_set1_epi16(conv_gauss5[j*5 + i]);
+				lo[j] = _mm256_add_epi16(lo[j], _mm256_mullo_epi16(_mm256_unpacklo_epi8(v, zero), wt));
+				hi[j] = _mm256_add_epi16(hi[j], _mm256_mullo_epi16(_mm256_unpackhi_epi8(v, zero), wt));
+			}
+		}
+
+		t_lo = _mm256_add_epi16(_mm256_add_epi16(lo[0], lo[4]), lo[2]);
+		t_hi = _mm256_add_epi16(_mm256_add_epi16(hi[0], hi[4]), hi[2]);
+
+		_mm256_storeu_si256((__m256i *)(dst + x),
+				    _mm256_packus_epi16(div331_avx2(t_lo, _mm256_add_epi16(lo[1], lo[3])),
+							div331_avx2(t_hi, _mm256_add_epi16(hi[1], hi[3]))));
+	}
+
+	return x;
+}
+
+#endif /* SIMD_X86 */
+
+#ifdef SIMD_ARM
+
+static inline uint16x8_t gray8_neon(uint8x8_t r, uint8x8_t g, uint8x8_t b)
+{
+	uint16x8_t r16, g16, b16;
+	uint32x4_t lo, hi;
+
+	r16 = vmovl_u8(r);
+	g16 = vmovl_u8(g);
+	b16 = vmovl_u8(b);
+
+	lo = vmull_n_u16(vget_low_u16(r16), GRAY_WR);
+	lo = vmlal_n_u16(lo, vget_low_u16(g16), GRAY_WG);
+	lo = vmlal_n_u16(lo, vget_low_u16(b16), GRAY_WB);
+	hi = vmull_n_u16(vget_high_u16(r16), GRAY_WR);
+	hi = vmlal_n_u16(hi, vget_high_u16(g16), GRAY_WG);
+	hi = vmlal_n_u16(hi, vget_high_u16(b16), GRAY_WB);
+
+	return vcombine_u16(vshrn_n_u32(lo, GRAY_SHIFT), vshrn_n_u32(hi, GRAY_SHIFT));
+}
+
+static inline uint8x16_t gray16_neon(uint8x16_t r, uint8x16_t g, uint8x16_t b)
+{
+	return vcombine_u8(vmovn_u16(gray8_neon(vget_low_u8(r), vget_low_u8(g), vget_low_u8(b))),
+			   vmovn_u16(gray8_neon(vget_high_u8(r), vget_high_u8(g), vget_high_u8(b))));
+}
+
+static int gray_planar_neon(const unsigned char *r, const unsigned char *g, const unsigned char *b,
+			    unsigned char *dst, int n)
+{
+	int i;
+
+	for (i = 0; i + 16 <= n; i += 16)
+		vst1q_u8(dst + i, gray16_neon(vld1q_u8(r + i), vld1q_u8(g + i), vld1q_u8(b + i)));
+
+	return i;
+}
+
+/* vld3/vld4 deinterleave the channels */
+static int gray_packed_neon(const unsigned char *pix, int nchan, unsigned char *dst, int n)
+{
+	uint8x16x3_t p3;
+	uint8x16x4_t p4;
+	int i;
+
+	if (nchan == 3) {
+		for (i = 0; i + 16 <= n; i += 16) {
+			p3 = vld3q_u8(pix + 3*i);
+			vst1q_u8(dst + i, gray16_neon(p3.val[0], p3.val[1], p3.val[2]));
+		}
+		return i;
+	}
+
+	if (nchan == 4) {
+		for (i = 0; i + 16 <= n; i += 16) {
+			p4 = vld4q_u8(pix + 4*i);
+			vst1q_u8(dst + i, gray16_neon(p4.val[0], p4.val[1], p4.val[2]));
+		}
+		return i;
+	}
+
+	return 0;
+}
+
+static inline uint8x8_t div331_neon(uint16x8_t t, uint16x8_t s)
+{
+	uint32x4_t lo, hi;
+
+	lo = vaddl_u16(vget_low_u16(t), vget_low_u16(s));
+	hi = vaddl_u16(vget_high_u16(t), vget_high_u16(s));
+	lo = vshrq_n_u32(vmulq_n_u32(lo, DIV331_M), 24);
+	hi = vshrq_n_u32(vmulq_n_u32(hi, DIV331_M), 24);
+
+	return vmovn_u16(vcombine_u16(vmovn_u32(lo), vmovn_u32(hi)));
+}
+
+static int blur5_neon(const unsigned char *src, int pitch, unsigned char *dst, int x0, int x1)
+{
+	uint16x8_t lo[5], hi[5];
+	uint8x16_t v;
+	const unsigned char *row;
+	int x, i, j;
+
+	for (x = x0; x + 16 <= x1; x += 16) {
+		for (j = 0; j < 5; j++) {
+			row = src + (j - 2)*pitch + x - 2;
+			lo[j] = hi[j] = vdupq_n_u16(0);
+			for (i = 0; i < 5; i++) {
+				v = vld1q_u8(row + i);
+				lo[j] = vmlaq_n_u16(lo[j], vmovl_u8(vget_low_u8(v)), conv_gauss5[j*5 + i]);
+				hi[j] = vmlaq_n_u16(hi[j], vmovl_u8(vget_high_u8(v)), conv_gauss5[j*5 + i]);
+			}
+		}
+
+		vst1q_u8(dst + x, vcombine_u8(
+			div331_neon(vaddq_u16(vaddq_u16(lo[0], lo[4]), lo[2]), vaddq_u16(lo[1], lo[3])),
+			div331_neon(vaddq_u16(vaddq_u16(hi[0], hi[4]), hi[2]), vaddq_u16(hi[1], hi[3]))));
+	}
+
+	return x;
+}
+
+#endif /* SIMD_ARM */
+
+int img_simd_gray_planar(const unsigned char *r, const unsigned char *g, const unsigned char *b,
+			 unsigned char *dst, int n)
+{
+	switch (img_simd_level()) {
+#ifdef SIMD_X86
+	case SIMD_AVX2:
+		return gray_planar_avx2(r, g, b, dst, n);
+	case SIMD_SSE2:
+		return gray_planar_sse2(r, g, b, dst, n);
+#endif
+#ifdef SIMD_ARM
+	case SIMD_NEON:
+		return gray_planar_neon(r, g, b, dst, n);
+#endif
+	default:
+		return 0;
+	}
+}
+
+int img_simd_gray_packed(const unsigned char *pix, int nchan, unsigned char *dst, int n)
+{
+	switch (img_simd_level()) {
+#ifdef SIMD_X86
+	case SIMD_AVX2:
+		return gray_packed_avx2(pix, nchan, dst, n);
+	case SIMD_SSE2:
+		return gray_packed_sse2(pix, nchan, dst, n);
+#endif
+#ifdef SIMD_ARM
+	case SIMD_NEON:
+		return gray_packed_neon(pix, nchan, dst, n);
+#endif
+	default:
+		return 0;
+	}
+}
+
+/*
+ * Interior pixels [x0, x1) of the row at `src', rows above and below
+ * are `pitch' bytes away. Returns the first x left to the caller.
+ */
+int img_simd_blur5(const unsigned char *src, int pitch, unsigned char *dst, int x0, int x1)
+{
+	simd_level_t level;
+
+	level = img_simd_level();
+	if (!blur5_ok)
+		return x0;
+
+	switch (level) {
+#ifdef SIMD_X86
+	case SIMD_AVX2:
+		return blur5_avx2(src, pitch, dst, x0, x1);
+	case SIMD_SSE2:
+		return blur5_sse2(src, pitch, dst, x0, x1);
+#endif
+#ifdef SIMD_ARM
+	case SIMD_NEON:
+		return blur5_neon(src, pitch, dst, x0, x1);
+#endif
+	default:
+		return x0;
+	}
+}
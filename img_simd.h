@@ -0,0 +1,27 @@
+#ifndef IMG_SIMD_H_
+#define IMG_SIMD_H_
+
+typedef enum {
+	SIMD_NONE = 0,		/* scalar code only */
+	SIMD_SSE2,
+	SIMD_AVX2,
+	SIMD_NEON
+} simd_level_t;
+
+/*
+ * Vector row kernels of img_utils.c, picked once at run time from what
+ * the CPU supports. Each one does a prefix of the row and returns where
+ * it stopped, the scalar code finishes the rest. Results are the same
+ * as the scalar code, bit for bit.
+ */
+simd_level_t img_simd_level(void);
+int img_simd_has(simd_level_t level);
+const char *img_simd_name(simd_level_t level);
+simd_level_t img_simd_set(simd_level_t level);
+
+int img_simd_gray_planar(const unsigned char *r, const unsigned char *g, const unsigned char *b,
+			 unsigned char *dst, int n);
+int img_simd_gray_packed(const unsigned char *pix, int nchan, unsigned char *dst, int n);
+int img_simd_blur5(const unsigned char *src, int pitch, unsigned char *dst, int x0, int x1);
+
+#endif /* IMG_SIMD_H_ */
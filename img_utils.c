@@ -0,0 +1,690 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+
+#include "img_utils.h"
+#include "img_simd.h"
+#include "conv.h"
+#include "xmalloc.h"
+
+/* fixed point weights, as cl_img_grayscale16 and cl_img_grayscale_packed */
+void img_grayscale_rows(struct img_ctx *src, struct img_ctx *dst, int y0, int y1)
+{
+	unsigned char *p, *q, *r, *g, *b;
+	int x, y, w;
+
+	w = src->w;
+
+	switch (src->type) {
+	case TYPE_RGB:
+		for (y = y0; y < y1; y++) {
+			r = src->r + y*src->pitch;
+			g = src->g + y*src->pitch;
+			b = src->b + y*src->pitch;
+			q = dst->pix + y*dst->pitch;
+			x = img_simd_gray_planar(r, g, b, q, w);
+			for (; x < w; x++)
+				q[x] = GRAY_FIXED(r[x], g[x], b[x]);
+		}
+		break;
+	case TYPE_PACKED:
+		for (y = y0; y < y1; y++) {
+			p = src->pix + y*src->pitch;
+			q = dst->pix + y*dst->pitch;
+			x = img_simd_gray_packed(p, src->nchan, q, w);
+			p += x*src->nchan;
+			for (; x < w; x++) {
+				q[x] = GRAY_FIXED(p[0], p[1], p[2]);
+				p += src->nchan;
+			}
+		}
+		break;
+	case TYPE_GRAY:
+		/* already gray, e.g. a PGM */
+		for (y = y0; y < y1; y++)
+			memcpy(dst->pix + y*dst->pitch, src->pix + y*src->pitch, w);
+		break;
+	default:
+		fprintf(stderr, "error: not implemented\n");
+		abort();
+	}
+}
+
+static inline int clampi(int v, int lo, int hi)
+{
+	return v < lo ? lo : (v > hi ? hi : v);
+}
+
+/* where index `i' of a row or column of `n' pixels reads, as border_index() of img.cl */
+static inline int border_index(int i, int n, border_type_t border)
+{
+	if (i >= 0 && i < n)
+		return i;
+
+	if (border == BORDER_MIRROR)
+		i = i < 0 ? -i - 1 : 2*n - i - 1;
+	else if (border == BORDER_WRAP)
+		i = i < 0 ? i + n : i - n;
+
+	return clampi(i, 0, n - 1);
+}
+
+/* 5x5 mask at a pixel whose neighbourhood leaves the image */
+static unsigned char blur5_border(struct img_ctx *src, int x, int y, border_type_t border)
+{
+	unsigned int summ;
+	int i, j, w, h, offset, yi;
+
+	w = src->w;
+	h = src->h;
+
+	if (border == BORDER_COPY)
+		return src->pix[y*src->pitch + x];
+
+	offset = CONV_GAUSS5_DIM/2;
+	summ = 0;
+
+	for (j = 0; j < CONV_GAUSS5_DIM; j++) {
+		yi = border_index(y + j - offset, h, border);
+		for (i = 0; i < CONV_GAUSS5_DIM; i++)
+			summ += src->pix[yi*src->pitch + border_index(x + i - offset, w, border)]*
+				conv_gauss5[j*CONV_GAUSS5_DIM + i];
+	}
+
+	return summ/CONV_GAUSS5_SUM;
+}
+
+/* conv_gauss5, `border' says what it reads past the edges */
+void img_gaussian_blur_rows(struct img_ctx *src, struct img_ctx *dst, border_type_t border, int y0, int y1)
+{
+	unsigned int summ;
+	unsigned char *s, *d;
+	int x, y, i, j, w, h, sp, offset;
+
+	w = src->w;
+	h = src->h;
+	sp = src->pitch;
+	offset = CONV_GAUSS5_DIM/2;
+
+	for (y = y0; y < y1; y++) {
+		d = dst->pix + y*dst->pitch;
+
+		if (y < offset || y >= h - offset) {
+			for (x = 0; x < w; x++)
+				d[x] = blur5_border(src, x, y, border);
+			continue;
+		}
+
+		for (x = 0; x < offset && x < w; x++)
+			d[x] = blur5_border(src, x, y, border);
+
+		/* vector code takes what it can of the interior */
+		if (w > 2*offset)
+			x = img_simd_blur5(src->pix + y*sp, sp, d, offset, w - offset);
+
+		for (; x < w; x++) {
+			if (x < offset || x >= w - offset) {
+				d[x] = blur5_border(src, x, y, border);
+				continue;
+			}
+
+			summ = 0;
+			s = src->pix + (y - offset)*sp + x - offset;
+
+			for (j = 0; j < CONV_GAUSS5_DIM; j++) {
+				for (i = 0; i < CONV_GAUSS5_DIM; i++)
+					summ += s[j*sp + i]*conv_gauss5[j*CONV_GAUSS5_DIM + i];
+			}
+
+			d[x] = summ/CONV_GAUSS5_SUM;
+		}
+	}
+}
+
+/* horizontal pass of the separable blur into a float plane, rows `w' apart, as cl_img_blur_h */
+void img_blur_h_rows(struct img_ctx *src, float *tmp, const float *wt, int radius, border_type_t border,
+		     int y0, int y1)
+{
+	unsigned char *s;
+	float summ;
+	int x, y, i, w;
+
+	w = src->w;
+
+	for (y = y0; y < y1; y++) {
+		s = src->pix + y*src->pitch;
+		for (x = 0; x < w; x++) {
+			summ = 0.0f;
+			for (i = -radius; i <= radius; i++)
+				summ += s[border_index(x + i, w, border)]*wt[i + radius];
+			tmp[y*w + x] = summ;
+		}
+	}
+}
+
+/*
+ * Vertical pass, rounds as convert_uchar_sat(summ + 0.5f). Pixels within
+ * `radius' of the edges come from `src' with BORDER_COPY, as cl_img_blur_v.
+ */
+void img_blur_v_rows(struct img_ctx *src, const float *tmp, struct img_ctx *dst, const float *wt, int radius,
+		     border_type_t border, int y0, int y1)
+{
+	float summ;
+	int x, y, i, w, h;
+
+	w = dst->w;
+	h = dst->h;
+
+	for (y = y0; y < y1; y++) {
+		for (x = 0; x < w; x++) {
+			if (border == BORDER_COPY &&
+			    (y < radius || y >= h - radius || x < radius || x >= w - radius)) {
+				dst->pix[y*dst->pitch + x] = src->pix[y*src->pitch + x];
+				continue;
+			}
+
+			summ = 0.0f;
+			for (i = -radius; i <= radius; i++)
+				summ += tmp[border_index(y + i, h, border)*w + x]*wt[i + radius];
+
+			summ += 0.5f;
+			dst->pix[y*dst->pitch + x] = summ <= 0.0f ? 0 : (summ >= 255.0f ? 255 : (unsigned char)summ);
+		}
+	}
+}
+
+/* the mask of `c' at (x, y) stays inside a w x h image */
+static inline int conv_inside(const struct conv *c, int x, int y, int w, int h)
+{
+	return x >= c->w/2 && x < w - c->w/2 && y >= c->h/2 && y < h - c->h/2;
+}
+
+/* any mask in one pass, summed row by row as cl_img_conv */
+void img_conv_rows(struct img_ctx *src, struct img_ctx *dst, const struct conv *c, border_type_t border,
+		   int y0, int y1)
+{
+	const float *wt;
+	float summ;
+	int x, y, i, j, w, h, rx, ry, xi, yi, inside;
+
+	w = src->w;
+	h = src->h;
+	rx = c->w/2;
+	ry = c->h/2;
+
+	for (y = y0; y < y1; y++) {
+		for (x = 0; x < w; x++) {
+			inside = conv_inside(c, x, y, w, h);
+			if (!inside && border == BORDER_COPY) {
+				dst->pix[y*dst->pitch + x] = src->pix[y*src->pitch + x];
+				continue;
+			}
+
+			summ = 0.0f;
+			wt = c->wt;
+
+			for (j = 0; j < c->h; j++) {
+				yi = inside ? y + j - ry : border_index(y + j - ry, h, border);
+				for (i = 0; i < c->w; i++) {
+					xi = inside ? x + i - rx : border_index(x + i - rx, w, border);
+					summ += src->pix[yi*src->pitch + xi]*wt[i];
+				}
+				wt += c->w;
+			}
+
+			dst->pix[y*dst->pitch + x] = conv_result(summ, c->div);
+		}
+	}
+}
+
+/* horizontal pass of a separable mask into a float plane of rows `w' apart, as cl_img_conv_h */
+void img_conv_h_rows(struct img_ctx *src, float *tmp, const struct conv *c, border_type_t border,
+		     int y0, int y1)
+{
+	unsigned char *s;
+	float summ;
+	int x, y, i, w, rx;
+
+	w = src->w;
+	rx = c->w/2;
+
+	for (y = y0; y < y1; y++) {
+		s = src->pix + y*src->pitch;
+		for (x = 0; x < w; x++) {
+			summ = 0.0f;
+			for (i = 0; i < c->w; i++)
+				summ += s[border_index(x + i - rx, w, border)]*c->row[i];
+			tmp[y*w + x] = summ;
+		}
+	}
+}
+
+/* vertical pass, border pixels come from `src' with BORDER_COPY, as cl_img_conv_v */
+void img_conv_v_rows(struct img_ctx *src, const float *tmp, struct img_ctx *dst, const struct conv *c,
+		     border_type_t border, int y0, int y1)
+{
+	float summ;
+	int x, y, j, w, h, ry;
+
+	w = dst->w;
+	h = dst->h;
+	ry = c->h/2;
+
+	for (y = y0; y < y1; y++) {
+		for (x = 0; x < w; x++) {
+			if (border == BORDER_COPY && !conv_inside(c, x, y, w, h)) {
+				dst->pix[y*dst->pitch + x] = src->pix[y*src->pitch + x];
+				continue;
+			}
+
+			summ = 0.0f;
+			for (j = 0; j < c->h; j++)
+				summ += tmp[border_index(y + j - ry, h, border)*w + x]*c->col[j];
+
+			dst->pix[y*dst->pitch + x] = conv_result(summ, c->div);
+		}
+	}
+}
+
+/* as cl_img_sobel: L1 magnitude, direction from fixed point tangents */
+void img_sobel_rows(struct img_ctx *src, struct img_gradient *g, int y0, int y1)
+{
+	unsigned char *p;
+	int x, y, w, h, sp, gx, gy, ax, ay, d;
+
+	w = src->w;
+	h = src->h;
+	sp = src->pitch;
+
+	for (y = y0; y < y1; y++) {
+		for (x = 0; x < w; x++) {
+			if (y == 0 || y == h - 1 || x == 0 || x == w - 1) {
+				g->gmag[(size_t)y*w + x] = 0;
+				g->gdir[(size_t)y*w + x] = DIR_NONE;
+				continue;
+			}
+
+			p = src->pix + (size_t)y*sp + x;
+
+			gx = (p[-sp + 1] + 2*p[1] + p[sp + 1]) - (p[-sp - 1] + 2*p[-1] + p[sp - 1]);
+			gy = (p[sp - 1] + 2*p[sp] + p[sp + 1]) - (p[-sp - 1] + 2*p[-sp] + p[-sp + 1]);
+
+			ax = abs(gx);
+			ay = abs(gy);
+
+			if (ay*65536 < ax*TAN_Q16(TAN_22))
+				d = DIR_HORIZONTAL;
+			else if (ay*65536 > ax*TAN_Q16(TAN_67))
+				d = DIR_VERTICAL;
+			else if ((gx > 0) == (gy > 0))
+				d = DIR_POSITIVE_DIAG;
+			else
+				d = DIR_NEGATIVE_DIAG;
+
+			g->gmag[(size_t)y*w + x] = ax + ay;
+			g->gdir[(size_t)y*w + x] = d;
+		}
+	}
+}
+
+/* as cl_img_nms */
+void img_nms_rows(struct img_gradient *g, struct img_ctx *dst, unsigned int low, unsigned int high,
+		  int y0, int y1)
+{
+	unsigned char *d;
+	unsigned int m;
+	size_t i;
+	int x, y, w, da;
+
+	w = g->w;
+
+	for (y = y0; y < y1; y++) {
+		d = dst->pix + (size_t)y*dst->pitch;
+		for (x = 0; x < w; x++) {
+			i = (size_t)y*w + x;
+			m = g->gmag[i];
+
+			switch (g->gdir[i]) {
+			case DIR_HORIZONTAL:
+				da = -1;
+				break;
+			case DIR_VERTICAL:
+				da = -w;
+				break;
+			case DIR_POSITIVE_DIAG:
+				da = -w - 1;
+				break;
+			case DIR_NEGATIVE_DIAG:
+				da = -w + 1;
+				break;
+			default:
+				d[x] = EDGE_NONE;
+				continue;
+			}
+
+			if (m < low || m <= g->gmag[i + da] || m < g->gmag[i - da])
+				d[x] = EDGE_NONE;
+			else
+				d[x] = m >= high ? EDGE_STRONG : EDGE_WEAK;
+		}
+	}
+}
+
+/*
+ * Promote weak pixels 8-connected to a strong one and drop the rest, in
+ * place. Same fixed point as the cl_img_hysteresis passes, reached with
+ * an explicit stack in one sweep.
+ */
+void img_hysteresis(struct img_ctx *edges)
+{
+	unsigned char *e;
+	size_t *stack;
+	size_t i, n, k;
+	int x, y, w, h, pitch, dx, dy;
+
+	w = edges->w;
+	h = edges->h;
+	pitch = edges->pitch;
+	e = edges->pix;
+
+	/* every pixel goes on the stack at most once, when it turns strong */
+	stack = xmalloc((size_t)w*h*sizeof(*stack));
+	n = 0;
+
+	for (y = 0; y < h; y++) {
+		for (x = 0; x < w; x++) {
+			if (e[(size_t)y*pitch + x] == EDGE_STRONG)
+				stack[n++] = (size_t)y*pitch + x;
+		}
+	}
+
+	while (n > 0) {
+		i = stack[--n];
+		y = i/pitch;
+		x = i%pitch;
+
+		for (dy = -1; dy <= 1; dy++) {
+			for (dx = -1; dx <= 1; dx++) {
+				if (y + dy < 0 || y + dy >= h || x + dx < 0 || x + dx >= w)
+					continue;
+				k = (size_t)(y + dy)*pitch + x + dx;
+				if (e[k] == EDGE_WEAK) {
+					e[k] = EDGE_STRONG;
+					stack[n++] = k;
+				}
+			}
+		}
+	}
+
+	for (y = 0; y < h; y++) {
+		for (x = 0; x < w; x++) {
+			if (e[(size_t)y*pitch + x] != EDGE_STRONG)
+				e[(size_t)y*pitch + x] = EDGE_NONE;
+		}
+	}
+
+	xfree(stack);
+}
+
+/* adds the levels of rows [y0, y1) to `hist' */
+void img_histogram_rows(struct img_ctx *src, unsigned int *hist, int y0, int y1)
+{
+	unsigned char *p;
+	int x, y;
+
+	for (y = y0; y < y1; y++) {
+		p = src->pix + y*src->pitch;
+		for (x = 0; x < src->w; x++)
+			hist[p[x]]++;
+	}
+}
+
+/* 64 x 64 bit product in two halves, as mul_hi() and the low word in img.cl */
+static void mul64(unsigned long long a, unsigned long long b, unsigned long long *hi, unsigned long long *lo)
+{
+	unsigned long long p00, p01, p10, p11, mid;
+
+	p00 = (a & 0xffffffffULL)*(b & 0xffffffffULL);
+	p01 = (a & 0xffffffffULL)*(b >> 32);
+	p10 = (a >> 32)*(b & 0xffffffffULL);
+	p11 = (a >> 32)*(b >> 32);
+
+	mid = (p00 >> 32) + (p01 & 0xffffffffULL) + (p10 & 0xffffffffULL);
+	*lo = mid << 32 | (p00 & 0xffffffffULL);
+	*hi = p11 + (p01 >> 32) + (p10 >> 32) + (mid >> 32);
+}
+
+/* hi:lo / v by shift and subtract as div128() of img.cl, the quotient must fit in 64 bits */
+static unsigned long long div128(unsigned long long hi, unsigned long long lo, unsigned long long v)
+{
+	unsigned long long top;
+	int i;
+
+	for (i = 0; i < 64; i++) {
+		top = hi >> 63;
+		hi = hi << 1 | lo >> 63;
+		lo <<= 1;
+		if (top || hi >= v) {
+			hi -= v;
+			lo |= 1;
+		}
+	}
+
+	return lo;
+}
+
+/*
+ * Threshold maximising the between class variance d^2/(wb*wf), with
+ * d = sum_t*wb - sum_b*n, compared as (d/wb)*(d/wf) exactly as
+ * cl_img_otsu does. d takes 128 bits from about 2^28 pixels on, both
+ * quotients and their product fit in 64 and 128 for uint bins. The
+ * lowest level wins ties.
+ */
+int img_otsu(const unsigned int *hist)
+{
+	unsigned long long n, st, wb, sb, a, b, hi, lo, shi, slo, vhi, vlo, maxhi, maxlo;
+	int i, t;
+
+	n = st = 0;
+	for (i = 0; i < 256; i++) {
+		n += hist[i];
+		st += (unsigned long long)i*hist[i];
+	}
+
+	wb = sb = 0;
+	maxhi = maxlo = 0;
+	t = 0;
+
+	for (i = 0; i < 256; i++) {
+		wb += hist[i];
+		sb += (unsigned long long)i*hist[i];
+
+		if (wb == 0 || wb == n)
+			continue;
+
+		/* the background mean is at most the overall mean, d >= 0 */
+		mul64(st, wb, &hi, &lo);
+		mul64(sb, n, &shi, &slo);
+		hi -= shi + (lo < slo);
+		lo -= slo;
+
+		a = div128(hi, lo, wb);
+		b = div128(hi, lo, n - wb);
+		mul64(a, b, &vhi, &vlo);
+
+		if (vhi > maxhi || (vhi == maxhi && vlo > maxlo)) {
+			maxhi = vhi;
+			maxlo = vlo;
+			t = i;
+		}
+	}
+
+	return t;
+}
+
+/* levels above `t' become white, the rest black */
+void img_binarize_rows(struct img_ctx *src, struct img_ctx *dst, int t, int y0, int y1)
+{
+	unsigned char *p, *q;
+	int x, y;
+
+	for (y = y0; y < y1; y++) {
+		p = src->pix + y*src->pitch;
+		q = dst->pix + y*dst->pitch;
+		for (x = 0; x < src->w; x++)
+			q[x] = p[x] > t ? 255 : 0;
+	}
+}
+
+int img_grayscale(struct img_ctx *src, struct img_ctx *dst)
+{
+	assert(src != NULL);
+	assert(dst != NULL);
+	assert(dst->type == TYPE_GRAY);
+
+	if ((src->w != dst->w) || (src->h != dst->h)) {
+		fprintf(stderr, "error: images not the same size\n");
+		return RET_ERR;
+	}
+
+	img_grayscale_rows(src, dst, 0, src->h);
+
+	return RET_OK;
+}
+
+int img_gaussian_blur(struct img_ctx *src, struct img_ctx *dst)
+{
+	return img_gaussian_blur_passes(src, dst, 1);
+}
+
+/*
+ * `passes' 5x5 blurs, ping-ponging between two planes so no pass reads
+ * pixels it already wrote; `dst' may be `src'.
+ */
+int img_gaussian_blur_passes(struct img_ctx *src, struct img_ctx *dst, int passes)
+{
+	struct img_ctx *tmp[2], *cur, *out;
+	int i, k;
+
+	assert(src != NULL);
+	assert(dst != NULL);
+	assert(passes > 0);
+
+	if ((src->w != dst->w) || (src->h != dst->h)) {
+		fprintf(stderr, "error: images not the same size\n");
+		return RET_ERR;
+	}
+
+	tmp[0] = tmp[1] = NULL;
+	cur = src;
+
+	for (k = 0; k < passes; k++) {
+		if (k == passes - 1 && cur->pix != dst->pix) {
+			out = dst;
+		} else {
+			i = cur == tmp[0] ? 1 : 0;
+			if (tmp[i] == NULL)
+				tmp[i] = img_ctx_new_flags(src->w, src->h, TYPE_GRAY, C_NONE, IMG_F_NOZERO);
+			out = tmp[i];
+		}
+
+		img_gaussian_blur_rows(cur, out, BORDER_COPY, 0, src->h);
+		cur = out;
+	}
+
+	if (cur != dst)
+		img_ctx_copy(cur, dst);
+
+	for (i = 0; i < 2; i++) {
+		if (tmp[i] != NULL)
+			img_destroy_ctx(tmp[i]);
+	}
+
+	return RET_OK;
+}
+
+/* separable masks in two passes, like both backends */
+int img_convolve(struct img_ctx *src, struct img_ctx *dst, const struct conv *c, border_type_t border)
+{
+	struct img_ctx *copy;
+	float *tmp;
+
+	assert(src != NULL);
+	assert(dst != NULL);
+	assert(c != NULL);
+
+	if ((src->w != dst->w) || (src->h != dst->h)) {
+		fprintf(stderr, "error: images not the same size\n");
+		return RET_ERR;
+	}
+
+	/* in place, the rows would read results of the ones above */
+	copy = NULL;
+	if (src->pix == dst->pix) {
+		copy = img_ctx_new_flags(src->w, src->h, TYPE_GRAY, C_NONE, IMG_F_NOZERO);
+		img_ctx_copy(src, copy);
+		src = copy;
+	}
+
+	if (!c->separable) {
+		img_conv_rows(src, dst, c, border, 0, src->h);
+	} else {
+		tmp = xmalloc(src->w*src->h*sizeof(*tmp));
+		img_conv_h_rows(src, tmp, c, border, 0, src->h);
+		img_conv_v_rows(src, tmp, dst, c, border, 0, src->h);
+		xfree(tmp);
+	}
+
+	if (copy != NULL)
+		img_destroy_ctx(copy);
+
+	return RET_OK;
+}
+
+/* returns the threshold or RET_ERR */
+int img_otsu_threshold(struct img_ctx *src, struct img_ctx *dst)
+{
+	unsigned int hist[256];
+	int t;
+
+	assert(src != NULL);
+	assert(dst != NULL);
+	assert(src->type == TYPE_GRAY);
+
+	if ((src->w != dst->w) || (src->h != dst->h)) {
+		fprintf(stderr, "error: images not the same size\n");
+		return RET_ERR;
+	}
+
+	memset(hist, 0, sizeof(hist));
+	img_histogram_rows(src, hist, 0, src->h);
+	t = img_otsu(hist);
+	img_binarize_rows(src, dst, t, 0, src->h);
+
+	return t;
+}
+
+int img_canny(struct img_ctx *src, struct img_ctx *dst, unsigned int low, unsigned int high)
+{
+	struct img_gradient *g;
+
+	assert(src != NULL);
+	assert(dst != NULL);
+	assert(src->type == TYPE_GRAY);
+	assert(dst->type == TYPE_GRAY);
+
+	if ((src->w != dst->w) || (src->h != dst->h)) {
+		fprintf(stderr, "error: images not the same size\n");
+		return RET_ERR;
+	}
+
+	g = img_gradient_new(src);
+	img_sobel_rows(src, g, 0, src->h);
+	img_nms_rows(g, dst, low, high, 0, src->h);
+	img_hysteresis(dst);
+	img_gradient_destroy(g);
+
+	return RET_OK;
+}
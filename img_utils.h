@@ -0,0 +1,39 @@
+#ifndef IMG_UTILS_H_
+#define IMG_UTILS_H_
+
+#include "img.h"
+#include "conv.h"
+
+/*
+ * Host implementations of the pipeline stages. The _rows variants work
+ * on rows [y0, y1) of the output only, so bands can run in parallel.
+ * Results match the OpenCL kernels bit for bit.
+ */
+void img_grayscale_rows(struct img_ctx *src, struct img_ctx *dst, int y0, int y1);
+void img_gaussian_blur_rows(struct img_ctx *src, struct img_ctx *dst, border_type_t border, int y0, int y1);
+void img_blur_h_rows(struct img_ctx *src, float *tmp, const float *wt, int radius, border_type_t border,
+		     int y0, int y1);
+void img_blur_v_rows(struct img_ctx *src, const float *tmp, struct img_ctx *dst, const float *wt, int radius,
+		     border_type_t border, int y0, int y1);
+void img_conv_rows(struct img_ctx *src, struct img_ctx *dst, const struct conv *c, border_type_t border,
+		   int y0, int y1);
+void img_conv_h_rows(struct img_ctx *src, float *tmp, const struct conv *c, border_type_t border,
+		     int y0, int y1);
+void img_conv_v_rows(struct img_ctx *src, const float *tmp, struct img_ctx *dst, const struct conv *c,
+		     border_type_t border, int y0, int y1);
+void img_sobel_rows(struct img_ctx *src, struct img_gradient *g, int y0, int y1);
+void img_nms_rows(struct img_gradient *g, struct img_ctx *dst, unsigned int low, unsigned int high,
+		  int y0, int y1);
+void img_hysteresis(struct img_ctx *edges);
+void img_histogram_rows(struct img_ctx *src, unsigned int *hist, int y0, int y1);
+int img_otsu(const unsigned int *hist);
+void img_binarize_rows(struct img_ctx *src, struct img_ctx *dst, int t, int y0, int y1);
+
+int img_grayscale(struct img_ctx *src, struct img_ctx *dst);
+int img_gaussian_blur(struct img_ctx *src, struct img_ctx *dst);
+int img_gaussian_blur_passes(struct img_ctx *src, struct img_ctx *dst, int passes);
+int img_convolve(struct img_ctx *src, struct img_ctx *dst, const struct conv *c, border_type_t border);
+int img_otsu_threshold(struct img_ctx *src, struct img_ctx *dst);
+int img_canny(struct img_ctx *src, struct img_ctx *dst, unsigned int low, unsigned int high);
+
+#endif /* IMG_UTILS_H_ */
@@ -1,41 +1,806 @@
-__kernel void cl_img_grayscale(__global const uchar *r, __global const uchar *g, __global const uchar *b, __global uchar *gray,
-			       uint len) 
+/*
+ * No fused multiply-add: the float blur then rounds the same way on every
+ * device, which keeps bands computed on different devices seamless.
+ */
+#pragma OPENCL FP_CONTRACT OFF
+
+/*
+ * r, g and b planes are `plane' bytes apart in `rgb', rows `pitch' bytes
+ * apart in each; `gray' rows are `opitch' bytes apart.
+ */
+__kernel void cl_img_grayscale(__global const uchar *rgb, __global uchar *gray, int w, int h, int pitch, uint plane,
+			       int opitch)
 {	
-	uint i;
+	__global const uchar *r, *g, *b;
+	int x, y, i;
 
-	i = get_global_id(0);
+	y = get_global_id(0);
+	x = get_global_id(1);
 	
-	if (i >= len)
+	if (y >= h || x >= w)
 		return;
 
-	gray[i] = (uint)(0.229*r[i] + 0.587*g[i] + 0.114*b[i]);	
+	i = y*pitch + x;
+	r = rgb;
+	g = rgb + plane;
+	b = rgb + 2*plane;
+
+	gray[y*opitch + x] = (uint)(0.229*r[i] + 0.587*g[i] + 0.114*b[i]);	
+}
+
+/*
+ * Where index `i' of a row or column of `n' pixels reads under border
+ * mode `border'. BORDER_COPY never reads outside and clamps.
+ */
+int border_index(int i, int n, int border)
+{
+	if (i >= 0 && i < n)
+		return i;
+
+	if (border == BORDER_MIRROR)
+		i = i < 0 ? -i - 1 : 2*n - i - 1;
+	else if (border == BORDER_WRAP)
+		i = i < 0 ? i + n : i - n;
+
+	return clamp(i, 0, n - 1);
 }
 
-__kernel void cl_img_gaussian_blur(__global const uchar *gray, __global uchar *out, __global const uint *gbox, uint n, uint sum, uint w, uint h)
+/* `gray' rows are `pitch' bytes apart, `out' rows `opitch' */
+__kernel void cl_img_gaussian_blur(__global const uchar *gray, __global uchar *out, __global const uint *gbox, uint n, uint sum, int w, int h,
+				   int pitch, int opitch, int border)
 {
-	int i, j, offset;
-	uint x, y, summ;
+	int i, j, x, y, offset, yi;
+	uint summ;
 
 	y = get_global_id(0);
 	x = get_global_id(1);
 
+	/* global size is padded to whole work-groups */
+	if (y >= h || x >= w)
+		return;
+
 	offset = n/2;
 
-	/* ignore border pixels 
-	 */
-	if (y - offset < 0 || y + offset > h || x - offset < 0 || x + offset > w) {
-		out[y*w + x] = gray[y*w + x];
+	/* border pixels are copied or read past the edge as `border' says */
+	if (y < offset || y >= h - offset || x < offset || x >= w - offset) {
+		if (border == BORDER_COPY) {
+			out[y*opitch + x] = gray[y*pitch + x];
+			return;
+		}
+
+		summ = 0;
+
+		for (j = -offset; j <= offset; j++) {
+			yi = border_index(y + j, h, border);
+			for (i = -offset; i <= offset; i++)
+				summ += gray[yi*pitch + border_index(x + i, w, border)]*gbox[(j + offset)*n + i + offset];
+		}
+
+		out[y*opitch + x] = summ/sum;
 		return;
 	}
-	
+
 	summ = 0;
 
 	for (j = -offset; j <= offset; j++) {
 		for (i = -offset; i <= offset; i++) {
-			summ += gray[(y + j)*w + x + i]*gbox[(j + offset)*n + i + offset];
+			summ += gray[(y + j)*pitch + x + i]*gbox[(j + offset)*n + i + offset];
+		}
+	}
+
+	out[y*opitch + x] = summ/sum;
+}
+
+
+/* 
+ * Separable gaussian: a horizontal pass into a float plane followed by a
+ * vertical pass back to uchar, 2*(2*radius + 1) taps per pixel instead of
+ * (2*radius + 1)^2. `border' says what is read past the edges, as
+ * img_blur_h_rows() and img_blur_v_rows(). `tmp' rows are packed, `gray'
+ * rows `pitch' bytes apart and `out' rows `opitch'.
+ */
+__kernel void cl_img_blur_h(__global const uchar *gray, __global float *tmp, __constant float *wt, int radius, int w, int h,
+			    int pitch, int border)
+{
+	int x, y, i, xi;
+	float summ;
+
+	y = get_global_id(0);
+	x = get_global_id(1);
+
+	if (y >= h || x >= w)
+		return;
+
+	summ = 0.0f;
+
+	for (i = -radius; i <= radius; i++) {
+		xi = border_index(x + i, w, border);
+		summ += gray[y*pitch + xi]*wt[i + radius];
+	}
+
+	tmp[y*w + x] = summ;
+}
+
+/* pixels within `radius' of the edges come from `gray' with BORDER_COPY */
+__kernel void cl_img_blur_v(__global const uchar *gray, __global const float *tmp, __global uchar *out,
+			    __constant float *wt, int radius, int w, int h, int pitch, int opitch, int border)
+{
+	int x, y, i, yi;
+	float summ;
+
+	y = get_global_id(0);
+	x = get_global_id(1);
+
+	if (y >= h || x >= w)
+		return;
+
+	if (border == BORDER_COPY && (y < radius || y >= h - radius || x < radius || x >= w - radius)) {
+		out[y*opitch + x] = gray[y*pitch + x];
+		return;
+	}
+
+	summ = 0.0f;
+
+	for (i = -radius; i <= radius; i++) {
+		yi = border_index(y + i, h, border);
+		summ += tmp[yi*w + x]*wt[i + radius];
+	}
+
+	out[y*opitch + x] = convert_uchar_sat(summ + 0.5f);
+}
+
+/*
+ * Tiled variant of cl_img_gaussian_blur. Each TILE_SIZE x TILE_SIZE work-group
+ * loads its block plus a halo of n/2 pixels into local memory once and
+ * convolves from there, instead of every work-item fetching n*n pixels
+ * from global memory. `tile' must hold (TILE_SIZE + n - 1)^2 bytes.
+ */
+#ifndef TILE_SIZE
+#define TILE_SIZE 16
+#endif
+
+__kernel __attribute__((reqd_work_group_size(TILE_SIZE, TILE_SIZE, 1)))
+void cl_img_gaussian_blur_tiled(__global const uchar *gray, __global uchar *out, __constant uint *gbox, uint n, uint sum,
+				int w, int h, int pitch, int opitch, int border, __local uchar *tile)
+{
+	int i, j, lx, ly, gx, gy, x0, y0, offset, tw;
+	uint summ;
+
+	ly = get_local_id(0);
+	lx = get_local_id(1);
+	y0 = get_group_id(0)*TILE_SIZE;
+	x0 = get_group_id(1)*TILE_SIZE;
+
+	offset = n/2;
+	tw = TILE_SIZE + 2*offset;
+
+	/* cooperative load of block and halo, past the edges as `border' says */
+	for (i = ly*TILE_SIZE + lx; i < tw*tw; i += TILE_SIZE*TILE_SIZE) {
+		gy = border_index(y0 + i/tw - offset, h, border);
+		gx = border_index(x0 + i%tw - offset, w, border);
+		tile[i] = gray[gy*pitch + gx];
+	}
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	gy = y0 + ly;
+	gx = x0 + lx;
+
+	if (gy >= h || gx >= w)
+		return;
+
+	/* border pixels are copied as in cl_img_gaussian_blur */
+	if (border == BORDER_COPY && (gy < offset || gy >= h - offset || gx < offset || gx >= w - offset)) {
+		out[gy*opitch + gx] = tile[(ly + offset)*tw + lx + offset];
+		return;
+	}
+
+	summ = 0;
+
+	for (j = 0; j < n; j++) {
+		for (i = 0; i < n; i++) {
+			summ += tile[(ly + j)*tw + lx + i]*gbox[j*n + i];
 		}
 	}
 
-	out[y*w + x] = summ/sum;
+	out[gy*opitch + gx] = summ/sum;
+}
+
+/*
+ * cl_img_gaussian_blur reading through an image object: the reads go
+ * through the texture cache and `smp' handles the pixels past the edges
+ * in hardware (clamp to edge, mirrored repeat or repeat, all of them need
+ * normalized coordinates). `gray' is CL_R, CL_UNORM_INT8 and `pitch' only
+ * keeps the arguments of the buffer kernels. Only built for devices with
+ * image support.
+ */
+#ifdef __IMAGE_SUPPORT__
+__kernel void cl_img_gaussian_blur_image(__read_only image2d_t gray, __global uchar *out, __constant uint *gbox,
+					 uint n, uint sum, int w, int h, int pitch, int opitch, int border,
+					 sampler_t smp)
+{
+	int i, j, x, y, offset;
+	float sx, sy;
+	float2 c;
+	uint summ;
+
+	y = get_global_id(0);
+	x = get_global_id(1);
+
+	if (y >= h || x >= w)
+		return;
+
+	offset = n/2;
+	sx = 1.0f/w;
+	sy = 1.0f/h;
+
+	if (border == BORDER_COPY && (y < offset || y >= h - offset || x < offset || x >= w - offset)) {
+		c.x = (x + 0.5f)*sx;
+		c.y = (y + 0.5f)*sy;
+		out[y*opitch + x] = convert_uchar_sat_rte(read_imagef(gray, smp, c).x*255.0f);
+		return;
+	}
+
+	summ = 0;
+
+	/* pixel centres, the sampler maps the ones past the edges */
+	for (j = -offset; j <= offset; j++) {
+		c.y = (y + j + 0.5f)*sy;
+		for (i = -offset; i <= offset; i++) {
+			c.x = (x + i + 0.5f)*sx;
+			summ += convert_uint_sat_rte(read_imagef(gray, smp, c).x*255.0f)*gbox[(j + offset)*n + i + offset];
+		}
+	}
+
+	out[y*opitch + x] = summ/sum;
+}
+#endif
+
+/* truncated sum/div of an integer mask or the rounded sum, as conv_result() of conv.h */
+uchar conv_result(float summ, int div)
+{
+	if (div > 0)
+		return clamp(convert_int(summ)/div, 0, 255);
+
+	return convert_uchar_sat(summ + 0.5f);
+}
+
+/*
+ * Any kw x kh mask, one pixel per work-item. Integer masks have exact
+ * float sums, see conv.h; summed row by row like img_conv_rows().
+ */
+__kernel void cl_img_conv(__global const uchar *gray, __global uchar *out, __constant float *wt, int kw, int kh,
+			  int div, int w, int h, int pitch, int opitch, int border)
+{
+	int i, j, x, y, rx, ry, xi, yi, inside;
+	float summ;
+
+	y = get_global_id(0);
+	x = get_global_id(1);
+
+	if (y >= h || x >= w)
+		return;
+
+	rx = kw/2;
+	ry = kh/2;
+	inside = x >= rx && x < w - rx && y >= ry && y < h - ry;
+
+	if (!inside && border == BORDER_COPY) {
+		out[y*opitch + x] = gray[y*pitch + x];
+		return;
+	}
+
+	summ = 0.0f;
+
+	for (j = 0; j < kh; j++) {
+		yi = inside ? y + j - ry : border_index(y + j - ry, h, border);
+		for (i = 0; i < kw; i++) {
+			xi = inside ? x + i - rx : border_index(x + i - rx, w, border);
+			summ += gray[yi*pitch + xi]*wt[j*kw + i];
+		}
+	}
+
+	out[y*opitch + x] = conv_result(summ, div);
+}
+
+/* cl_img_conv with the image block and halo in local memory, for large masks */
+__kernel __attribute__((reqd_work_group_size(TILE_SIZE, TILE_SIZE, 1)))
+void cl_img_conv_tiled(__global const uchar *gray, __global uchar *out, __constant float *wt, int kw, int kh,
+		       int div, int w, int h, int pitch, int opitch, int border, __local uchar *tile)
+{
+	int i, j, lx, ly, gx, gy, x0, y0, rx, ry, tw, th;
+	float summ;
+
+	ly = get_local_id(0);
+	lx = get_local_id(1);
+	y0 = get_group_id(0)*TILE_SIZE;
+	x0 = get_group_id(1)*TILE_SIZE;
+
+	rx = kw/2;
+	ry = kh/2;
+	tw = TILE_SIZE + kw - 1;
+	th = TILE_SIZE + kh - 1;
+
+	for (i = ly*TILE_SIZE + lx; i < tw*th; i += TILE_SIZE*TILE_SIZE) {
+		gy = border_index(y0 + i/tw - ry, h, border);
+		gx = border_index(x0 + i%tw - rx, w, border);
+		tile[i] = gray[gy*pitch + gx];
+	}
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	gy = y0 + ly;
+	gx = x0 + lx;
+
+	if (gy >= h || gx >= w)
+		return;
+
+	if (border == BORDER_COPY && (gy < ry || gy >= h - ry || gx < rx || gx >= w - rx)) {
+		out[gy*opitch + gx] = tile[(ly + ry)*tw + lx + rx];
+		return;
+	}
+
+	summ = 0.0f;
+
+	for (j = 0; j < kh; j++) {
+		for (i = 0; i < kw; i++)
+			summ += tile[(ly + j)*tw + lx + i]*wt[j*kw + i];
+	}
+
+	out[gy*opitch + gx] = conv_result(summ, div);
+}
+
+/* horizontal pass of a separable mask, as img_conv_h_rows(), into packed `tmp' rows */
+__kernel void cl_img_conv_h(__global const uchar *gray, __global float *tmp, __constant float *row, int kw,
+			    int w, int h, int pitch, int border)
+{
+	int i, x, y, rx;
+	float summ;
+
+	y = get_global_id(0);
+	x = get_global_id(1);
+
+	if (y >= h || x >= w)
+		return;
+
+	rx = kw/2;
+	summ = 0.0f;
+
+	for (i = 0; i < kw; i++)
+		summ += gray[y*pitch + border_index(x + i - rx, w, border)]*row[i];
+
+	tmp[y*w + x] = summ;
 }
 
+/* vertical pass, border pixels come from `gray' with BORDER_COPY */
+__kernel void cl_img_conv_v(__global const uchar *gray, __global const float *tmp, __global uchar *out,
+			    __constant float *col, int kw, int kh, int div, int w, int h, int pitch, int opitch,
+			    int border)
+{
+	int j, x, y, rx, ry;
+	float summ;
+
+	y = get_global_id(0);
+	x = get_global_id(1);
+
+	if (y >= h || x >= w)
+		return;
+
+	rx = kw/2;
+	ry = kh/2;
+
+	if (border == BORDER_COPY && (y < ry || y >= h - ry || x < rx || x >= w - rx)) {
+		out[y*opitch + x] = gray[y*pitch + x];
+		return;
+	}
+
+	summ = 0.0f;
+
+	for (j = 0; j < kh; j++)
+		summ += tmp[border_index(y + j - ry, h, border)*w + x]*col[j];
+
+	out[y*opitch + x] = conv_result(summ, div);
+}
+
+/*
+ * Fixed point grayscale, 16 pixels per work-item. GRAY_WR, GRAY_WG, GRAY_WB
+ * and GRAY_SHIFT come from common.h through the build options. The last
+ * work-item of a row handles the w % 16 tail one pixel at a time. Layout
+ * as cl_img_grayscale.
+ */
+__kernel void cl_img_grayscale16(__global const uchar *rgb, __global uchar *gray, int w, int h, int pitch,
+				 uint plane, int opitch)
+{
+	__global const uchar *r, *g, *b;
+	__global uchar *o;
+	uint16 vr, vg, vb;
+	int x, y;
+
+	y = get_global_id(0);
+	x = get_global_id(1)*16;
+
+	if (y >= h || x >= w)
+		return;
+
+	r = rgb + y*pitch;
+	g = r + plane;
+	b = r + 2*plane;
+	o = gray + y*opitch;
+
+	if (x + 16 <= w) {
+		vr = convert_uint16(vload16(0, r + x));
+		vg = convert_uint16(vload16(0, g + x));
+		vb = convert_uint16(vload16(0, b + x));
+		vstore16(convert_uchar16((GRAY_WR*vr + GRAY_WG*vg + GRAY_WB*vb) >> GRAY_SHIFT), 0, o + x);
+		return;
+	}
+
+	for (; x < w; x++)
+		o[x] = (GRAY_WR*r[x] + GRAY_WG*g[x] + GRAY_WB*b[x]) >> GRAY_SHIFT;
+}
+
+/*
+ * Fixed point grayscale straight from interleaved RGB/RGBA rows as laid
+ * out by GdkPixbuf, `pitch' bytes apart, `nchan' bytes per pixel. `gray'
+ * rows are `opitch' bytes apart.
+ */
+__kernel void cl_img_grayscale_packed(__global const uchar *pix, __global uchar *gray, int w, int h, int pitch, int nchan,
+				      int opitch)
+{
+	__global const uchar *p;
+	int x, y;
+
+	y = get_global_id(0);
+	x = get_global_id(1);
+
+	if (y >= h || x >= w)
+		return;
+
+	p = pix + y*pitch + x*nchan;
+
+	gray[y*opitch + x] = (GRAY_WR*p[0] + GRAY_WG*p[1] + GRAY_WB*p[2]) >> GRAY_SHIFT;
+}
+
+/*
+ * CANNY EDGE DETECTOR
+ *
+ * Sobel gradient with L1 magnitude |gx| + |gy| and the direction rounded
+ * to one of four, NMS with double threshold, then hysteresis in passes
+ * until no weak pixel next to a strong one is left. TAN_22_Q16,
+ * TAN_67_Q16, the DIR_* and EDGE_* values come from common.h through the
+ * build options. Integer math only, so the native backend matches.
+ * Gradients are packed, `gray' and `edges' rows `pitch' bytes apart.
+ */
+__kernel void cl_img_sobel(__global const uchar *gray, __global uint *gmag, __global int *gdir, int w, int h, int pitch)
+{
+	__global const uchar *p;
+	int x, y, gx, gy, ax, ay;
+
+	y = get_global_id(0);
+	x = get_global_id(1);
+
+	if (y >= h || x >= w)
+		return;
+
+	/* no full neighbourhood on the border */
+	if (y == 0 || y == h - 1 || x == 0 || x == w - 1) {
+		gmag[y*w + x] = 0;
+		gdir[y*w + x] = DIR_NONE;
+		return;
+	}
+
+	p = gray + y*pitch + x;
+
+	gx = (p[-pitch + 1] + 2*p[1] + p[pitch + 1]) - (p[-pitch - 1] + 2*p[-1] + p[pitch - 1]);
+	gy = (p[pitch - 1] + 2*p[pitch] + p[pitch + 1]) - (p[-pitch - 1] + 2*p[-pitch] + p[-pitch + 1]);
+
+	ax = abs(gx);
+	ay = abs(gy);
+
+	gmag[y*w + x] = ax + ay;
+
+	/* ay/ax against tan(22.5) and tan(67.5) */
+	if (ay*65536 < ax*TAN_22_Q16)
+		gdir[y*w + x] = DIR_HORIZONTAL;
+	else if (ay*65536 > ax*TAN_67_Q16)
+		gdir[y*w + x] = DIR_VERTICAL;
+	else if ((gx > 0) == (gy > 0))
+		gdir[y*w + x] = DIR_POSITIVE_DIAG;
+	else
+		gdir[y*w + x] = DIR_NEGATIVE_DIAG;
+}
+
+/*
+ * Keep pixels at a maximum along the gradient, >= `high' is strong,
+ * >= `low' weak. The `>' / `>=' pair keeps one pixel of a plateau.
+ */
+__kernel void cl_img_nms(__global const uint *gmag, __global const int *gdir, __global uchar *edges,
+			 int w, int h, int pitch, uint low, uint high)
+{
+	int x, y, da, db;
+	uint m;
+
+	y = get_global_id(0);
+	x = get_global_id(1);
+
+	if (y >= h || x >= w)
+		return;
+
+	m = gmag[y*w + x];
+
+	switch (gdir[y*w + x]) {
+	case DIR_HORIZONTAL:
+		da = -1;
+		break;
+	case DIR_VERTICAL:
+		da = -w;
+		break;
+	case DIR_POSITIVE_DIAG:
+		da = -w - 1;
+		break;
+	case DIR_NEGATIVE_DIAG:
+		da = -w + 1;
+		break;
+	default:
+		edges[y*pitch + x] = EDGE_NONE;
+		return;
+	}
+	db = -da;
+
+	if (m < low || m <= gmag[y*w + x + da] || m < gmag[y*w + x + db]) {
+		edges[y*pitch + x] = EDGE_NONE;
+		return;
+	}
+
+	edges[y*pitch + x] = m >= high ? EDGE_STRONG : EDGE_WEAK;
+}
+
+/*
+ * Hysteresis pass `pass' over `edges' in place. A work-group promotes weak
+ * pixels inside its tile in local memory until the tile settles, so an
+ * edge crosses a whole tile per pass; changed[pass] is set if anything
+ * was promoted and a pass after one that changed nothing returns at
+ * once. Other groups may promote pixels of the halo concurrently, which
+ * is harmless: pixels only ever go from weak to strong.
+ */
+__kernel __attribute__((reqd_work_group_size(TILE_SIZE, TILE_SIZE, 1)))
+void cl_img_hysteresis(__global uchar *edges, int w, int h, int pitch, __global int *changed, int pass)
+{
+	__local uchar tile[(TILE_SIZE + 2)*(TILE_SIZE + 2)];
+	__local int lchanged;
+	int i, lx, ly, gx, gy, x0, y0, tw, me, again;
+	uchar e0;
+
+	ly = get_local_id(0);
+	lx = get_local_id(1);
+	y0 = get_group_id(0)*TILE_SIZE;
+	x0 = get_group_id(1)*TILE_SIZE;
+	tw = TILE_SIZE + 2;
+
+	/* the same for the whole launch, so no group is left at a barrier */
+	if (pass > 0 && changed[pass - 1] == 0)
+		return;
+
+	/* halo outside the image is no edge */
+	for (i = ly*TILE_SIZE + lx; i < tw*tw; i += TILE_SIZE*TILE_SIZE) {
+		gy = y0 + i/tw - 1;
+		gx = x0 + i%tw - 1;
+		tile[i] = (gy >= 0 && gy < h && gx >= 0 && gx < w) ? edges[gy*pitch + gx] : EDGE_NONE;
+	}
+
+	gy = y0 + ly;
+	gx = x0 + lx;
+	me = (ly + 1)*tw + lx + 1;
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+	e0 = tile[me];
+
+	do {
+		if (ly == 0 && lx == 0)
+			lchanged = 0;
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		if (gy < h && gx < w && tile[me] == EDGE_WEAK &&
+		    (tile[me - tw - 1] == EDGE_STRONG || tile[me - tw] == EDGE_STRONG ||
+		     tile[me - tw + 1] == EDGE_STRONG || tile[me - 1] == EDGE_STRONG ||
+		     tile[me + 1] == EDGE_STRONG || tile[me + tw - 1] == EDGE_STRONG ||
+		     tile[me + tw] == EDGE_STRONG || tile[me + tw + 1] == EDGE_STRONG)) {
+			tile[me] = EDGE_STRONG;
+			lchanged = 1;
+		}
+
+		barrier(CLK_LOCAL_MEM_FENCE);
+		again = lchanged;
+		barrier(CLK_LOCAL_MEM_FENCE);
+	} while (again);
+
+	if (gy < h && gx < w && tile[me] != e0) {
+		edges[gy*pitch + gx] = tile[me];
+		changed[pass] = 1;
+	}
+}
+
+/* weak pixels left after hysteresis are not edges */
+__kernel void cl_img_edges_final(__global uchar *edges, int w, int h, int pitch)
+{
+	int x, y;
+
+	y = get_global_id(0);
+	x = get_global_id(1);
+
+	if (y >= h || x >= w)
+		return;
+
+	if (edges[y*pitch + x] != EDGE_STRONG)
+		edges[y*pitch + x] = EDGE_NONE;
+}
+
+/*
+ * OTSU THRESHOLD
+ *
+ * Histogram with bins privatised per work-group in local memory and
+ * merged into `hist' with one atomic per bin, the Otsu scan over the 256
+ * bins in a single work-group, then binarisation against the threshold
+ * the scan left in device memory. `hist' must be zero on entry. Both
+ * work-groups take any power of two size up to 256, each work-item then
+ * owns 256/size bins. `gray' rows are `pitch' bytes apart, `out' rows
+ * `opitch'; pixels are counted in 64 bits, the bins in 32.
+ */
+__kernel void cl_img_histogram(__global const uchar *gray, uint w, uint h, uint pitch, __global uint *hist)
+{
+	__local uint bins[256];
+	ulong i, len;
+	uint b, lid, lsz;
+
+	lid = get_local_id(0);
+	lsz = get_local_size(0);
+
+	for (b = lid; b < 256; b += lsz)
+		bins[b] = 0;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	/* packed rows are read straight through */
+	len = (ulong)w*h;
+	if (pitch == w) {
+		for (i = get_global_id(0); i < len; i += get_global_size(0))
+			atomic_inc(&bins[gray[i]]);
+	} else {
+		for (i = get_global_id(0); i < len; i += get_global_size(0))
+			atomic_inc(&bins[gray[i/w*pitch + i%w]]);
+	}
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (b = lid; b < 256; b += lsz)
+		if (bins[b] != 0)
+			atomic_add(&hist[b], bins[b]);
+}
+
+/* hi:lo / v by shift and subtract, the quotient must fit in 64 bits */
+ulong div128(ulong hi, ulong lo, ulong v)
+{
+	ulong top;
+	int i;
+
+	for (i = 0; i < 64; i++) {
+		top = hi >> 63;
+		hi = hi << 1 | lo >> 63;
+		lo <<= 1;
+		if (top || hi >= v) {
+			hi -= v;
+			lo |= 1;
+		}
+	}
+
+	return lo;
+}
+
+/*
+ * Between class variance of a split after gray level t is
+ * d^2/(wb*wf) with d = sum_t*wb - sum_b*n, 128 bits for large images.
+ * It is compared as the 128 bit product (d/wb)*(d/wf), which the host
+ * reproduces exactly. Ties go to the lowest level; pixels > threshold
+ * are foreground.
+ */
+__kernel void cl_img_otsu(__global const uint *hist, __global uint *thresh)
+{
+	__local ulong wsum[256], isum[256], wblk[256], iblk[256];
+	__local ulong vhi[256], vlo[256];
+	__local uint lvl[256];
+	ulong wb, sb, n, st, a, b, hi, lo, w0, s0, bhi, blo;
+	uint i, t, s, k, l, l0, lsz, best;
+
+	t = get_local_id(0);
+	lsz = get_local_size(0);
+	k = 256/lsz;
+	l0 = t*k;
+
+	/* inclusive prefix sums of pixel counts and of levels in the block */
+	w0 = s0 = 0;
+	for (l = l0; l < l0 + k; l++) {
+		w0 += hist[l];
+		s0 += (ulong)l*hist[l];
+		wsum[l] = w0;
+		isum[l] = s0;
+	}
+	wblk[t] = w0;
+	iblk[t] = s0;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	/* then of the block totals */
+	for (s = 1; s < lsz; s <<= 1) {
+		w0 = t >= s ? wblk[t - s] : 0;
+		s0 = t >= s ? iblk[t - s] : 0;
+		barrier(CLK_LOCAL_MEM_FENCE);
+		wblk[t] += w0;
+		iblk[t] += s0;
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	w0 = t > 0 ? wblk[t - 1] : 0;
+	s0 = t > 0 ? iblk[t - 1] : 0;
+	n = wblk[lsz - 1];
+	st = iblk[lsz - 1];
+
+	/* best level of the block, ties to the lowest */
+	bhi = blo = 0;
+	best = l0;
+	for (l = l0; l < l0 + k; l++) {
+		wb = wsum[l] + w0;
+		sb = isum[l] + s0;
+
+		hi = lo = 0;
+		if (wb != 0 && wb != n) {
+			/* the background mean is at most the overall mean, d >= 0 */
+			lo = st*wb;
+			hi = mul_hi(st, wb) - mul_hi(sb, n) - (lo < sb*n);
+			lo -= sb*n;
+			a = div128(hi, lo, wb);
+			b = div128(hi, lo, n - wb);
+			hi = mul_hi(a, b);
+			lo = a*b;
+		}
+
+		if (hi > bhi || (hi == bhi && lo > blo)) {
+			bhi = hi;
+			blo = lo;
+			best = l;
+		}
+	}
+
+	vhi[t] = bhi;
+	vlo[t] = blo;
+	lvl[t] = best;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	/* arg max, equal variances go to the lower level */
+	for (s = lsz >> 1; s > 0; s >>= 1) {
+		if (t < s) {
+			i = t + s;
+			if (vhi[i] > vhi[t] || (vhi[i] == vhi[t] && (vlo[i] > vlo[t] ||
+								    (vlo[i] == vlo[t] && lvl[i] < lvl[t])))) {
+				vhi[t] = vhi[i];
+				vlo[t] = vlo[i];
+				lvl[t] = lvl[i];
+			}
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	if (t == 0)
+		thresh[0] = lvl[0];
+}
+
+__kernel void cl_img_binarize(__global const uchar *gray, __global uchar *out, int w, int h, int pitch, int opitch,
+			      __global const uint *thresh)
+{
+	int x, y;
+
+	y = get_global_id(0);
+	x = get_global_id(1);
+
+	if (y >= h || x >= w)
+		return;
+
+	out[y*opitch + x] = gray[y*pitch + x] > thresh[0] ? 255 : 0;
+}
@@ -9,338 +9,486 @@
 #include <assert.h>
 #include <string.h>
 #include <errno.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <time.h>
 
-#include <gtk/gtk.h>
-#include <gdk-pixbuf/gdk-pixbuf.h>
 #include <CL/cl.h>
 
 #include "img.h"
+#include "img_io.h"
 #include "clerr.h"
+#include "clrt.h"
+#include "clcache.h"
+#include "cltune.h"
+#include "xcl_img.h"
+#include "pipeline.h"
+#include "backend.h"
+#include "xcl_stream.h"
+#include "xcl_sched.h"
+#include "prof.h"
 #include "xmalloc.h"
-#include "cl_blur.h"
 
-static cl_platform_id platform;
-static cl_device_id device;
-static cl_context context;
-static cl_command_queue queue;
-static cl_program program;
+/* how images are read and written, set from the command line */
+static struct img_io io;
+
+/*
+ * BATCH MODE
+ *
+ * Images go through a ring of slots. While the device works on image N
+ * the host decodes image N+1 and encodes the oldest finished one, so
+ * with three slots two images can be queued on the device at a time.
+ */
+#define BATCH_SLOTS 3
+
+struct batch_slot {
+	const char *name;
+	struct img_ctx *rgb;
+	struct img_ctx *gray;
+	struct xcl_pipe pipe;
+	int queued;		/* pipe holds commands of this image */
+	int busy;		/* holds a decoded image */
+	int done;		/* set by the event callback */
+	cl_int status;
+};
+
+static pthread_mutex_t batch_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t batch_cond = PTHREAD_COND_INITIALIZER;
+
+static int name_cmp(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
 
-int get_ctx(GdkPixbuf *pbuf, img_type_t type, struct img_ctx **imctx)
+/* regular files of `dir', sorted by name */
+static char **batch_dir(const char *dir, int *n)
 {
-	struct img_ctx *ctx;
-	int nchan, w, h, i, j, rowstride, skip;
-	unsigned char *pix, *p, *q, *r, *g, *b;
-	
-	assert(pbuf != NULL);
-	assert(imctx != NULL);
-	
-	nchan = gdk_pixbuf_get_n_channels(pbuf);
-	w = gdk_pixbuf_get_width(pbuf);
-	h = gdk_pixbuf_get_height(pbuf);
-	rowstride = gdk_pixbuf_get_rowstride(pbuf);
-	pix = gdk_pixbuf_get_pixels(pbuf);
-
-	skip = rowstride - w*nchan;
-
-	switch (type) {
-	case TYPE_GRAY:
-		ctx = img_ctx_new(w, h, TYPE_GRAY, C_NONE);
-		
-		p = pix;
-        	q = ctx->pix;
-
-		for (i = 0; i < h; i++) {
-                	for (j = 0; j < w; j++) {
-				/* the same gray value in the next two pixels */
-				q[0] = p[0];
-				/* skip it */
-                       		p += nchan;
-				q++;
-                	}
-                	/* skip the padding bytes */
-                	p += skip;
-        	}	
-		break;
-	case TYPE_RGB:
-		ctx = img_ctx_new(w, h, TYPE_RGB, C_NONE);
-		
-		p = pix;
-		r = ctx->r;
-		g = ctx->g;
-		b = ctx->b;
-
-		for (i = 0; i < h; i++) {
-			for (j = 0; j < w; j++) {
-				r[0] = p[0];
-				g[0] = p[1];
-				b[0] = p[2];
-				p += nchan;
-				r++;
-				g++;
-				b++;
-			}
-			p += skip;
+	struct dirent *de;
+	struct stat sb;
+	char **names, *path;
+	int count, size;
+	DIR *d;
+
+	d = opendir(dir);
+	if (d == NULL) {
+		fprintf(stderr, "error: %s: %s\n", dir, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	names = NULL;
+	count = size = 0;
+
+	while ((de = readdir(d)) != NULL) {
+		if (de->d_name[0] == '.')
+			continue;
+
+		path = xmalloc(strlen(dir) + strlen(de->d_name) + 2);
+		sprintf(path, "%s/%s", dir, de->d_name);
+
+		if (stat(path, &sb) == -1 || !S_ISREG(sb.st_mode)) {
+			xfree(path);
+			continue;
 		}
-		break;
-	default:
-		fprintf(stderr, "error: not implemented\n");
-		abort();
+
+		if (count == size) {
+			size = size ? 2*size : 64;
+			names = xrealloc(names, size*sizeof(*names));
+		}
+		names[count++] = path;
 	}
 
-	*imctx = ctx;
+	closedir(d);
+
+	qsort(names, count, sizeof(*names), name_cmp);
+	*n = count;
 
-	return RET_OK;		
+	return names;
 }
 
-int load_ctx(struct img_ctx *ctx, GdkPixbuf *pbuf)
+/* one path per line, empty lines are skipped */
+static char **batch_list(const char *fname, int *n)
 {
-	unsigned int nchan, w, h, i, j, rowstride, skip;
-	unsigned char *pix, *p, *gray;
+	char **names, line[4096];
+	int count, size;
+	size_t len;
+	FILE *file;
 
-	assert(ctx != NULL);
-	assert(pbuf != NULL);
+	file = fopen(fname, "r");
+	if (file == NULL) {
+		fprintf(stderr, "error: %s: %s\n", fname, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
 
-	w = ctx->w;
-	h = ctx->h;
+	names = NULL;
+	count = size = 0;
 
-	nchan = gdk_pixbuf_get_n_channels(pbuf);
-	rowstride = gdk_pixbuf_get_rowstride(pbuf);
-	pix = gdk_pixbuf_get_pixels(pbuf);
-	
-	skip = rowstride - w*nchan;
-	
-	p = pix;
-	gray = ctx->pix;
-
-	for (i = 0; i < h; i++) {
-		for (j = 0; j < w; j++) {			
-			p[0] = gray[0];
-			p[1] = gray[0];
-			p[2] = gray[0];
-			p += nchan;
-			gray++;
+	while (fgets(line, sizeof(line), file) != NULL) {
+		len = strcspn(line, "\r\n");
+		line[len] = '\0';
+		if (len == 0)
+			continue;
+
+		if (count == size) {
+			size = size ? 2*size : 64;
+			names = xrealloc(names, size*sizeof(*names));
 		}
-		
-		p += skip;
+		names[count++] = xstrdup(line);
 	}
 
-	return RET_OK;
+	fclose(file);
+	*n = count;
+
+	return names;
 }
 
-char *get_extention(char *fname)
+/* `dir'/`name' with the extension replaced by .png */
+static char *batch_outname(const char *dir, const char *name)
 {
-	char *p;
+	const char *base, *dot;
+	char *out;
+	int len;
 
-	assert(fname != NULL);
-	
-	p = strchr(fname, '.') + 1;
-	return xstrdup(p);
+	base = strrchr(name, '/');
+	base = base ? base + 1 : name;
+	dot = strrchr(base, '.');
+	len = dot ? dot - base : (int)strlen(base);
+
+	out = xmalloc(strlen(dir) + len + sizeof("/.png"));
+	sprintf(out, "%s/%.*s.png", dir, len, base);
+
+	return out;
 }
 
-cl_mem create_buffer(cl_context context, 
-		     cl_mem_flags flags, 
-		     size_t size, 
-		     void *host_ptr)
+static int batch_decode(struct batch_slot *s, struct backend *be, const char *name)
 {
-	cl_mem buf;
-	cl_int err;
-
-	buf = clCreateBuffer(context, flags, size, host_ptr, &err);
+	double t0;
 
-	if (err != CL_SUCCESS) {
-		fprintf(stderr, "error: clCreateBuffer() %d %s\n", err, cl_strerror(err));
-		exit(EXIT_FAILURE);
+	t0 = prof_now();
+	s->rgb = img_read(name, &io);
+	if (s->rgb == NULL) {
+		fprintf(stderr, "warning: unable to load %s\n", name);
+		return RET_ERR;
 	}
+	prof_host("img_read", t0);
+
+	/* blocks of images already written are reused, sizes need not match */
+	s->gray = img_pool_get(io.pool, s->rgb->w, s->rgb->h, TYPE_GRAY,
+			       be->rt != NULL && be->rt->zero_copy ? IMG_F_ALIGNED : 0);
 
-	return buf;
+	s->name = name;
+	s->busy = TRUE;
+
+	return RET_OK;
 }
 
-void build_program(cl_program program, 
-		   cl_uint num_devices, 
-		   const cl_device_id *device, 
-		   const char *options, 
-		   void (*pfn_notify)(cl_program, void *user_data),
-		   void *user_data)
+/* runs on a thread of the OpenCL implementation */
+static void CL_CALLBACK batch_done(cl_event ev, cl_int status, void *data)
 {
-	cl_int err;
-	size_t log_size;
-	char *log;
+	struct batch_slot *s;
 
-	/* building program */
-	err = clBuildProgram(program, num_devices, device, options, pfn_notify, user_data);
-	if (err != CL_SUCCESS) {
-		/* determine size of compiler log */
-		clGetProgramBuildInfo(program, *device, CL_PROGRAM_BUILD_LOG, 0, NULL, &log_size);
-		log = malloc(log_size + 1);
-		log[log_size] = '\0';
-		/* store compiler output to buffer */
-		clGetProgramBuildInfo(program, *device, CL_PROGRAM_BUILD_LOG, log_size, log, NULL);
-		fprintf(stderr, "error: clBuildProgram() %d %s\n", err, cl_strerror(err));
-		fprintf(stderr, "%s\n", log);
-		exit(EXIT_FAILURE);
-	}
+	s = data;
+
+	pthread_mutex_lock(&batch_lock);
+	s->status = status;
+	s->done = TRUE;
+	pthread_cond_broadcast(&batch_cond);
+	pthread_mutex_unlock(&batch_lock);
 }
 
-cl_kernel create_kernel(cl_program  program, const char *kernel_name)
+static void batch_submit(struct batch_slot *s, struct backend *be, struct pipeline *pl)
 {
-	cl_kernel kernel;
+	struct clrt *rt;
 	cl_int err;
+	double t0;
+
+	s->done = FALSE;
+	s->status = CL_COMPLETE;
+
+	/*
+	 * The native backend already keeps every core busy and images split
+	 * into bands overlap on their own, run those in place.
+	 */
+	if (be->type != BACKEND_OPENCL || xcl_stream_rows(be->rt, pl, s->rgb, be->band) > 0) {
+		t0 = prof_now();
+		backend_run(be, pl, s->rgb, s->gray);
+		prof_host("pipeline", t0);
+		s->done = TRUE;
+		return;
+	}
+
+	rt = be->rt;
+	s->queued = TRUE;
 
-	kernel = clCreateKernel(program, kernel_name, &err);
+	xcl_pipe_init(&s->pipe, rt, rt->queue);
+	xcl_pipeline_enqueue(&s->pipe, pl, s->rgb, s->gray);
+
+	err = clSetEventCallback(s->pipe.ev, CL_COMPLETE, batch_done, s);
 	if (err != CL_SUCCESS) {
-		fprintf(stderr, "error: clCreateKerne() %d %s\n", err, cl_strerror(err));
+		fprintf(stderr, "error: clSetEventCallback() %d %s\n", err, cl_strerror(err));
 		exit(EXIT_FAILURE);
 	}
-	
-	return kernel;
+
+	/* start the device now, the host goes on decoding and encoding */
+	clFlush(rt->queue);
 }
 
-void xcl_img_grayscale(struct img_ctx *rgb, struct img_ctx *gray)
+static int batch_encode(struct batch_slot *s, const char *outdir)
 {
-	cl_kernel cl_img_grayscale;
-	cl_mem r, g, b, out;
-	cl_int err;
-	size_t global_work_size;
-	size_t local_work_size;
-	int len;
+	char *outname;
+	double t0;
+	int ret;
+
+	pthread_mutex_lock(&batch_lock);
+	while (!s->done)
+		pthread_cond_wait(&batch_cond, &batch_lock);
+	pthread_mutex_unlock(&batch_lock);
+
+	if (s->status != CL_COMPLETE) {
+		fprintf(stderr, "error: processing %s failed %d %s\n", s->name, s->status,
+			cl_strerror(s->status));
+		exit(EXIT_FAILURE);
+	}
 
-	assert(rgb != NULL);
-	assert(gray != NULL);
+	if (s->queued) {
+		xcl_pipe_finish(&s->pipe);
+		s->queued = FALSE;
+	}
 
-	len = rgb->w*rgb->h;
-	err = 0;
+	outname = batch_outname(outdir, s->name);
+	t0 = prof_now();
+	ret = img_write(s->gray, outname, &io);
+	prof_host("img_write", t0);
+	xfree(outname);
 
-	cl_img_grayscale = create_kernel(program, "cl_img_grayscale");
+	img_destroy_ctx(s->rgb);
+	img_destroy_ctx(s->gray);
+	s->rgb = NULL;
+	s->gray = NULL;
+	s->busy = FALSE;
 
-	r = create_buffer(context, CL_MEM_READ_WRITE, len, NULL);
-	g = create_buffer(context, CL_MEM_READ_WRITE, len, NULL);
-	b = create_buffer(context, CL_MEM_READ_WRITE, len, NULL);
-	out = create_buffer(context, CL_MEM_WRITE_ONLY, len, NULL);
+	return ret;
+}
 
-	err |= clSetKernelArg(cl_img_grayscale, 0, sizeof(cl_mem), &r);
-	err |= clSetKernelArg(cl_img_grayscale, 1, sizeof(cl_mem), &g);
-	err |= clSetKernelArg(cl_img_grayscale, 2, sizeof(cl_mem), &b);
-	err |= clSetKernelArg(cl_img_grayscale, 3, sizeof(cl_mem), &out);
-	err |= clSetKernelArg(cl_img_grayscale, 4, sizeof(cl_int), (void *)&len);
+static void batch_ring(struct backend *be, struct pipeline *pl, char **names, int n, const char *outdir,
+		       int *ok, int *failed)
+{
+	struct batch_slot slots[BATCH_SLOTS], *s;
+	int i;
+
+	memset(slots, 0, sizeof(slots));
+
+	for (i = 0; i < n + BATCH_SLOTS - 1; i++) {
+		/* decode and queue image i */
+		if (i < n) {
+			s = &slots[i % BATCH_SLOTS];
+			if (batch_decode(s, be, names[i]) == RET_OK)
+				batch_submit(s, be, pl);
+			else
+				(*failed)++;
+		}
 
-	if (err != CL_SUCCESS) {
-		fprintf(stderr, "error: clSetKernelArg() %d %s\n", err, cl_strerror(err));
-		exit(EXIT_FAILURE);
+		/* encode the oldest image, the newer ones keep the device busy */
+		if (i >= BATCH_SLOTS - 1) {
+			s = &slots[(i + 1) % BATCH_SLOTS];
+			if (!s->busy)
+				continue;
+			if (batch_encode(s, outdir) == RET_OK)
+				(*ok)++;
+			else
+				(*failed)++;
+		}
 	}
+}
 
-	err |= clEnqueueWriteBuffer(queue, r, CL_FALSE, 0, len, rgb->r, 0, NULL, NULL);
-	err |= clEnqueueWriteBuffer(queue, g, CL_FALSE, 0, len, rgb->g, 0, NULL, NULL);
-	err |= clEnqueueWriteBuffer(queue, b, CL_FALSE, 0, len, rgb->b, 0, NULL, NULL);
+/* a batch spread over several devices */
+struct batch_job {
+	struct backend *be;
+	struct pipeline *pl;
+	char **names;
+	const char *outdir;
+	int ok;
+	int failed;
+};
+
+/* runs on a scheduler thread, the whole image on the device of `rt' */
+static void batch_image(struct clrt *rt, void *arg, int i)
+{
+	struct batch_job *job;
+	struct batch_slot s;
+	double t0;
+	int ret;
+
+	job = arg;
+	memset(&s, 0, sizeof(s));
+
+	ret = batch_decode(&s, job->be, job->names[i]);
+	if (ret == RET_OK) {
+		t0 = prof_now();
+		xcl_stream_run(rt, job->pl, s.rgb, s.gray, job->be->band);
+		prof_host("pipeline", t0);
+
+		s.done = TRUE;
+		ret = batch_encode(&s, job->outdir);
+	}
 
-	if (err != CL_SUCCESS) {
-		fprintf(stderr, "error: clEnqueueWriteBuffer() %d %s\n", err, cl_strerror(err));
-		exit(EXIT_FAILURE);
-	}	
+	pthread_mutex_lock(&batch_lock);
+	if (ret == RET_OK)
+		job->ok++;
+	else
+		job->failed++;
+	pthread_mutex_unlock(&batch_lock);
+}
 
-	global_work_size = len;
-	local_work_size = 64;
+/*
+ * Each device decodes, runs and encodes whole images on a thread of its
+ * own; one that is done early takes over images queued for a slower one.
+ */
+static void batch_sched(struct backend *be, struct pipeline *pl, char **names, int n, const char *outdir,
+			int *ok, int *failed)
+{
+	struct batch_job job;
 
-	err = clEnqueueNDRangeKernel(queue, cl_img_grayscale, 1, NULL, &global_work_size, &local_work_size, 0, NULL, NULL);
-	if (err != CL_SUCCESS) {
-		fprintf(stderr, "error: clEnqueueNDRangeKernel() %d %s\n", err, cl_strerror(err));
-		exit(EXIT_FAILURE);
-	}
-	
-	err = clEnqueueReadBuffer(queue, out, CL_TRUE, 0, len, gray->pix, 0, NULL, NULL);
-	if (err != CL_SUCCESS) {
-		fprintf(stderr, "error: clEnqueueReadBuffer() %d %s\n", err, cl_strerror(err));
-		exit(EXIT_FAILURE);
-	}
-	
-	clReleaseMemObject(r);
-   	clReleaseMemObject(g);
-   	clReleaseMemObject(b);
-	clReleaseMemObject(out);
-	clReleaseKernel(cl_img_grayscale);
+	job.be = be;
+	job.pl = xcl_sched_pipeline(pl);
+	job.names = names;
+	job.outdir = outdir;
+	job.ok = job.failed = 0;
+
+	xcl_sched_run(be->sched, n, batch_image, &job);
+
+	pipeline_destroy(job.pl);
+	*ok = job.ok;
+	*failed = job.failed;
 }
 
-void xcl_img_gaussian_blur(struct img_ctx *gray, struct img_ctx *blur)
+static void batch_run(struct backend *be, struct pipeline *pl, char **names, int n, const char *outdir)
 {
-	cl_mem gray_buf, blur_buf, gauss_buf;
-	cl_kernel cl_img_gaussian_blur;
-	cl_int err;
-	size_t global_wblur[2];
-	size_t local_wblur[2];
-	int len;
+	struct timespec t0, t1;
+	int ok, failed;
+	double sec;
 
-	assert(gray != NULL);
-	assert(blur != NULL);
+	ok = failed = 0;
 
-	len = gray->w*gray->h;
-	err = 0;
+	/* decoded and output images recycle the blocks of earlier ones */
+	io.pool = img_pool_new();
 
-	cl_img_gaussian_blur = create_kernel(program, "cl_img_gaussian_blur");
+	clock_gettime(CLOCK_MONOTONIC, &t0);
 
-	gray_buf = create_buffer(context,  CL_MEM_READ_ONLY, len, NULL);
-	gauss_buf = create_buffer(context, CL_MEM_READ_ONLY, gauss_dim*gauss_dim*sizeof(cl_int), NULL);
-	/* output buffer */
-	blur_buf = create_buffer(context, CL_MEM_WRITE_ONLY, len, NULL);
+	if (be->sched != NULL)
+		batch_sched(be, pl, names, n, outdir, &ok, &failed);
+	else
+		batch_ring(be, pl, names, n, outdir, &ok, &failed);
 
-	err |= clSetKernelArg(cl_img_gaussian_blur, 0, sizeof(cl_mem), &gray_buf);
-	err |= clSetKernelArg(cl_img_gaussian_blur, 1, sizeof(cl_mem), &blur_buf);
-	err |= clSetKernelArg(cl_img_gaussian_blur, 2, sizeof(cl_mem), &gauss_buf);
-	err |= clSetKernelArg(cl_img_gaussian_blur, 3, sizeof(cl_int), &gauss_dim);
-	err |= clSetKernelArg(cl_img_gaussian_blur, 4, sizeof(cl_int), &gauss_sum);
-	err |= clSetKernelArg(cl_img_gaussian_blur, 5, sizeof(cl_int), &gray->w);
-	err |= clSetKernelArg(cl_img_gaussian_blur, 6, sizeof(cl_int), &gray->h);
-	
-	if (err != CL_SUCCESS) {
-		fprintf(stderr, "error: clSetKernelArg() %d %s\n", err, cl_strerror(err));
-		exit(EXIT_FAILURE);
-	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	sec = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec)/1e9;
 
-	err |= clEnqueueWriteBuffer(queue, gray_buf, CL_FALSE, 0, len, gray->pix, 0, NULL, NULL);
-	err |= clEnqueueWriteBuffer(queue, gauss_buf, CL_FALSE, 0, gauss_dim*gauss_dim*sizeof(cl_int), gauss, 0, NULL, NULL);
+	img_pool_destroy(io.pool);
+	io.pool = NULL;
 
-	if (err != CL_SUCCESS) {
-		fprintf(stderr, "error: clEnqueueWriteBuffer() %d %s\n", err, cl_strerror(err));
-		exit(EXIT_FAILURE);
-	}	
+	printf("%d images in %.3f s, %.2f images/s", ok, sec, sec > 0 ? ok/sec : 0.0);
+	if (failed)
+		printf(", %d failed", failed);
+	printf("\n");
 
-	global_wblur[0] = gray->h;
-	global_wblur[1] = gray->w;
-	local_wblur[0] = local_wblur[1] = 32;
+	if (be->sched != NULL)
+		xcl_sched_report(be->sched, stdout, "images");
+}
 
-	err = clEnqueueNDRangeKernel(queue, cl_img_gaussian_blur, 2, NULL, global_wblur, local_wblur, 0, NULL, NULL);
-	if (err != CL_SUCCESS) {
-		fprintf(stderr, "error: clEnqueueNDRangeKernel() blur %d %s\n", err, cl_strerror(err));
+/* breakdown on stdout and the report file of -p */
+static int prof_report(const char *fname)
+{
+	if (fname == NULL)
+		return RET_OK;
+
+	prof_print(stdout);
+
+	return prof_write(fname);
+}
+
+/* mmap the kernel source */
+static char *map_source(const char *fname, size_t *fsize)
+{
+	struct stat sb;
+	FILE *file;
+	char *src;
+
+	/* chek file existance */
+	if (stat(fname, &sb) == -1) {
+		fprintf(stderr, "error: %s\n", strerror(errno));
 		exit(EXIT_FAILURE);
 	}
-
-	err = clEnqueueReadBuffer(queue, blur_buf, CL_TRUE, 0, len, blur->pix, 0, NULL, NULL);
-	if (err != CL_SUCCESS) {
-		fprintf(stderr, "error: clEnqueueReadBuffer() blur %d %s\n", err, cl_strerror(err));
+	
+	file = fopen(fname, "r");
+	
+	if (file == NULL) {
+		fprintf(stderr, "error: %s\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	/* get file size */
+	*fsize = sb.st_size;
+	/* mmap source file to memory */
+	src = mmap(NULL, *fsize, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+	
+	fclose(file);
+	
+	if (src == (void *)(-1)) {
+		fprintf(stderr, "error: %s\n", strerror(errno));
 		exit(EXIT_FAILURE);
 	}
 
-	clReleaseMemObject(gray_buf);
-	clReleaseMemObject(blur_buf);
-	clReleaseMemObject(gauss_buf);
-	clReleaseKernel(cl_img_gaussian_blur);
+	return src;
 }
 
 int main(int argc, char **argv)
 {
-	GdkPixbuf *pbuf, *newbuf;
-	GError *error = NULL;
-	struct img_ctx *rgb, *gray;
-	char *fname, *imgname, *outname, *ext, *src;
-	int w, h, opt;
-	struct stat sb;
-	FILE *file;
+	struct img_ctx *rgb, *gray, *in, view;
+	struct pipeline *pl;
+	struct stage *st;
+	struct backend *be;
+	struct clrt *rt, **rts;
+	backend_type_t backend;
+	char *fname, *imgname, *outname, *src, *cache_dir, *dirname, *listname;
+	char **names;
+	int opt, radius, tile, nthreads, nnames, i, ret, canny, low, high, otsu, band, autotune;
+	int multi, cus, nrts, passes, gray8, cx, cy, cw, ch;
+	char *profname;
+	double t0;
+	variant_t variant;
+	border_type_t border;
+	struct conv *conv;
+	char options[512];
+	float sigma;
 	size_t fsize;
-	cl_int err;
 
 	fname = NULL;
 	outname = NULL;
 	imgname = NULL;
-
-	while ((opt = getopt(argc, argv, "f:i:")) != -1) {
+	dirname = NULL;
+	listname = NULL;
+	cache_dir = clcache_default_dir();
+	sigma = 0;
+	radius = 0;
+	variant = VARIANT_AUTO;
+	border = BORDER_COPY;
+	conv = NULL;
+	passes = 1;
+	gray8 = 0;
+	cw = ch = cx = cy = 0;
+	tile = 0;
+	backend = BACKEND_AUTO;
+	nthreads = 0;
+	canny = 0;
+	otsu = 0;
+	band = 0;
+	autotune = 0;
+	multi = 0;
+	cus = 0;
+	profname = NULL;
+	low = 0;
+	high = 0;
+	img_io_init(&io);
+
+	while ((opt = getopt(argc, argv, "f:i:o:d:l:R:z:Gx:c:Cs:r:Tt:IE:K:n:b:j:eL:H:BS:p:aMU:")) != -1) {
 		switch (opt) {
 		case 'f':
 			fname = xstrdup(optarg);
@@ -349,8 +497,151 @@ int main(int argc, char **argv)
 			imgname = xstrdup(optarg);
 			break;
 		case 'o':
+			/* output image, or output directory in batch mode */
 			outname = xstrdup(optarg);
 			break;
+		case 'd':
+			/* batch: every file of a directory */
+			dirname = xstrdup(optarg);
+			break;
+		case 'l':
+			/* batch: file with one image path per line */
+			listname = xstrdup(optarg);
+			break;
+		case 'R':
+			/* size of headerless .gray and .rgb input, WxH */
+			if (sscanf(optarg, "%dx%d", &io.raw_w, &io.raw_h) != 2 || io.raw_w <= 0 || io.raw_h <= 0) {
+				fprintf(stderr, "error: raw image size `%s' is not WxH\n", optarg);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'z':
+			/* PNG compression level 0..9, lower is faster */
+			io.level = atoi(optarg);
+			if (io.level < 0 || io.level > 9) {
+				fprintf(stderr, "error: compression level must be 0..9\n");
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'G':
+			/* 8 bit PNG output even for edges and binarized images */
+			gray8 = 1;
+			break;
+		case 'x':
+			/* only the region WxH+X+Y of the image, read where it lies */
+			if (sscanf(optarg, "%dx%d+%d+%d", &cw, &ch, &cx, &cy) != 4 || cw <= 0 || ch <= 0 ||
+			    cx < 0 || cy < 0) {
+				fprintf(stderr, "error: region `%s' is not WxH+X+Y\n", optarg);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'c':
+			/* directory for compiled program binaries */
+			if (cache_dir != NULL)
+				xfree(cache_dir);
+			cache_dir = xstrdup(optarg);
+			break;
+		case 'C':
+			/* always compile from source */
+			if (cache_dir != NULL)
+				xfree(cache_dir);
+			cache_dir = NULL;
+			break;
+		case 's':
+			/* gaussian sigma, selects the separable blur */
+			sigma = atof(optarg);
+			break;
+		case 'r':
+			/* blur radius, default is 3*sigma */
+			radius = atoi(optarg);
+			break;
+		case 'T':
+			/* local memory tiled blur */
+			variant = VARIANT_TILED;
+			break;
+		case 't':
+			/* tile edge of the tiled blur, built into the program */
+			tile = atoi(optarg);
+			variant = VARIANT_TILED;
+			break;
+		case 'I':
+			/* blur reads through an image object and a sampler */
+			variant = VARIANT_IMAGE;
+			break;
+		case 'E':
+			/* copy, clamp, mirror or wrap: pixels the blur reads past the edges */
+			if (pipeline_border_parse(optarg, &border) != RET_OK) {
+				fprintf(stderr, "error: unknown border mode `%s'\n", optarg);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'K':
+			/* convolve with a built-in mask, a mask file or "1,2,1;2,4,2;1,2,1" instead of the blur */
+			if (conv != NULL)
+				conv_destroy(conv);
+			conv = conv_parse(optarg);
+			if (conv == NULL)
+				exit(EXIT_FAILURE);
+			break;
+		case 'n':
+			/* blur or convolve this many times, passes stay on the device */
+			passes = atoi(optarg);
+			if (passes < 1) {
+				fprintf(stderr, "error: passes must be at least 1\n");
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'b':
+			/* auto, opencl or native */
+			if (backend_parse(optarg, &backend) != RET_OK) {
+				fprintf(stderr, "error: unknown backend `%s'\n", optarg);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'j':
+			/* native backend threads, default is one per CPU */
+			nthreads = atoi(optarg);
+			break;
+		case 'e':
+			/* canny edges after the blur */
+			canny = 1;
+			break;
+		case 'L':
+			/* canny low threshold, implies -e */
+			low = atoi(optarg);
+			canny = 1;
+			break;
+		case 'H':
+			/* canny high threshold, implies -e */
+			high = atoi(optarg);
+			canny = 1;
+			break;
+		case 'B':
+			/* binarize at the Otsu threshold after the blur */
+			otsu = 1;
+			break;
+		case 'S':
+			/* OpenCL rows per band, default only splits what does not fit */
+			band = atoi(optarg);
+			break;
+		case 'p':
+			/* profile, breakdown on stdout and a .json or .csv report */
+			profname = xstrdup(optarg);
+			prof_enable();
+			break;
+		case 'a':
+			/* time local work sizes not tuned yet, kept in the cache */
+			autotune = 1;
+			break;
+		case 'M':
+			/* every OpenCL device of every platform */
+			multi = 1;
+			break;
+		case 'U':
+			/* split devices into sub-devices of that many compute units, implies -M */
+			cus = atoi(optarg);
+			multi = 1;
+			break;
 		default:
 			fprintf(stderr, "error: unknown option `%i'\n", opt);
 			exit(EXIT_FAILURE);
@@ -360,131 +651,176 @@ int main(int argc, char **argv)
 	argc -= optind;
 	argv += optind;
 
-	if (fname == NULL) {
+	if (fname == NULL && backend != BACKEND_NATIVE) {
 		fprintf(stderr, "error: no file name is specified\n");
 		exit(EXIT_FAILURE);
 	}
 
-	if (imgname == NULL) {
-		fprintf(stderr, "error: no image name is specified\n");
+	if (cus < 0) {
+		fprintf(stderr, "error: compute units per sub-device must be positive\n");
 		exit(EXIT_FAILURE);
-	}	
-	
-	if (outname == NULL) {
-		outname = xstrdup("out.png");
-		ext = get_extention(outname);
 	}
 
-	/* chek file existance */
-	if (stat(fname, &sb) == -1) {
-		fprintf(stderr, "error: %s\n", strerror(errno));
+	if (conv != NULL && (sigma > 0 || radius > 0)) {
+		fprintf(stderr, "error: a mask replaces the gaussian blur, sigma and radius do not apply\n");
 		exit(EXIT_FAILURE);
 	}
-	
-	file = fopen(fname, "r");
-	
-	if (file == NULL) {
-		fprintf(stderr, "error: %s\n", strerror(errno));
+
+	if (sigma < 0 || radius < 0) {
+		fprintf(stderr, "error: sigma and radius must be positive\n");
 		exit(EXIT_FAILURE);
 	}
-	/* get file size */
-	fsize = sb.st_size;
-	/* mmap source file to memory */
-	src = mmap(NULL, fsize, PROT_READ, MAP_PRIVATE, fileno(file), 0);
-	
-	fclose(file);
-	
-	if (src == (void *)(-1)) {
-		fprintf(stderr, "error: %s\n", strerror(errno));
+
+	if (low < 0 || high < 0 || (low > 0 && high > 0 && low > high)) {
+		fprintf(stderr, "error: canny thresholds must be positive, low <= high\n");
 		exit(EXIT_FAILURE);
 	}
 
-	/* read image to buffer */
-	gtk_init(&argc, &argv);
-
-	newbuf = pbuf = NULL;
+	/* radius alone: let +-3 sigma span it */
+	if (radius > 0 && sigma == 0)
+		sigma = radius/3.0;
 
-	pbuf = gdk_pixbuf_new_from_file(imgname, &error);
-	if (pbuf == NULL) {
-		fprintf(stderr, "error: unable to load image\n");
+	if ((imgname != NULL) + (dirname != NULL) + (listname != NULL) != 1) {
+		fprintf(stderr, "error: specify one of an image, a directory or a list\n");
 		exit(EXIT_FAILURE);
 	}
 
-	get_ctx(pbuf, TYPE_RGB, &rgb);
-
-	w = rgb->w;
-	h = rgb->h;
+	if (cw > 0 && imgname == NULL) {
+		fprintf(stderr, "error: a region applies to a single image only\n");
+		exit(EXIT_FAILURE);
+	}
 
-	gray = img_ctx_new(w, h, TYPE_GRAY, C_NONE);
+	if (imgname != NULL && outname == NULL)
+		outname = xstrdup("out.png");
+	if (imgname == NULL && outname == NULL)
+		outname = xstrdup(".");
 
 	/* 
 	 * OPENCL INITIALIZATION
 	 */
-	err = clGetPlatformIDs(1, &platform, NULL);
-	if (err != CL_SUCCESS) {
-		fprintf(stderr, "error: clGetPlatformIDs() errcode %d %s\n", err, cl_strerror(err));
-		exit(EXIT_SUCCESS);
-	}
-	
-	/* get available device */
-	err = clGetDeviceIDs(platform, CL_DEVICE_TYPE_CPU, 1, &device, NULL);
-	if (err != CL_SUCCESS) {
-		fprintf(stderr, "error: clGetPlatformIDs() %d %s\n", err, cl_strerror(err));
-		exit(EXIT_FAILURE);
-	}
+	rts = NULL;
+	nrts = 0;
+	if (backend != BACKEND_NATIVE) {
+		if (multi) {
+			rts = clrt_all(CL_DEVICE_TYPE_ALL, prof_enabled(), cus, &nrts);
+		} else {
+			rt = clrt_new(CL_DEVICE_TYPE_CPU, prof_enabled());
+			if (rt != NULL) {
+				rts = xmalloc(sizeof(*rts));
+				rts[nrts++] = rt;
+			}
+		}
 
-	/* create context */	
-	context = clCreateContext(NULL, 1, &device, NULL, NULL, &err);
-	if (err != CL_SUCCESS) {
-		fprintf(stderr, "error: clCreateContext() %d %s\n", err, cl_strerror(err));
-		exit(EXIT_FAILURE);
+		if (nrts == 0 && backend == BACKEND_OPENCL) {
+			fprintf(stderr, "error: no OpenCL device\n");
+			exit(EXIT_FAILURE);
+		}
 	}
 
-	/* create program source */
-	program = clCreateProgramWithSource(context, 1, (const char **)&src, &fsize, &err);
-	if (err != CL_SUCCESS) {
-		fprintf(stderr, "error: clCreateProgramWithSource() %d %s\n", err, cl_strerror(err));
-		exit(EXIT_FAILURE);
+	if (nrts > 0) {
+		src = map_source(fname, &fsize);
+		for (i = 0; i < nrts; i++) {
+			xcl_build_options(rts[i], options, sizeof(options), tile);
+			clrt_build(rts[i], src, fsize, options, cache_dir);
+			rts[i]->tune = cltune_new(rts[i]->device, cache_dir, autotune);
+		}
+		be = nrts > 1 ? backend_opencl_multi(rts, nrts) : backend_opencl(rts[0]);
+		be->band = band;
+		xfree(rts);
+	} else {
+		if (backend == BACKEND_AUTO)
+			fprintf(stderr, "warning: no OpenCL device, using the native backend\n");
+		be = backend_native(nthreads);
 	}
 
-	/* create comand queue */	
-	queue = clCreateCommandQueue(context, device, 0, &err);
-	if (err != CL_SUCCESS) {
-		fprintf(stderr, "error: clCreateCommandQueue() %d %s\n", err, cl_strerror(err));
-		exit(EXIT_FAILURE);
+	/* on OpenCL the gray plane stays on the device between stages */
+	pl = pipeline_new();
+	pipeline_add(pl, STAGE_GRAYSCALE);
+	if (conv != NULL) {
+		st = pipeline_add(pl, STAGE_CONVOLVE);
+		st->conv = conv;
+	} else {
+		st = pipeline_add(pl, STAGE_GAUSSIAN_BLUR);
+		st->sigma = sigma;
+		st->radius = radius;
 	}
-	
-	build_program(program, 1, &device, NULL, NULL, NULL);
-	
-	/* run kernels */
-	xcl_img_grayscale(rgb, gray);
-	xcl_img_gaussian_blur(gray, gray);
-	
-	/* END OF OPENCL SECTION
-	 */
-	newbuf = gdk_pixbuf_new(GDK_COLORSPACE_RGB, FALSE, 8, w, h);
-	if (newbuf == NULL) {
-		fprintf(stderr, "error: unable to create pixbuf\n");
-		exit(EXIT_FAILURE);
+	st->variant = variant;
+	st->border = border;
+	st->passes = passes;
+	if (canny) {
+		st = pipeline_add(pl, STAGE_CANNY);
+		st->low = low;
+		st->high = high;
 	}
+	if (otsu)
+		pipeline_add(pl, STAGE_OTSU);
 
-	load_ctx(gray, newbuf);
+	/* 0 and 255 only, a bit per pixel loses nothing */
+	if (!gray8 && pipeline_bilevel(pl))
+		io.bits = 1;
 
-	if (!gdk_pixbuf_save(newbuf, outname, ext, &error, NULL)) {
-		fprintf(stderr,"error: failed to save image: %s\n", error->message);
-		g_error_free(error);
+	if (imgname == NULL) {
+		if (dirname != NULL)
+			names = batch_dir(dirname, &nnames);
+		else
+			names = batch_list(listname, &nnames);
+
+		batch_run(be, pl, names, nnames, outname);
+
+		for (i = 0; i < nnames; i++)
+			xfree(names[i]);
+		xfree(names);
+
+		pipeline_destroy(pl);
+		if (conv != NULL)
+			conv_destroy(conv);
+		backend_destroy(be);
+
+		return prof_report(profname) == RET_OK ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	/* PGM and PPM pixels are used where they are mapped */
+	t0 = prof_now();
+	rgb = img_read(imgname, &io);
+	if (rgb == NULL)
 		exit(EXIT_FAILURE);
+	prof_host("img_read", t0);
+
+	/* a view with the rows of the whole image, nothing is copied */
+	in = rgb;
+	if (cw > 0) {
+		if (cx + cw > rgb->w || cy + ch > rgb->h) {
+			fprintf(stderr, "error: region %dx%d+%d+%d is not inside the %dx%d image\n",
+				cw, ch, cx, cy, rgb->w, rgb->h);
+			exit(EXIT_FAILURE);
+		}
+		img_ctx_roi(rgb, cx, cy, cw, ch, &view);
+		in = &view;
 	}
+
+	/* page aligned memory is used by zero-copy devices without a copy */
+	gray = img_ctx_new_flags(in->w, in->h, TYPE_GRAY, C_NONE, IMG_F_NOZERO |
+				 (be->rt != NULL && be->rt->zero_copy ? IMG_F_ALIGNED : 0));
+
+	t0 = prof_now();
+	backend_run(be, pl, in, gray);
+	prof_host("pipeline", t0);
+
+	pipeline_destroy(pl);
+	if (conv != NULL)
+		conv_destroy(conv);
 	
+	t0 = prof_now();
+	ret = img_write(gray, outname, &io);
+	prof_host("img_write", t0);
+
 	img_destroy_ctx(rgb);
 	img_destroy_ctx(gray);
 
-	g_object_unref(G_OBJECT(pbuf));
-	g_object_unref(G_OBJECT(newbuf));
+	backend_destroy(be);
 
-   	clReleaseCommandQueue(queue);
-   	clReleaseProgram(program);
-   	clReleaseContext(context);
+	if (prof_report(profname) != RET_OK)
+		ret = RET_ERR;
 	
-	return EXIT_SUCCESS;
+	return ret == RET_OK ? EXIT_SUCCESS : EXIT_FAILURE;
 }
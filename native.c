@@ -0,0 +1,332 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "native.h"
+#include "img_utils.h"
+#include "xmalloc.h"
+
+/* arguments of one stage, shared by all bands */
+struct native_job {
+	struct img_ctx *src;
+	struct img_ctx *dst;
+	float *tmp;
+	const float *wt;
+	int radius;
+	const struct conv *conv;
+	border_type_t border;
+	struct img_gradient *grad;
+	unsigned int low;
+	unsigned int high;
+	unsigned int *hist;
+	int thresh;
+};
+
+struct native *native_new(int nthreads)
+{
+	struct native *nt;
+
+	nt = xmalloc0(sizeof(*nt));
+	nt->tp = thpool_new(nthreads > 0 ? nthreads : thpool_ncpu());
+
+	return nt;
+}
+
+void native_destroy(struct native *nt)
+{
+	int i;
+
+	assert(nt != NULL);
+
+	for (i = 0; i < 2; i++) {
+		if (nt->tmp[i] != NULL)
+			img_destroy_ctx(nt->tmp[i]);
+	}
+
+	if (nt->ftmp != NULL)
+		xfree(nt->ftmp);
+	if (nt->grad != NULL)
+		img_gradient_destroy(nt->grad);
+
+	thpool_destroy(nt->tp);
+	xfree(nt);
+}
+
+/* a gray plane of w x h that is not `busy' */
+static struct img_ctx *native_tmp(struct native *nt, struct img_ctx *busy, int w, int h)
+{
+	int i;
+
+	i = nt->tmp[0] == busy ? 1 : 0;
+
+	if (nt->tmp[i] != NULL && (nt->tmp[i]->w != w || nt->tmp[i]->h != h)) {
+		img_destroy_ctx(nt->tmp[i]);
+		nt->tmp[i] = NULL;
+	}
+
+	if (nt->tmp[i] == NULL)
+		nt->tmp[i] = img_ctx_new(w, h, TYPE_GRAY, C_NONE);
+
+	return nt->tmp[i];
+}
+
+static void job_grayscale(void *arg, int y0, int y1)
+{
+	struct native_job *job = arg;
+
+	img_grayscale_rows(job->src, job->dst, y0, y1);
+}
+
+static void job_gaussian_blur(void *arg, int y0, int y1)
+{
+	struct native_job *job = arg;
+
+	img_gaussian_blur_rows(job->src, job->dst, job->border, y0, y1);
+}
+
+static void job_blur_h(void *arg, int y0, int y1)
+{
+	struct native_job *job = arg;
+
+	img_blur_h_rows(job->src, job->tmp, job->wt, job->radius, job->border, y0, y1);
+}
+
+static void job_blur_v(void *arg, int y0, int y1)
+{
+	struct native_job *job = arg;
+
+	img_blur_v_rows(job->src, job->tmp, job->dst, job->wt, job->radius, job->border, y0, y1);
+}
+
+static void job_conv(void *arg, int y0, int y1)
+{
+	struct native_job *job = arg;
+
+	img_conv_rows(job->src, job->dst, job->conv, job->border, y0, y1);
+}
+
+static void job_conv_h(void *arg, int y0, int y1)
+{
+	struct native_job *job = arg;
+
+	img_conv_h_rows(job->src, job->tmp, job->conv, job->border, y0, y1);
+}
+
+static void job_conv_v(void *arg, int y0, int y1)
+{
+	struct native_job *job = arg;
+
+	img_conv_v_rows(job->src, job->tmp, job->dst, job->conv, job->border, y0, y1);
+}
+
+static void job_sobel(void *arg, int y0, int y1)
+{
+	struct native_job *job = arg;
+
+	img_sobel_rows(job->src, job->grad, y0, y1);
+}
+
+static void job_nms(void *arg, int y0, int y1)
+{
+	struct native_job *job = arg;
+
+	img_nms_rows(job->grad, job->dst, job->low, job->high, y0, y1);
+}
+
+static void stage_canny(struct native *nt, struct stage *st, struct native_job *job)
+{
+	if (nt->grad != NULL && (nt->grad->w != job->src->w || nt->grad->h != job->src->h)) {
+		img_gradient_destroy(nt->grad);
+		nt->grad = NULL;
+	}
+	if (nt->grad == NULL)
+		nt->grad = img_gradient_new(job->src);
+
+	job->grad = nt->grad;
+	job->low = st->low > 0 ? st->low : CANNY_LOW;
+	job->high = st->high > 0 ? st->high : CANNY_HIGH;
+
+	/* nms looks one row up and down into the gradient */
+	thpool_rows(nt->tp, job->src->h, job_sobel, job);
+	thpool_rows(nt->tp, job->src->h, job_nms, job);
+	img_hysteresis(job->dst);
+}
+
+/* private bins per band, merged with one atomic add per bin */
+static void job_histogram(void *arg, int y0, int y1)
+{
+	struct native_job *job = arg;
+	unsigned int hist[256];
+	int i;
+
+	memset(hist, 0, sizeof(hist));
+	img_histogram_rows(job->src, hist, y0, y1);
+
+	for (i = 0; i < 256; i++) {
+		if (hist[i] != 0)
+			__atomic_fetch_add(&job->hist[i], hist[i], __ATOMIC_RELAXED);
+	}
+}
+
+static void job_binarize(void *arg, int y0, int y1)
+{
+	struct native_job *job = arg;
+
+	img_binarize_rows(job->src, job->dst, job->thresh, y0, y1);
+}
+
+static void stage_otsu(struct native *nt, struct native_job *job)
+{
+	unsigned int hist[256];
+
+	memset(hist, 0, sizeof(hist));
+	job->hist = hist;
+
+	/* thpool_rows() returns after every band, the bins are complete */
+	thpool_rows(nt->tp, job->src->h, job_histogram, job);
+	job->thresh = img_otsu(hist);
+	thpool_rows(nt->tp, job->src->h, job_binarize, job);
+}
+
+/* float plane between the passes of a separable filter */
+static float *native_ftmp(struct native *nt, size_t len)
+{
+	if (nt->ftmp_len < len) {
+		if (nt->ftmp != NULL)
+			xfree(nt->ftmp);
+		nt->ftmp = xmalloc(len*sizeof(*(nt->ftmp)));
+		nt->ftmp_len = len;
+	}
+
+	return nt->ftmp;
+}
+
+static void stage_gaussian_sep(struct native *nt, struct stage *st, struct native_job *job)
+{
+	float *wt;
+
+	job->radius = st->radius > 0 ? st->radius : img_gauss_radius(st->sigma);
+	wt = img_gauss_kernel1d(st->sigma, job->radius);
+	job->wt = wt;
+	job->border = st->border;
+	job->tmp = native_ftmp(nt, job->src->w*job->src->h);
+
+	/* the vertical pass needs whole rows of the horizontal one */
+	thpool_rows(nt->tp, job->src->h, job_blur_h, job);
+	thpool_rows(nt->tp, job->src->h, job_blur_v, job);
+
+	xfree(wt);
+}
+
+static void stage_convolve(struct native *nt, struct stage *st, struct native_job *job)
+{
+	job->conv = st->conv;
+	job->border = st->border;
+
+	if (!st->conv->separable) {
+		thpool_rows(nt->tp, job->src->h, job_conv, job);
+		return;
+	}
+
+	job->tmp = native_ftmp(nt, job->src->w*job->src->h);
+	thpool_rows(nt->tp, job->src->h, job_conv_h, job);
+	thpool_rows(nt->tp, job->src->h, job_conv_v, job);
+}
+
+static void native_stage(struct native *nt, struct stage *st, struct img_ctx *src, struct img_ctx *dst)
+{
+	struct native_job job;
+
+	memset(&job, 0, sizeof(job));
+	job.src = src;
+	job.dst = dst;
+
+	switch (st->type) {
+	case STAGE_GRAYSCALE:
+		if (src->type != TYPE_RGB && src->type != TYPE_PACKED && src->type != TYPE_GRAY) {
+			fprintf(stderr, "error: grayscale stage needs an RGB image\n");
+			exit(EXIT_FAILURE);
+		}
+		thpool_rows(nt->tp, src->h, job_grayscale, &job);
+		break;
+	case STAGE_GAUSSIAN_BLUR:
+		if (src->type != TYPE_GRAY) {
+			fprintf(stderr, "error: blur stage needs a grayscale image\n");
+			exit(EXIT_FAILURE);
+		}
+		if (st->sigma > 0) {
+			stage_gaussian_sep(nt, st, &job);
+		} else {
+			job.border = st->border;
+			thpool_rows(nt->tp, src->h, job_gaussian_blur, &job);
+		}
+		break;
+	case STAGE_CANNY:
+		if (src->type != TYPE_GRAY) {
+			fprintf(stderr, "error: canny stage needs a grayscale image\n");
+			exit(EXIT_FAILURE);
+		}
+		stage_canny(nt, st, &job);
+		break;
+	case STAGE_OTSU:
+		if (src->type != TYPE_GRAY) {
+			fprintf(stderr, "error: otsu stage needs a grayscale image\n");
+			exit(EXIT_FAILURE);
+		}
+		stage_otsu(nt, &job);
+		break;
+	case STAGE_CONVOLVE:
+		if (src->type != TYPE_GRAY) {
+			fprintf(stderr, "error: convolve stage needs a grayscale image\n");
+			exit(EXIT_FAILURE);
+		}
+		stage_convolve(nt, st, &job);
+		break;
+	default:
+		fprintf(stderr, "error: unknown stage %d\n", st->type);
+		abort();
+	}
+}
+
+void native_pipeline_run(struct native *nt, struct pipeline *pl, struct img_ctx *src, struct img_ctx *dst)
+{
+	struct img_ctx *cur, *out;
+	int i, k, passes;
+
+	assert(nt != NULL);
+	assert(pl != NULL);
+	assert(src != NULL);
+	assert(dst != NULL);
+
+	if (dst->type != TYPE_GRAY || dst->w != src->w || dst->h != src->h) {
+		fprintf(stderr, "error: output image does not match pipeline result\n");
+		exit(EXIT_FAILURE);
+	}
+
+	cur = src;
+
+	for (i = 0; i < pl->nstages; i++) {
+		passes = stage_passes(&pl->stages[i]);
+
+		/* passes ping-pong between the two planes of `nt' */
+		for (k = 0; k < passes; k++) {
+			/* the last one writes to `dst' unless it would read it too */
+			if (i == pl->nstages - 1 && k == passes - 1 && dst->pix != cur->pix)
+				out = dst;
+			else
+				out = native_tmp(nt, cur, src->w, src->h);
+
+			native_stage(nt, &pl->stages[i], cur, out);
+			cur = out;
+		}
+	}
+
+	if (cur != dst) {
+		if (cur->type != TYPE_GRAY) {
+			fprintf(stderr, "error: output image does not match pipeline result\n");
+			exit(EXIT_FAILURE);
+		}
+		img_ctx_copy(cur, dst);
+	}
+}
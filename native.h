@@ -0,0 +1,26 @@
+#ifndef NATIVE_H_
+#define NATIVE_H_
+
+#include "img.h"
+#include "pipeline.h"
+#include "thpool.h"
+
+/*
+ * Native pipeline: the stages of img_utils.c run on the host, every
+ * stage split into row bands over a thread pool. Intermediate planes
+ * are kept between runs like the device buffers of struct clrt.
+ */
+struct native {
+	struct thpool *tp;
+
+	struct img_ctx *tmp[2];	/* ping-pong gray planes */
+	float *ftmp;		/* separable blur intermediate */
+	size_t ftmp_len;
+	struct img_gradient *grad;	/* canny sobel output */
+};
+
+struct native *native_new(int nthreads);
+void native_pipeline_run(struct native *nt, struct pipeline *pl, struct img_ctx *src, struct img_ctx *dst);
+void native_destroy(struct native *nt);
+
+#endif /* NATIVE_H_ */
@@ -0,0 +1,126 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "pipeline.h"
+#include "img.h"
+#include "conv.h"
+#include "xmalloc.h"
+
+struct pipeline *pipeline_new(void)
+{
+	return xmalloc0(sizeof(struct pipeline));
+}
+
+struct stage *pipeline_add(struct pipeline *pl, stage_type_t type)
+{
+	struct stage *st;
+
+	assert(pl != NULL);
+
+	pl->stages = xrealloc(pl->stages, (pl->nstages + 1)*sizeof(*(pl->stages)));
+	st = &pl->stages[pl->nstages++];
+	memset(st, 0, sizeof(*st));
+	st->type = type;
+
+	return st;
+}
+
+/* blur and convolve can be repeated, every other stage runs once */
+int stage_passes(const struct stage *st)
+{
+	assert(st != NULL);
+
+	if (st->type != STAGE_GAUSSIAN_BLUR && st->type != STAGE_CONVOLVE)
+		return 1;
+
+	return st->passes > 1 ? st->passes : 1;
+}
+
+/*
+ * Rows of context above and below an output row the whole pipeline
+ * needs, -1 if a stage looks at the whole image.
+ */
+int pipeline_halo(struct pipeline *pl)
+{
+	struct stage *st;
+	int i, halo, reach;
+
+	assert(pl != NULL);
+
+	halo = 0;
+
+	for (i = 0; i < pl->nstages; i++) {
+		st = &pl->stages[i];
+		switch (st->type) {
+		case STAGE_GRAYSCALE:
+			reach = 0;
+			break;
+		case STAGE_GAUSSIAN_BLUR:
+			/* the first rows read the last ones */
+			if (st->border == BORDER_WRAP)
+				return -1;
+			if (st->sigma > 0)
+				reach = st->radius > 0 ? st->radius : img_gauss_radius(st->sigma);
+			else
+				reach = CONV_GAUSS5_DIM/2;
+			break;
+		case STAGE_CONVOLVE:
+			if (st->border == BORDER_WRAP)
+				return -1;
+			reach = st->conv->h/2;
+			break;
+		default:
+			/* hysteresis and the histogram are global */
+			return -1;
+		}
+
+		/* every pass reads further out */
+		halo += reach*stage_passes(st);
+	}
+
+	return halo;
+}
+
+/* TRUE if the result only holds 0 and 255, edges or a binarized image */
+int pipeline_bilevel(struct pipeline *pl)
+{
+	stage_type_t type;
+
+	assert(pl != NULL);
+
+	if (pl->nstages == 0)
+		return FALSE;
+
+	type = pl->stages[pl->nstages - 1].type;
+
+	return type == STAGE_CANNY || type == STAGE_OTSU;
+}
+
+void pipeline_destroy(struct pipeline *pl)
+{
+	assert(pl != NULL);
+
+	if (pl->stages != NULL)
+		xfree(pl->stages);
+	xfree(pl);
+}
+
+int pipeline_border_parse(const char *name, border_type_t *border)
+{
+	assert(name != NULL);
+	assert(border != NULL);
+
+	if (strcmp(name, "copy") == 0)
+		*border = BORDER_COPY;
+	else if (strcmp(name, "clamp") == 0)
+		*border = BORDER_CLAMP;
+	else if (strcmp(name, "mirror") == 0)
+		*border = BORDER_MIRROR;
+	else if (strcmp(name, "wrap") == 0)
+		*border = BORDER_WRAP;
+	else
+		return RET_ERR;
+
+	return RET_OK;
+}
@@ -0,0 +1,60 @@
+#ifndef PIPELINE_H_
+#define PIPELINE_H_
+
+#include "common.h"
+#include "conv.h"
+
+typedef enum {
+	STAGE_GRAYSCALE,
+	STAGE_GAUSSIAN_BLUR,
+	STAGE_CANNY,
+	STAGE_OTSU,		/* binarize at the Otsu threshold */
+	STAGE_CONVOLVE		/* any struct conv mask */
+} stage_type_t;
+
+/* canny thresholds on the L1 sobel magnitude, 0..2040 */
+#define CANNY_LOW	40
+#define CANNY_HIGH	100
+
+/* kernel implementation of a stage, VARIANT_AUTO lets the backend pick */
+typedef enum {
+	VARIANT_AUTO = 0,
+	VARIANT_NAIVE,		/* one pixel per work-item from global memory */
+	VARIANT_TILED,		/* fixed mask blur or convolution from local memory tiles */
+	VARIANT_VEC16,		/* 16 pixels per work-item, fixed point */
+	VARIANT_IMAGE		/* fixed mask blur through image2d_t and a sampler */
+} variant_t;
+
+struct stage {
+	stage_type_t type;
+	/* gaussian blur: sigma == 0 selects the fixed 5x5 mask conv_gauss5,
+	 * otherwise a separable kernel of the given radius is used */
+	float sigma;
+	int radius;
+	variant_t variant;
+	/* convolve: the mask, not owned by the stage */
+	const struct conv *conv;
+	/* 5x5 blur and convolve: what they read past the edges */
+	border_type_t border;
+	/* blur and convolve: times the filter is applied, 0 is once */
+	int passes;
+	/* canny: hysteresis thresholds, 0 selects CANNY_LOW/CANNY_HIGH */
+	int low;
+	int high;
+};
+
+/* ordered list of processing stages, independent of where they run */
+struct pipeline {
+	struct stage *stages;
+	int nstages;
+};
+
+struct pipeline *pipeline_new(void);
+struct stage *pipeline_add(struct pipeline *pl, stage_type_t type);
+int pipeline_halo(struct pipeline *pl);
+int stage_passes(const struct stage *st);
+int pipeline_bilevel(struct pipeline *pl);
+int pipeline_border_parse(const char *name, border_type_t *border);
+void pipeline_destroy(struct pipeline *pl);
+
+#endif /* PIPELINE_H_ */
@@ -0,0 +1,191 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include <time.h>
+
+#include <CL/cl.h>
+
+#include "prof.h"
+#include "common.h"
+#include "clerr.h"
+
+/*
+ * Per-stage timing, off unless prof_enable() is called. Host stages are
+ * wall clock times, device stages the start to end times of profiling
+ * events. The OpenCL callback thread may add entries too, so they are
+ * kept under a lock.
+ */
+static struct prof_entry entries[PROF_MAX_ENTRIES];
+static int nentries;
+static int enabled;
+static pthread_mutex_t prof_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void prof_enable(void)
+{
+	enabled = TRUE;
+}
+
+int prof_enabled(void)
+{
+	return enabled;
+}
+
+/* monotonic milliseconds */
+double prof_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec*1e3 + ts.tv_nsec/1e6;
+}
+
+void prof_add(const char *name, const char *kind, double ms)
+{
+	struct prof_entry *e;
+	int i;
+
+	assert(name != NULL);
+	assert(kind != NULL);
+
+	if (!enabled)
+		return;
+
+	pthread_mutex_lock(&prof_lock);
+
+	e = NULL;
+	for (i = 0; i < nentries; i++) {
+		if (strcmp(entries[i].name, name) == 0 && strcmp(entries[i].kind, kind) == 0) {
+			e = &entries[i];
+			break;
+		}
+	}
+
+	if (e == NULL) {
+		if (nentries == PROF_MAX_ENTRIES) {
+			pthread_mutex_unlock(&prof_lock);
+			fprintf(stderr, "warning: too many profiled stages, %s dropped\n", name);
+			return;
+		}
+		e = &entries[nentries++];
+		e->name = name;
+		e->kind = kind;
+		e->min_ms = ms;
+		e->max_ms = ms;
+	}
+
+	e->count++;
+	e->total_ms += ms;
+	if (ms < e->min_ms)
+		e->min_ms = ms;
+	if (ms > e->max_ms)
+		e->max_ms = ms;
+
+	pthread_mutex_unlock(&prof_lock);
+}
+
+/* time since `t0' of prof_now() */
+void prof_host(const char *name, double t0)
+{
+	if (enabled)
+		prof_add(name, "host", prof_now() - t0);
+}
+
+/* `ev' must be complete and from a queue with CL_QUEUE_PROFILING_ENABLE */
+void prof_event(const char *name, cl_event ev)
+{
+	cl_ulong start, end;
+	cl_int err;
+
+	if (!enabled)
+		return;
+
+	err = clGetEventProfilingInfo(ev, CL_PROFILING_COMMAND_START, sizeof(start), &start, NULL);
+	err |= clGetEventProfilingInfo(ev, CL_PROFILING_COMMAND_END, sizeof(end), &end, NULL);
+	if (err != CL_SUCCESS) {
+		fprintf(stderr, "warning: clGetEventProfilingInfo() %d %s\n", err, cl_strerror(err));
+		return;
+	}
+
+	prof_add(name, "device", (end - start)/1e6);
+}
+
+/*
+ * Human readable breakdown, in order of first appearance. Host stages
+ * may contain device ones, so times are not summed up.
+ */
+void prof_print(FILE *file)
+{
+	struct prof_entry *e;
+	int i;
+
+	assert(file != NULL);
+
+	fprintf(file, "%-28s %-6s %8s %12s %10s %10s %10s\n", "stage", "kind", "count", "total ms",
+		"avg ms", "min ms", "max ms");
+
+	for (i = 0; i < nentries; i++) {
+		e = &entries[i];
+		fprintf(file, "%-28s %-6s %8lu %12.3f %10.3f %10.3f %10.3f\n", e->name, e->kind,
+			e->count, e->total_ms, e->total_ms/e->count, e->min_ms, e->max_ms);
+	}
+}
+
+static void prof_write_json(FILE *file)
+{
+	struct prof_entry *e;
+	int i;
+
+	fprintf(file, "{\n\t\"stages\": [\n");
+
+	for (i = 0; i < nentries; i++) {
+		e = &entries[i];
+		fprintf(file, "\t\t{ \"name\": \"%s\", \"kind\": \"%s\", \"count\": %lu, "
+			"\"total_ms\": %.6f, \"avg_ms\": %.6f, \"min_ms\": %.6f, \"max_ms\": %.6f }%s\n",
+			e->name, e->kind, e->count, e->total_ms, e->total_ms/e->count, e->min_ms,
+			e->max_ms, i < nentries - 1 ? "," : "");
+	}
+
+	fprintf(file, "\t]\n}\n");
+}
+
+static void prof_write_csv(FILE *file)
+{
+	struct prof_entry *e;
+	int i;
+
+	fprintf(file, "name,kind,count,total_ms,avg_ms,min_ms,max_ms\n");
+
+	for (i = 0; i < nentries; i++) {
+		e = &entries[i];
+		fprintf(file, "%s,%s,%lu,%.6f,%.6f,%.6f,%.6f\n", e->name, e->kind, e->count,
+			e->total_ms, e->total_ms/e->count, e->min_ms, e->max_ms);
+	}
+}
+
+/* CSV if `fname' ends in .csv, JSON otherwise */
+int prof_write(const char *fname)
+{
+	const char *ext;
+	FILE *file;
+
+	assert(fname != NULL);
+
+	file = fopen(fname, "w");
+	if (file == NULL) {
+		fprintf(stderr, "error: unable to open %s\n", fname);
+		return RET_ERR;
+	}
+
+	ext = strrchr(fname, '.');
+	if (ext != NULL && strcmp(ext, ".csv") == 0)
+		prof_write_csv(file);
+	else
+		prof_write_json(file);
+
+	fclose(file);
+
+	return RET_OK;
+}
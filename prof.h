@@ -0,0 +1,29 @@
+#ifndef PROF_H_
+#define PROF_H_
+
+#include <stdio.h>
+
+#include <CL/cl.h>
+
+#define PROF_MAX_ENTRIES 64
+
+/* accumulated time of one named stage */
+struct prof_entry {
+	const char *name;	/* must outlive the profile */
+	const char *kind;	/* "host" or "device" */
+	unsigned long count;
+	double total_ms;
+	double min_ms;
+	double max_ms;
+};
+
+void prof_enable(void);
+int prof_enabled(void);
+double prof_now(void);
+void prof_add(const char *name, const char *kind, double ms);
+void prof_host(const char *name, double t0);
+void prof_event(const char *name, cl_event ev);
+void prof_print(FILE *file);
+int prof_write(const char *fname);
+
+#endif /* PROF_H_ */
@@ -129,13 +129,21 @@ int img_gaussian_blur(struct img_ctx *src, struct img_ctx *dst)
 		return RET_ERR;
 	}
 
+	if (src->pix == dst->pix) {
+		fprintf(stderr, "error: blur cannot be done in place\n");
+		return RET_ERR;
+	}
+
 	w = src->w;
 	h = src->h;
+
+	/* the two pixel border the mask does not reach is copied */
+	memcpy(dst->pix, src->pix, w*h);
 	
 	/* start with third line */
-	for (y = 2; y < h; y++) {
+	for (y = 2; y + 2 < h; y++) {
 		/* skip two pixel from the left */
-		for (x = 2; x < w; x++) {
+		for (x = 2; x + 2 < w; x++) {
 			/* apply convolution mask 
 			 */
 					   /* 1 */
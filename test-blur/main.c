@@ -190,7 +190,8 @@ int main(int argc, char **argv)
 
 	gray = img_ctx_new(w, h, TYPE_GRAY, C_NONE);
 	img_grayscale(rgb, gray);
-	img_gaussian_blur(gray, gray);	
+	blur = img_ctx_new(w, h, TYPE_GRAY, C_NONE);
+	img_gaussian_blur(gray, blur);
 	
 	newbuf = gdk_pixbuf_new(GDK_COLORSPACE_RGB, FALSE, 8, w, h);
 	if (newbuf == NULL) {
@@ -198,7 +199,7 @@ int main(int argc, char **argv)
 		exit(EXIT_FAILURE);
 	}
 
-	load_ctx(gray, newbuf);
+	load_ctx(blur, newbuf);
 
 	if (!gdk_pixbuf_save(newbuf, outname, ext, &error, NULL)) {
 		fprintf(stderr,"error: failed to save image: %s\n", error->message);
@@ -208,6 +209,7 @@ int main(int argc, char **argv)
 
 	img_destroy_ctx(rgb);
 	img_destroy_ctx(gray);
+	img_destroy_ctx(blur);
 
 	g_object_unref(G_OBJECT(pbuf));
 	g_object_unref(G_OBJECT(newbuf));
@@ -0,0 +1,142 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "thpool.h"
+#include "xmalloc.h"
+
+/* bands per thread, more than one evens out uneven rows */
+#define THPOOL_BANDS 4
+
+int thpool_ncpu(void)
+{
+	long n;
+
+	n = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return n > 0 ? n : 1;
+}
+
+/* take bands of the current job until none are left, called locked */
+static void thpool_work(struct thpool *tp)
+{
+	int band, y0, y1;
+
+	while (tp->next < tp->nbands) {
+		band = tp->next++;
+		y0 = (long)band*tp->rows/tp->nbands;
+		y1 = (long)(band + 1)*tp->rows/tp->nbands;
+
+		pthread_mutex_unlock(&tp->lock);
+		tp->fn(tp->arg, y0, y1);
+		pthread_mutex_lock(&tp->lock);
+	}
+}
+
+static void *thpool_worker(void *data)
+{
+	struct thpool *tp;
+	unsigned long seen;
+
+	tp = data;
+	seen = 0;
+
+	pthread_mutex_lock(&tp->lock);
+
+	for (;;) {
+		while (!tp->quit && tp->gen == seen)
+			pthread_cond_wait(&tp->work, &tp->lock);
+		if (tp->quit)
+			break;
+
+		seen = tp->gen;
+		thpool_work(tp);
+
+		if (--tp->active == 0)
+			pthread_cond_signal(&tp->done);
+	}
+
+	pthread_mutex_unlock(&tp->lock);
+
+	return NULL;
+}
+
+struct thpool *thpool_new(int nthreads)
+{
+	struct thpool *tp;
+	int i;
+
+	assert(nthreads > 0);
+
+	tp = xmalloc0(sizeof(*tp));
+	tp->nthreads = nthreads;
+	tp->threads = xmalloc0(nthreads*sizeof(*(tp->threads)));
+
+	pthread_mutex_init(&tp->lock, NULL);
+	pthread_cond_init(&tp->work, NULL);
+	pthread_cond_init(&tp->done, NULL);
+
+	/* thread 0 is the caller */
+	for (i = 1; i < nthreads; i++) {
+		if (pthread_create(&tp->threads[i], NULL, thpool_worker, tp) != 0) {
+			fprintf(stderr, "error: unable to create thread\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	return tp;
+}
+
+/* run `fn' over `rows' rows split into bands, returns when all are done */
+void thpool_rows(struct thpool *tp, int rows, thpool_fn_t fn, void *arg)
+{
+	assert(tp != NULL);
+	assert(fn != NULL);
+
+	if (rows <= 0)
+		return;
+
+	pthread_mutex_lock(&tp->lock);
+
+	tp->fn = fn;
+	tp->arg = arg;
+	tp->rows = rows;
+	tp->nbands = tp->nthreads*THPOOL_BANDS < rows ? tp->nthreads*THPOOL_BANDS : rows;
+	tp->next = 0;
+	tp->active = tp->nthreads - 1;
+	tp->gen++;
+	pthread_cond_broadcast(&tp->work);
+
+	thpool_work(tp);
+
+	/* every worker has to see the job before the next one is posted */
+	while (tp->active > 0)
+		pthread_cond_wait(&tp->done, &tp->lock);
+
+	pthread_mutex_unlock(&tp->lock);
+}
+
+void thpool_destroy(struct thpool *tp)
+{
+	int i;
+
+	assert(tp != NULL);
+
+	pthread_mutex_lock(&tp->lock);
+	tp->quit = TRUE;
+	pthread_cond_broadcast(&tp->work);
+	pthread_mutex_unlock(&tp->lock);
+
+	for (i = 1; i < tp->nthreads; i++)
+		pthread_join(tp->threads[i], NULL);
+
+	pthread_mutex_destroy(&tp->lock);
+	pthread_cond_destroy(&tp->work);
+	pthread_cond_destroy(&tp->done);
+
+	xfree(tp->threads);
+	xfree(tp);
+}
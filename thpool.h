@@ -0,0 +1,37 @@
+#ifndef THPOOL_H_
+#define THPOOL_H_
+
+#include <pthread.h>
+
+/* work on rows [y0, y1) of an image */
+typedef void (*thpool_fn_t)(void *arg, int y0, int y1);
+
+/*
+ * Fixed set of worker threads splitting the rows of an image into bands.
+ * The calling thread works on bands too, so `nthreads' counts it.
+ */
+struct thpool {
+	pthread_t *threads;
+	int nthreads;
+
+	pthread_mutex_t lock;
+	pthread_cond_t work;	/* a new job or shutdown */
+	pthread_cond_t done;	/* the last worker left the job */
+
+	/* current job */
+	thpool_fn_t fn;
+	void *arg;
+	int rows;
+	int nbands;
+	int next;		/* next band to take */
+	int active;		/* workers still in the job */
+	unsigned long gen;	/* bumped for every job */
+	int quit;
+};
+
+int thpool_ncpu(void);
+struct thpool *thpool_new(int nthreads);
+void thpool_rows(struct thpool *tp, int rows, thpool_fn_t fn, void *arg);
+void thpool_destroy(struct thpool *tp);
+
+#endif /* THPOOL_H_ */
@@ -0,0 +1,1452 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include <CL/cl.h>
+
+#include "xcl_img.h"
+#include "clerr.h"
+#include "xmalloc.h"
+#include "conv.h"
+#include "prof.h"
+#include "cltune.h"
+
+void xcl_pipe_init(struct xcl_pipe *p, struct clrt *rt, cl_command_queue queue)
+{
+	assert(p != NULL);
+	assert(rt != NULL);
+
+	memset(p, 0, sizeof(*p));
+	p->rt = rt;
+	p->queue = queue;
+}
+
+/* host memory used by the device in place, CPU and unified memory only */
+static cl_mem pipe_wrap(struct xcl_pipe *p, void *ptr, size_t size)
+{
+	cl_mem mem;
+
+	assert(p->nwrapped < XCL_PIPE_MAX_WRAPPED);
+
+	mem = clrt_buf_wrap(p->rt, ptr, size);
+	p->wrapped[p->nwrapped++] = mem;
+
+	return mem;
+}
+
+static int pipe_is_wrapped(struct xcl_pipe *p, cl_mem mem)
+{
+	int i;
+
+	for (i = 0; i < p->nwrapped; i++) {
+		if (p->wrapped[i] == mem)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+/* take a buffer for this pass, reusing one released by an earlier stage */
+static cl_mem pipe_buf_get(struct xcl_pipe *p, size_t size)
+{
+	struct xcl_pipe_buf *b;
+	int i;
+
+	for (i = 0; i < p->nbufs; i++) {
+		b = &p->bufs[i];
+		if (!b->busy && b->size >= size) {
+			b->busy = TRUE;
+			return b->mem;
+		}
+	}
+
+	assert(p->nbufs < XCL_PIPE_MAX_BUFS);
+
+	b = &p->bufs[p->nbufs++];
+	b->mem = clrt_buf_get(p->rt, size);
+	b->size = size;
+	b->busy = TRUE;
+
+	return b->mem;
+}
+
+/*
+ * The buffer stays with the pass until xcl_pipe_finish(). Reusing it for
+ * a later stage is safe since all commands of a pass go to one in-order
+ * queue.
+ */
+static void pipe_buf_put(struct xcl_pipe *p, cl_mem mem)
+{
+	int i;
+
+	if (pipe_is_wrapped(p, mem))
+		return;
+
+	for (i = 0; i < p->nbufs; i++) {
+		if (p->bufs[i].mem == mem) {
+			p->bufs[i].busy = FALSE;
+			return;
+		}
+	}
+
+	assert(0);
+}
+
+/*
+ * Output plane of a stage and the bytes `*pitch' between its rows: the
+ * caller's image if this is the last stage, else rows at the pitch the
+ * caller asked for or packed ones.
+ */
+static cl_mem pipe_out(struct xcl_pipe *p, int *pitch)
+{
+	cl_mem mem;
+
+	*pitch = p->target_pitch > 0 ? p->target_pitch : p->w;
+	p->target_pitch = 0;
+
+	if (p->target != NULL) {
+		mem = p->target;
+		p->target = NULL;
+		return mem;
+	}
+
+	return pipe_buf_get(p, (size_t)(p->h - 1)**pitch + p->w);
+}
+
+/* wait list of the next command, empty while nothing is enqueued */
+static cl_uint pipe_nwait(struct xcl_pipe *p)
+{
+	return p->ev != NULL ? 1 : 0;
+}
+
+static const cl_event *pipe_wait(struct xcl_pipe *p)
+{
+	return p->ev != NULL ? &p->ev : NULL;
+}
+
+/* hand the profiled commands of the pass to prof.c, all must be done */
+static void pipe_prof_drain(struct xcl_pipe *p)
+{
+	cl_int err;
+	int i;
+
+	if (p->nevs == 0)
+		return;
+
+	if (p->ev != NULL) {
+		err = clWaitForEvents(1, &p->ev);
+		if (err != CL_SUCCESS) {
+			fprintf(stderr, "error: clWaitForEvents() %d %s\n", err, cl_strerror(err));
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	for (i = 0; i < p->nevs; i++) {
+		prof_event(p->evs[i].name, p->evs[i].ev);
+		clReleaseEvent(p->evs[i].ev);
+	}
+	p->nevs = 0;
+}
+
+/*
+ * Make `ev' the event the next command has to wait for. With profiling
+ * it is kept under `name' until the pass is finished; a full list makes
+ * the pass wait early, which only costs time while profiling.
+ */
+static void pipe_advance(struct xcl_pipe *p, cl_event ev, const char *name)
+{
+	if (p->rt->profile) {
+		if (p->nevs == XCL_PIPE_MAX_EVENTS)
+			pipe_prof_drain(p);
+		clRetainEvent(ev);
+		p->evs[p->nevs].name = name;
+		p->evs[p->nevs].ev = ev;
+		p->nevs++;
+	}
+
+	if (p->ev != NULL)
+		clReleaseEvent(p->ev);
+	p->ev = ev;
+}
+
+/* bytes from the first pixel of `c' to the end of its last row, of a plane for TYPE_RGB */
+static size_t pipe_block(struct img_ctx *c)
+{
+	return (size_t)(c->h - 1)*c->pitch + img_row_size(c);
+}
+
+/*
+ * Rows [skip, skip + rows) of the gray result into rows from `y0' on of
+ * `dst'. Rows of the same pitch go in one read unless the bytes between
+ * them may be pixels of another image, as for a view; then as a rectangle.
+ */
+static cl_int pipe_read_rows(struct xcl_pipe *p, struct img_ctx *dst, int skip, int y0, int rows,
+			     cl_event *ev)
+{
+	size_t buf_origin[3] = {0, 0, 0};
+	size_t host_origin[3] = {0, 0, 0};
+	size_t region[3];
+	unsigned char *host;
+
+	host = dst->pix + (size_t)y0*dst->pitch;
+
+	if (dst->pitch == p->pitch && (p->pitch == p->w || !(dst->flags & IMG_F_FOREIGN)))
+		return clEnqueueReadBuffer(p->queue, p->cur, CL_FALSE, (size_t)skip*p->pitch,
+					   (size_t)(rows - 1)*p->pitch + p->w, host, pipe_nwait(p), pipe_wait(p), ev);
+
+	buf_origin[1] = skip;
+	region[0] = p->w;
+	region[1] = rows;
+	region[2] = 1;
+
+	return clEnqueueReadBufferRect(p->queue, p->cur, CL_FALSE, buf_origin, host_origin, region,
+				       p->pitch, 0, dst->pitch, 0, host, pipe_nwait(p), pipe_wait(p), ev);
+}
+
+/*
+ * Device planes keep the rows of `src' with their padding, kernels take
+ * the pitch. A pitched block, a view included, is wrapped as it is on
+ * zero-copy devices and otherwise written in one piece; RGB planes only
+ * share a wrapper if they are one block.
+ */
+void xcl_pipe_upload(struct xcl_pipe *p, struct img_ctx *src)
+{
+	cl_event ev;
+	cl_int err;
+	size_t size;
+	int block;
+
+	assert(p != NULL);
+	assert(src != NULL);
+
+	size = pipe_block(src);
+
+	p->type = src->type;
+	p->w = src->w;
+	p->h = src->h;
+	p->pitch = src->pitch;
+	p->nchan = src->nchan;
+	p->src = src;
+
+	switch (src->type) {
+	case TYPE_GRAY:
+	case TYPE_PACKED:
+		/* nothing to copy, the first stage waits on nothing */
+		if (p->rt->zero_copy) {
+			p->cur = pipe_wrap(p, src->pix, size);
+			return;
+		}
+		p->cur = pipe_buf_get(p, size);
+		err = clEnqueueWriteBuffer(p->queue, p->cur, CL_FALSE, 0, size, src->pix, 0, NULL, &ev);
+		break;
+	case TYPE_RGB:
+		block = src->g > src->r && src->b - src->g == src->g - src->r;
+		if (p->rt->zero_copy && block) {
+			p->plane = src->g - src->r;
+			p->cur = pipe_wrap(p, src->r, 2*p->plane + size);
+			return;
+		}
+		p->plane = size;
+		p->cur = pipe_buf_get(p, 3*size);
+		err = clEnqueueWriteBuffer(p->queue, p->cur, CL_FALSE, 0, size, src->r, 0, NULL, &ev);
+		pipe_advance(p, ev, "upload");
+		err |= clEnqueueWriteBuffer(p->queue, p->cur, CL_FALSE, size, size, src->g, 1, &p->ev, &ev);
+		pipe_advance(p, ev, "upload");
+		err |= clEnqueueWriteBuffer(p->queue, p->cur, CL_FALSE, 2*size, size, src->b, 1, &p->ev, &ev);
+		break;
+	default:
+		fprintf(stderr, "error: not implemented\n");
+		abort();
+	}
+
+	if (err != CL_SUCCESS) {
+		fprintf(stderr, "error: clEnqueueWriteBuffer() %d %s\n", err, cl_strerror(err));
+		exit(EXIT_FAILURE);
+	}
+
+	pipe_advance(p, ev, "upload");
+}
+
+/*
+ * Options every build of kernels/img.cl for `rt' needs. `tile' > 0 sets
+ * TILE_SIZE, which shrinks until the tiled kernels' TILE_SIZE^2 work-items
+ * fit CL_DEVICE_MAX_WORK_GROUP_SIZE.
+ */
+void xcl_build_options(struct clrt *rt, char *buf, size_t size, int tile)
+{
+	int n, t;
+
+	n = snprintf(buf, size, "-DGRAY_WR=%d -DGRAY_WG=%d -DGRAY_WB=%d -DGRAY_SHIFT=%d"
+		     " -DTAN_22_Q16=%d -DTAN_67_Q16=%d"
+		     " -DDIR_NONE=%d -DDIR_VERTICAL=%d -DDIR_HORIZONTAL=%d"
+		     " -DDIR_POSITIVE_DIAG=%d -DDIR_NEGATIVE_DIAG=%d"
+		     " -DEDGE_NONE=%d -DEDGE_WEAK=%d -DEDGE_STRONG=%d"
+		     " -DBORDER_COPY=%d -DBORDER_CLAMP=%d -DBORDER_MIRROR=%d -DBORDER_WRAP=%d",
+		     GRAY_WR, GRAY_WG, GRAY_WB, GRAY_SHIFT,
+		     TAN_Q16(TAN_22), TAN_Q16(TAN_67),
+		     DIR_NONE, DIR_VERTICAL, DIR_HORIZONTAL, DIR_POSITIVE_DIAG, DIR_NEGATIVE_DIAG,
+		     EDGE_NONE, EDGE_WEAK, EDGE_STRONG,
+		     BORDER_COPY, BORDER_CLAMP, BORDER_MIRROR, BORDER_WRAP);
+
+	t = tile > 0 ? tile : XCL_TILE_SIZE;
+	while (t > 1 && (size_t)t*t > rt->max_wg)
+		t--;
+	if (tile > 0 && t != tile)
+		fprintf(stderr, "warning: tile %d over %zu work-items, using %d\n", tile, rt->max_wg, t);
+
+	if ((tile > 0 || t != XCL_TILE_SIZE) && n < size)
+		snprintf(buf + n, size - n, " -DTILE_SIZE=%d", t);
+}
+
+/*
+ * Work-group of a tiled kernel, the TILE_SIZE x TILE_SIZE the program was
+ * built with. The compiler may still allow fewer work-items for the kernel.
+ */
+static void tile_local(struct xcl_pipe *p, cl_kernel kernel, const char *name, size_t *local)
+{
+	size_t kmax;
+	cl_int err;
+
+	err = clGetKernelWorkGroupInfo(kernel, p->rt->device, CL_KERNEL_COMPILE_WORK_GROUP_SIZE,
+				       3*sizeof(*local), local, NULL);
+	err |= clGetKernelWorkGroupInfo(kernel, p->rt->device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(kmax),
+					&kmax, NULL);
+	if (err != CL_SUCCESS) {
+		fprintf(stderr, "error: clGetKernelWorkGroupInfo() %d %s\n", err, cl_strerror(err));
+		exit(EXIT_FAILURE);
+	}
+
+	if (local[0]*local[1] > kmax) {
+		fprintf(stderr, "error: %s runs at most %zu work-items, a smaller -t tile is needed\n", name,
+			kmax);
+		exit(EXIT_FAILURE);
+	}
+}
+
+/*
+ * Only the fixed point vector kernel matches img_grayscale() bit for
+ * bit, the double one is there to be asked for explicitly.
+ */
+static variant_t grayscale_variant(struct stage *st)
+{
+	if (st->variant != VARIANT_AUTO)
+		return st->variant;
+
+	return VARIANT_VEC16;
+}
+
+static void stage_grayscale_packed(struct xcl_pipe *p)
+{
+	cl_kernel cl_img_grayscale_packed;
+	cl_mem out;
+	cl_event ev;
+	cl_int err;
+	size_t global_work_size[2], local_work_size[2];
+	const size_t *local;
+	int opitch;
+
+	err = 0;
+
+	cl_img_grayscale_packed = clrt_kernel(p->rt, "cl_img_grayscale_packed");
+	out = pipe_out(p, &opitch);
+
+	err |= clSetKernelArg(cl_img_grayscale_packed, 0, sizeof(cl_mem), &p->cur);
+	err |= clSetKernelArg(cl_img_grayscale_packed, 1, sizeof(cl_mem), &out);
+	err |= clSetKernelArg(cl_img_grayscale_packed, 2, sizeof(cl_int), &p->w);
+	err |= clSetKernelArg(cl_img_grayscale_packed, 3, sizeof(cl_int), &p->h);
+	err |= clSetKernelArg(cl_img_grayscale_packed, 4, sizeof(cl_int), &p->pitch);
+	err |= clSetKernelArg(cl_img_grayscale_packed, 5, sizeof(cl_int), &p->nchan);
+	err |= clSetKernelArg(cl_img_grayscale_packed, 6, sizeof(cl_int), &opitch);
+
+	if (err != CL_SUCCESS) {
+		fprintf(stderr, "error: clSetKernelArg() %d %s\n", err, cl_strerror(err));
+		exit(EXIT_FAILURE);
+	}
+
+	global_work_size[0] = p->h;
+	global_work_size[1] = p->w;
+	local = cltune_local(p->rt, p->queue, cl_img_grayscale_packed, "cl_img_grayscale_packed", 2,
+			     global_work_size, local_work_size, FALSE);
+
+	err = clEnqueueNDRangeKernel(p->queue, cl_img_grayscale_packed, 2, NULL, global_work_size, local,
+				     pipe_nwait(p), pipe_wait(p), &ev);
+	if (err != CL_SUCCESS) {
+		fprintf(stderr, "error: clEnqueueNDRangeKernel() %d %s\n", err, cl_strerror(err));
+		exit(EXIT_FAILURE);
+	}
+
+	pipe_buf_put(p, p->cur);
+	p->cur = out;
+	p->type = TYPE_GRAY;
+	p->pitch = opitch;
+	pipe_advance(p, ev, "cl_img_grayscale_packed");
+}
+
+static void stage_grayscale(struct xcl_pipe *p, struct stage *st)
+{
+	cl_kernel cl_img_grayscale;
+	const char *name;
+	cl_mem out;
+	cl_event ev;
+	cl_int err;
+	cl_uint plane;
+	size_t global_work_size[2], local_work_size[2];
+	const size_t *local;
+	int opitch;
+
+	if (p->type == TYPE_PACKED) {
+		stage_grayscale_packed(p);
+		return;
+	}
+
+	/* gray input, e.g. a PGM, is passed on as it is */
+	if (p->type == TYPE_GRAY)
+		return;
+
+	if (p->type != TYPE_RGB) {
+		fprintf(stderr, "error: grayscale stage needs an RGB image\n");
+		exit(EXIT_FAILURE);
+	}
+
+	plane = p->plane;
+	err = 0;
+
+	global_work_size[0] = p->h;
+	if (grayscale_variant(st) == VARIANT_VEC16) {
+		name = "cl_img_grayscale16";
+		global_work_size[1] = (p->w + 15)/16;
+	} else {
+		name = "cl_img_grayscale";
+		global_work_size[1] = p->w;
+	}
+	cl_img_grayscale = clrt_kernel(p->rt, name);
+
+	out = pipe_out(p, &opitch);
+
+	err |= clSetKernelArg(cl_img_grayscale, 0, sizeof(cl_mem), &p->cur);
+	err |= clSetKernelArg(cl_img_grayscale, 1, sizeof(cl_mem), &out);
+	err |= clSetKernelArg(cl_img_grayscale, 2, sizeof(cl_int), &p->w);
+	err |= clSetKernelArg(cl_img_grayscale, 3, sizeof(cl_int), &p->h);
+	err |= clSetKernelArg(cl_img_grayscale, 4, sizeof(cl_int), &p->pitch);
+	err |= clSetKernelArg(cl_img_grayscale, 5, sizeof(cl_uint), &plane);
+	err |= clSetKernelArg(cl_img_grayscale, 6, sizeof(cl_int), &opitch);
+
+	if (err != CL_SUCCESS) {
+		fprintf(stderr, "error: clSetKernelArg() %d %s\n", err, cl_strerror(err));
+		exit(EXIT_FAILURE);
+	}
+
+	local = cltune_local(p->rt, p->queue, cl_img_grayscale, name, 2, global_work_size, local_work_size,
+			     TRUE);
+
+	err = clEnqueueNDRangeKernel(p->queue, cl_img_grayscale, 2, NULL, global_work_size, local,
+				     pipe_nwait(p), pipe_wait(p), &ev);
+	if (err != CL_SUCCESS) {
+		fprintf(stderr, "error: clEnqueueNDRangeKernel() %d %s\n", err, cl_strerror(err));
+		exit(EXIT_FAILURE);
+	}
+
+	pipe_buf_put(p, p->cur);
+	p->cur = out;
+	p->type = TYPE_GRAY;
+	p->pitch = opitch;
+	pipe_advance(p, ev, name);
+}
+
+/* hardware addressing mode doing what `border' does past the edges */
+static cl_addressing_mode border_addressing(border_type_t border)
+{
+	switch (border) {
+	case BORDER_MIRROR:
+		return CL_ADDRESS_MIRRORED_REPEAT;
+	case BORDER_WRAP:
+		return CL_ADDRESS_REPEAT;
+	default:
+		/* copy only samples inside */
+		return CL_ADDRESS_CLAMP_TO_EDGE;
+	}
+}
+
+/*
+ * Copy cur into a pooled image for VARIANT_IMAGE. OpenCL 1.2 cannot make
+ * a 2D image over a buffer, so this is one device side copy.
+ */
+static cl_mem pipe_image(struct xcl_pipe *p)
+{
+	size_t origin[3] = {0, 0, 0};
+	size_t region[3];
+	cl_event ev;
+	cl_int err;
+
+	if (p->image == NULL)
+		p->image = clrt_image_get(p->rt, p->w, p->h);
+
+	region[0] = p->w;
+	region[1] = p->h;
+	region[2] = 1;
+
+	err = clEnqueueCopyBufferToImage(p->queue, p->cur, p->image, 0, origin, region,
+					 pipe_nwait(p), pipe_wait(p), &ev);
+	if (err != CL_SUCCESS) {
+		fprintf(stderr, "error: clEnqueueCopyBufferToImage() %d %s\n", err, cl_strerror(err));
+		exit(EXIT_FAILURE);
+	}
+
+	pipe_advance(p, ev, "copy");
+
+	return p->image;
+}
+
+static void stage_gaussian_blur(struct xcl_pipe *p, struct stage *st)
+{
+	cl_mem in, out, gauss_buf;
+	cl_kernel cl_img_gaussian_blur;
+	cl_sampler smp;
+	const char *name;
+	cl_event ev;
+	cl_int err;
+	size_t global_wblur[2];
+	size_t local_wblur[3];
+	const size_t *local;
+	size_t tile;
+	int opitch, border, image, dim, sum;
+
+	if (p->type != TYPE_GRAY) {
+		fprintf(stderr, "error: blur stage needs a grayscale image\n");
+		exit(EXIT_FAILURE);
+	}
+
+	border = st->border;
+	dim = CONV_GAUSS5_DIM;
+	sum = CONV_GAUSS5_SUM;
+	err = 0;
+
+	/* devices without image support and padded rows take the buffer kernel */
+	image = st->variant == VARIANT_IMAGE && p->rt->image_support && p->pitch == p->w;
+
+	if (st->variant == VARIANT_TILED)
+		name = "cl_img_gaussian_blur_tiled";
+	else if (image)
+		name = "cl_img_gaussian_blur_image";
+	else
+		name = "cl_img_gaussian_blur";
+	cl_img_gaussian_blur = clrt_kernel(p->rt, name);
+	gauss_buf = clrt_const(p->rt, "gauss", conv_gauss5, sizeof(conv_gauss5));
+	in = image ? pipe_image(p) : p->cur;
+	/* output buffer */
+	out = pipe_out(p, &opitch);
+
+	err |= clSetKernelArg(cl_img_gaussian_blur, 0, sizeof(cl_mem), &in);
+	err |= clSetKernelArg(cl_img_gaussian_blur, 1, sizeof(cl_mem), &out);
+	err |= clSetKernelArg(cl_img_gaussian_blur, 2, sizeof(cl_mem), &gauss_buf);
+	err |= clSetKernelArg(cl_img_gaussian_blur, 3, sizeof(cl_int), &dim);
+	err |= clSetKernelArg(cl_img_gaussian_blur, 4, sizeof(cl_int), &sum);
+	err |= clSetKernelArg(cl_img_gaussian_blur, 5, sizeof(cl_int), &p->w);
+	err |= clSetKernelArg(cl_img_gaussian_blur, 6, sizeof(cl_int), &p->h);
+	err |= clSetKernelArg(cl_img_gaussian_blur, 7, sizeof(cl_int), &p->pitch);
+	err |= clSetKernelArg(cl_img_gaussian_blur, 8, sizeof(cl_int), &opitch);
+	err |= clSetKernelArg(cl_img_gaussian_blur, 9, sizeof(cl_int), &border);
+
+	if (image) {
+		smp = clrt_sampler(p->rt, border_addressing(st->border));
+		err |= clSetKernelArg(cl_img_gaussian_blur, 10, sizeof(cl_sampler), &smp);
+	}
+
+	if (err != CL_SUCCESS) {
+		fprintf(stderr, "error: clSetKernelArg() %d %s\n", err, cl_strerror(err));
+		exit(EXIT_FAILURE);
+	}
+
+	global_wblur[0] = p->h;
+	global_wblur[1] = p->w;
+
+	if (st->variant == VARIANT_TILED) {
+		tile_local(p, cl_img_gaussian_blur, name, local_wblur);
+		tile = local_wblur[0] + CONV_GAUSS5_DIM - 1;
+		err = clSetKernelArg(cl_img_gaussian_blur, 10, tile*tile, NULL);
+		if (err != CL_SUCCESS) {
+			fprintf(stderr, "error: clSetKernelArg() %d %s\n", err, cl_strerror(err));
+			exit(EXIT_FAILURE);
+		}
+
+		/* whole tiles, the kernel skips work-items outside the image */
+		global_wblur[0] = (p->h + local_wblur[0] - 1)/local_wblur[0]*local_wblur[0];
+		global_wblur[1] = (p->w + local_wblur[1] - 1)/local_wblur[1]*local_wblur[1];
+		local = local_wblur;
+	} else {
+		local = cltune_local(p->rt, p->queue, cl_img_gaussian_blur, name, 2, global_wblur, local_wblur,
+				     TRUE);
+	}
+
+	err = clEnqueueNDRangeKernel(p->queue, cl_img_gaussian_blur, 2, NULL, global_wblur, local,
+				     pipe_nwait(p), pipe_wait(p), &ev);
+	if (err != CL_SUCCESS) {
+		fprintf(stderr, "error: clEnqueueNDRangeKernel() blur %d %s\n", err, cl_strerror(err));
+		exit(EXIT_FAILURE);
+	}
+
+	pipe_buf_put(p, p->cur);
+	p->cur = out;
+	p->pitch = opitch;
+	pipe_advance(p, ev, name);
+}
+
+/* two 1D passes with weights computed from sigma, any radius */
+static void stage_gaussian_sep(struct xcl_pipe *p, struct stage *st)
+{
+	cl_kernel cl_img_blur_h, cl_img_blur_v;
+	cl_mem tmp, out, wt_buf;
+	cl_event ev;
+	cl_int err;
+	size_t global_wblur[2], local_wblur[2];
+	const size_t *local;
+	char name[64];
+	float *wt;
+	size_t len;
+	int opitch, radius, border;
+
+	if (p->type != TYPE_GRAY) {
+		fprintf(stderr, "error: blur stage needs a grayscale image\n");
+		exit(EXIT_FAILURE);
+	}
+
+	len = (size_t)p->w*p->h;
+	radius = st->radius > 0 ? st->radius : img_gauss_radius(st->sigma);
+	border = st->border;
+	err = 0;
+
+	/* weights are uploaded once per sigma and radius, %.9g keeps every float apart */
+	snprintf(name, sizeof(name), "gauss1d:%.9g:%d", st->sigma, radius);
+	wt = img_gauss_kernel1d(st->sigma, radius);
+	wt_buf = clrt_const(p->rt, name, wt, (2*radius + 1)*sizeof(*wt));
+	xfree(wt);
+
+	cl_img_blur_h = clrt_kernel(p->rt, "cl_img_blur_h");
+	cl_img_blur_v = clrt_kernel(p->rt, "cl_img_blur_v");
+
+	tmp = pipe_buf_get(p, len*sizeof(cl_float));
+	out = pipe_out(p, &opitch);
+
+	err |= clSetKernelArg(cl_img_blur_h, 0, sizeof(cl_mem), &p->cur);
+	err |= clSetKernelArg(cl_img_blur_h, 1, sizeof(cl_mem), &tmp);
+	err |= clSetKernelArg(cl_img_blur_h, 2, sizeof(cl_mem), &wt_buf);
+	err |= clSetKernelArg(cl_img_blur_h, 3, sizeof(cl_int), &radius);
+	err |= clSetKernelArg(cl_img_blur_h, 4, sizeof(cl_int), &p->w);
+	err |= clSetKernelArg(cl_img_blur_h, 5, sizeof(cl_int), &p->h);
+	err |= clSetKernelArg(cl_img_blur_h, 6, sizeof(cl_int), &p->pitch);
+	err |= clSetKernelArg(cl_img_blur_h, 7, sizeof(cl_int), &border);
+
+	err |= clSetKernelArg(cl_img_blur_v, 0, sizeof(cl_mem), &p->cur);
+	err |= clSetKernelArg(cl_img_blur_v, 1, sizeof(cl_mem), &tmp);
+	err |= clSetKernelArg(cl_img_blur_v, 2, sizeof(cl_mem), &out);
+	err |= clSetKernelArg(cl_img_blur_v, 3, sizeof(cl_mem), &wt_buf);
+	err |= clSetKernelArg(cl_img_blur_v, 4, sizeof(cl_int), &radius);
+	err |= clSetKernelArg(cl_img_blur_v, 5, sizeof(cl_int), &p->w);
+	err |= clSetKernelArg(cl_img_blur_v, 6, sizeof(cl_int), &p->h);
+	err |= clSetKernelArg(cl_img_blur_v, 7, sizeof(cl_int), &p->pitch);
+	err |= clSetKernelArg(cl_img_blur_v, 8, sizeof(cl_int), &opitch);
+	err |= clSetKernelArg(cl_img_blur_v, 9, sizeof(cl_int), &border);
+
+	if (err != CL_SUCCESS) {
+		fprintf(stderr, "error: clSetKernelArg() %d %s\n", err, cl_strerror(err));
+		exit(EXIT_FAILURE);
+	}
+
+	global_wblur[0] = p->h;
+	global_wblur[1] = p->w;
+	local = cltune_local(p->rt, p->queue, cl_img_blur_h, "cl_img_blur_h", 2, global_wblur, local_wblur,
+			     FALSE);
+
+	err = clEnqueueNDRangeKernel(p->queue, cl_img_blur_h, 2, NULL, global_wblur, local,
+				     pipe_nwait(p), pipe_wait(p), &ev);
+	if (err != CL_SUCCESS) {
+		fprintf(stderr, "error: clEnqueueNDRangeKernel() blur_h %d %s\n", err, cl_strerror(err));
+		exit(EXIT_FAILURE);
+	}
+	pipe_advance(p, ev, "cl_img_blur_h");
+
+	global_wblur[0] = p->h;
+	global_wblur[1] = p->w;
+	local = cltune_local(p->rt, p->queue, cl_img_blur_v, "cl_img_blur_v", 2, global_wblur, local_wblur,
+			     FALSE);
+
+	err = clEnqueueNDRangeKernel(p->queue, cl_img_blur_v, 2, NULL, global_wblur, local,
+				     pipe_nwait(p), pipe_wait(p), &ev);
+	if (err != CL_SUCCESS) {
+		fprintf(stderr, "error: clEnqueueNDRangeKernel() blur_v %d %s\n", err, cl_strerror(err));
+		exit(EXIT_FAILURE);
+	}
+
+	pipe_buf_put(p, tmp);
+	pipe_buf_put(p, p->cur);
+	p->cur = out;
+	p->pitch = opitch;
+	pipe_advance(p, ev, "cl_img_blur_v");
+}
+
+/* separable mask of `st' in a horizontal and a vertical pass */
+static void stage_conv_sep(struct xcl_pipe *p, struct stage *st)
+{
+	const struct conv *c;
+	cl_kernel cl_img_conv_h, cl_img_conv_v;
+	cl_mem tmp, out, row_buf, col_buf;
+	cl_event ev;
+	cl_int err;
+	size_t global[2], local_ws[2];
+	const size_t *local;
+	char name[64];
+	size_t len;
+	int opitch, border;
+
+	c = st->conv;
+	len = (size_t)p->w*p->h;
+	border = st->border;
+	err = 0;
+
+	snprintf(name, sizeof(name), "%s:row", c->key);
+	row_buf = clrt_const(p->rt, name, c->row, c->w*sizeof(cl_float));
+	snprintf(name, sizeof(name), "%s:col", c->key);
+	col_buf = clrt_const(p->rt, name, c->col, c->h*sizeof(cl_float));
+
+	cl_img_conv_h = clrt_kernel(p->rt, "cl_img_conv_h");
+	cl_img_conv_v = clrt_kernel(p->rt, "cl_img_conv_v");
+
+	tmp = pipe_buf_get(p, len*sizeof(cl_float));
+	out = pipe_out(p, &opitch);
+
+	err |= clSetKernelArg(cl_img_conv_h, 0, sizeof(cl_mem), &p->cur);
+	err |= clSetKernelArg(cl_img_conv_h, 1, sizeof(cl_mem), &tmp);
+	err |= clSetKernelArg(cl_img_conv_h, 2, sizeof(cl_mem), &row_buf);
+	err |= clSetKernelArg(cl_img_conv_h, 3, sizeof(cl_int), &c->w);
+	err |= clSetKernelArg(cl_img_conv_h, 4, sizeof(cl_int), &p->w);
+	err |= clSetKernelArg(cl_img_conv_h, 5, sizeof(cl_int), &p->h);
+	err |= clSetKernelArg(cl_img_conv_h, 6, sizeof(cl_int), &p->pitch);
+	err |= clSetKernelArg(cl_img_conv_h, 7, sizeof(cl_int), &border);
+
+	err |= clSetKernelArg(cl_img_conv_v, 0, sizeof(cl_mem), &p->cur);
+	err |= clSetKernelArg(cl_img_conv_v, 1, sizeof(cl_mem), &tmp);
+	err |= clSetKernelArg(cl_img_conv_v, 2, sizeof(cl_mem), &out);
+	err |= clSetKernelArg(cl_img_conv_v, 3, sizeof(cl_mem), &col_buf);
+	err |= clSetKernelArg(cl_img_conv_v, 4, sizeof(cl_int), &c->w);
+	err |= clSetKernelArg(cl_img_conv_v, 5, sizeof(cl_int), &c->h);
+	err |= clSetKernelArg(cl_img_conv_v, 6, sizeof(cl_int), &c->div);
+	err |= clSetKernelArg(cl_img_conv_v, 7, sizeof(cl_int), &p->w);
+	err |= clSetKernelArg(cl_img_conv_v, 8, sizeof(cl_int), &p->h);
+	err |= clSetKernelArg(cl_img_conv_v, 9, sizeof(cl_int), &p->pitch);
+	err |= clSetKernelArg(cl_img_conv_v, 10, sizeof(cl_int), &opitch);
+	err |= clSetKernelArg(cl_img_conv_v, 11, sizeof(cl_int), &border);
+
+	if (err != CL_SUCCESS) {
+		fprintf(stderr, "error: clSetKernelArg() %d %s\n", err, cl_strerror(err));
+		exit(EXIT_FAILURE);
+	}
+
+	global[0] = p->h;
+	global[1] = p->w;
+	local = cltune_local(p->rt, p->queue, cl_img_conv_h, "cl_img_conv_h", 2, global, local_ws, TRUE);
+
+	err = clEnqueueNDRangeKernel(p->queue, cl_img_conv_h, 2, NULL, global, local,
+				     pipe_nwait(p), pipe_wait(p), &ev);
+	if (err != CL_SUCCESS) {
+		fprintf(stderr, "error: clEnqueueNDRangeKernel() conv_h %d %s\n", err, cl_strerror(err));
+		exit(EXIT_FAILURE);
+	}
+	pipe_advance(p, ev, "cl_img_conv_h");
+
+	global[0] = p->h;
+	global[1] = p->w;
+	local = cltune_local(p->rt, p->queue, cl_img_conv_v, "cl_img_conv_v", 2, global, local_ws, TRUE);
+
+	err = clEnqueueNDRangeKernel(p->queue, cl_img_conv_v, 2, NULL, global, local,
+				     pipe_nwait(p), pipe_wait(p), &ev);
+	if (err != CL_SUCCESS) {
+		fprintf(stderr, "error: clEnqueueNDRangeKernel() conv_v %d %s\n", err, cl_strerror(err));
+		exit(EXIT_FAILURE);
+	}
+
+	pipe_buf_put(p, tmp);
+	pipe_buf_put(p, p->cur);
+	p->cur = out;
+	p->pitch = opitch;
+	pipe_advance(p, ev, "cl_img_conv_v");
+}
+
+/*
+ * Any mask: separable ones in two passes, others from constant memory,
+ * masks of more than CONV_CONST_MAX weights from local memory tiles if
+ * the tile fits. VARIANT_NAIVE and VARIANT_TILED force the 2D kernels.
+ */
+static void stage_convolve(struct xcl_pipe *p, struct stage *st)
+{
+	const struct conv *c;
+	cl_kernel cl_img_conv;
+	cl_mem out, wt_buf;
+	const char *name;
+	cl_event ev;
+	cl_int err;
+	size_t global[2], local_ws[3], tile;
+	const size_t *local;
+	int opitch, border, tiled;
+
+	if (p->type != TYPE_GRAY) {
+		fprintf(stderr, "error: convolve stage needs a grayscale image\n");
+		exit(EXIT_FAILURE);
+	}
+
+	c = st->conv;
+	if (c->separable && st->variant == VARIANT_AUTO) {
+		stage_conv_sep(p, st);
+		return;
+	}
+
+	border = st->border;
+	tiled = st->variant == VARIANT_TILED || (st->variant == VARIANT_AUTO && c->w*c->h > CONV_CONST_MAX);
+	tile = 0;
+
+	if (tiled) {
+		cl_img_conv = clrt_kernel(p->rt, "cl_img_conv_tiled");
+		tile_local(p, cl_img_conv, "cl_img_conv_tiled", local_ws);
+		tile = (local_ws[0] + c->h - 1)*(local_ws[1] + c->w - 1);
+		if (tile > p->rt->local_mem)
+			tiled = FALSE;
+	}
+
+	name = tiled ? "cl_img_conv_tiled" : "cl_img_conv";
+	cl_img_conv = clrt_kernel(p->rt, name);
+	wt_buf = clrt_const(p->rt, c->key, c->wt, c->w*c->h*sizeof(cl_float));
+	out = pipe_out(p, &opitch);
+
+	err = 0;
+	err |= clSetKernelArg(cl_img_conv, 0, sizeof(cl_mem), &p->cur);
+	err |= clSetKernelArg(cl_img_conv, 1, sizeof(cl_mem), &out);
+	err |= clSetKernelArg(cl_img_conv, 2, sizeof(cl_mem), &wt_buf);
+	err |= clSetKernelArg(cl_img_conv, 3, sizeof(cl_int), &c->w);
+	err |= clSetKernelArg(cl_img_conv, 4, sizeof(cl_int), &c->h);
+	err |= clSetKernelArg(cl_img_conv, 5, sizeof(cl_int), &c->div);
+	err |= clSetKernelArg(cl_img_conv, 6, sizeof(cl_int), &p->w);
+	err |= clSetKernelArg(cl_img_conv, 7, sizeof(cl_int), &p->h);
+	err |= clSetKernelArg(cl_img_conv, 8, sizeof(cl_int), &p->pitch);
+	err |= clSetKernelArg(cl_img_conv, 9, sizeof(cl_int), &opitch);
+	err |= clSetKernelArg(cl_img_conv, 10, sizeof(cl_int), &border);
+	if (tiled)
+		err |= clSetKernelArg(cl_img_conv, 11, tile, NULL);
+
+	if (err != CL_SUCCESS) {
+		fprintf(stderr, "error: clSetKernelArg() %d %s\n", err, cl_strerror(err));
+		exit(EXIT_FAILURE);
+	}
+
+	global[0] = p->h;
+	global[1] = p->w;
+
+	if (tiled) {
+		/* whole tiles, the kernel skips work-items outside the image */
+		global[0] = (p->h + local_ws[0] - 1)/local_ws[0]*local_ws[0];
+		global[1] = (p->w + local_ws[1] - 1)/local_ws[1]*local_ws[1];
+		local = local_ws;
+	} else {
+		local = cltune_local(p->rt, p->queue, cl_img_conv, name, 2, global, local_ws, TRUE);
+	}
+
+	err = clEnqueueNDRangeKernel(p->queue, cl_img_conv, 2, NULL, global, local,
+				     pipe_nwait(p), pipe_wait(p), &ev);
+	if (err != CL_SUCCESS) {
+		fprintf(stderr, "error: clEnqueueNDRangeKernel() conv %d %s\n", err, cl_strerror(err));
+		exit(EXIT_FAILURE);
+	}
+
+	pipe_buf_put(p, p->cur);
+	p->cur = out;
+	p->pitch = opitch;
+	pipe_advance(p, ev, name);
+}
+
+/* hysteresis passes queued per tile along the width and the height */
+#define CANNY_TILE_PASSES 2
+
+static void stage_canny(struct xcl_pipe *p, struct stage *st)
+{
+	static const cl_int zero = 0;
+	cl_kernel cl_img_sobel, cl_img_nms, cl_img_hysteresis, cl_img_edges_final;
+	cl_mem gmag, gdir, changed, out;
+	cl_event ev;
+	cl_int err;
+	cl_uint low, high;
+	size_t global_work_size[2], local_work_size[2], hglobal[2], hlocal[3];
+	const size_t *local;
+	size_t len;
+	int opitch, i, passes;
+
+	if (p->type != TYPE_GRAY) {
+		fprintf(stderr, "error: canny stage needs a grayscale image\n");
+		exit(EXIT_FAILURE);
+	}
+
+	len = (size_t)p->w*p->h;
+	low = st->low > 0 ? st->low : CANNY_LOW;
+	high = st->high > 0 ? st->high : CANNY_HIGH;
+	err = 0;
+
+	cl_img_sobel = clrt_kernel(p->rt, "cl_img_sobel");
+	cl_img_nms = clrt_kernel(p->rt, "cl_img_nms");
+	cl_img_hysteresis = clrt_kernel(p->rt, "cl_img_hysteresis");
+	cl_img_edges_final = clrt_kernel(p->rt, "cl_img_edges_final");
+
+	gmag = pipe_buf_get(p, len*sizeof(cl_uint));
+	gdir = pipe_buf_get(p, len*sizeof(cl_int));
+	tile_local(p, cl_img_hysteresis, "cl_img_hysteresis", hlocal);
+	hglobal[0] = (p->h + hlocal[0] - 1)/hlocal[0]*hlocal[0];
+	hglobal[1] = (p->w + hlocal[1] - 1)/hlocal[1]*hlocal[1];
+	passes = CANNY_TILE_PASSES*(hglobal[0]/hlocal[0] + hglobal[1]/hlocal[1]);
+
+	changed = pipe_buf_get(p, passes*sizeof(cl_int));
+	/* the edge map is built in place in the output */
+	out = pipe_out(p, &opitch);
+
+	err |= clSetKernelArg(cl_img_sobel, 0, sizeof(cl_mem), &p->cur);
+	err |= clSetKernelArg(cl_img_sobel, 1, sizeof(cl_mem), &gmag);
+	err |= clSetKernelArg(cl_img_sobel, 2, sizeof(cl_mem), &gdir);
+	err |= clSetKernelArg(cl_img_sobel, 3, sizeof(cl_int), &p->w);
+	err |= clSetKernelArg(cl_img_sobel, 4, sizeof(cl_int), &p->h);
+	err |= clSetKernelArg(cl_img_sobel, 5, sizeof(cl_int), &p->pitch);
+
+	err |= clSetKernelArg(cl_img_nms, 0, sizeof(cl_mem), &gmag);
+	err |= clSetKernelArg(cl_img_nms, 1, sizeof(cl_mem), &gdir);
+	err |= clSetKernelArg(cl_img_nms, 2, sizeof(cl_mem), &out);
+	err |= clSetKernelArg(cl_img_nms, 3, sizeof(cl_int), &p->w);
+	err |= clSetKernelArg(cl_img_nms, 4, sizeof(cl_int), &p->h);
+	err |= clSetKernelArg(cl_img_nms, 5, sizeof(cl_int), &opitch);
+	err |= clSetKernelArg(cl_img_nms, 6, sizeof(cl_uint), &low);
+	err |= clSetKernelArg(cl_img_nms, 7, sizeof(cl_uint), &high);
+
+	err |= clSetKernelArg(cl_img_hysteresis, 0, sizeof(cl_mem), &out);
+	err |= clSetKernelArg(cl_img_hysteresis, 1, sizeof(cl_int), &p->w);
+	err |= clSetKernelArg(cl_img_hysteresis, 2, sizeof(cl_int), &p->h);
+	err |= clSetKernelArg(cl_img_hysteresis, 3, sizeof(cl_int), &opitch);
+	err |= clSetKernelArg(cl_img_hysteresis, 4, sizeof(cl_mem), &changed);
+
+	err |= clSetKernelArg(cl_img_edges_final, 0, sizeof(cl_mem), &out);
+	err |= clSetKernelArg(cl_img_edges_final, 1, sizeof(cl_int), &p->w);
+	err |= clSetKernelArg(cl_img_edges_final, 2, sizeof(cl_int), &p->h);
+	err |= clSetKernelArg(cl_img_edges_final, 3, sizeof(cl_int), &opitch);
+
+	if (err != CL_SUCCESS) {
+		fprintf(stderr, "error: clSetKernelArg() %d %s\n", err, cl_strerror(err));
+		exit(EXIT_FAILURE);
+	}
+
+	global_work_size[0] = p->h;
+	global_work_size[1] = p->w;
+	local = cltune_local(p->rt, p->queue, cl_img_sobel, "cl_img_sobel", 2, global_work_size,
+			     local_work_size, FALSE);
+
+	err = clEnqueueNDRangeKernel(p->queue, cl_img_sobel, 2, NULL, global_work_size, local,
+				     pipe_nwait(p), pipe_wait(p), &ev);
+	if (err != CL_SUCCESS) {
+		fprintf(stderr, "error: clEnqueueNDRangeKernel() sobel %d %s\n", err, cl_strerror(err));
+		exit(EXIT_FAILURE);
+	}
+	pipe_advance(p, ev, "cl_img_sobel");
+
+	global_work_size[0] = p->h;
+	global_work_size[1] = p->w;
+	local = cltune_local(p->rt, p->queue, cl_img_nms, "cl_img_nms", 2, global_work_size,
+			     local_work_size, FALSE);
+
+	err = clEnqueueNDRangeKernel(p->queue, cl_img_nms, 2, NULL, global_work_size, local,
+				     pipe_nwait(p), pipe_wait(p), &ev);
+	if (err != CL_SUCCESS) {
+		fprintf(stderr, "error: clEnqueueNDRangeKernel() nms %d %s\n", err, cl_strerror(err));
+		exit(EXIT_FAILURE);
+	}
+	pipe_advance(p, ev, "cl_img_nms");
+
+	/*
+	 * A fixed number of passes is queued and the host never waits on
+	 * them: each has its own flag, cleared on the device up front, and
+	 * the passes after one that changed nothing return at once. Edges
+	 * winding through more tiles than that stay weak and are dropped,
+	 * xcl_pipe_finish() warns about it from the flag of the last pass.
+	 */
+	err = clEnqueueFillBuffer(p->queue, changed, &zero, sizeof(zero), 0, passes*sizeof(cl_int),
+				  pipe_nwait(p), pipe_wait(p), &ev);
+	if (err != CL_SUCCESS) {
+		fprintf(stderr, "error: clEnqueueFillBuffer() %d %s\n", err, cl_strerror(err));
+		exit(EXIT_FAILURE);
+	}
+	pipe_advance(p, ev, "fill");
+
+	for (i = 0; i < passes; i++) {
+		err = clSetKernelArg(cl_img_hysteresis, 5, sizeof(cl_int), &i);
+		if (err != CL_SUCCESS) {
+			fprintf(stderr, "error: clSetKernelArg() %d %s\n", err, cl_strerror(err));
+			exit(EXIT_FAILURE);
+		}
+
+		err = clEnqueueNDRangeKernel(p->queue, cl_img_hysteresis, 2, NULL, hglobal, hlocal,
+					     pipe_nwait(p), pipe_wait(p), &ev);
+		if (err != CL_SUCCESS) {
+			fprintf(stderr, "error: clEnqueueNDRangeKernel() hysteresis %d %s\n", err, cl_strerror(err));
+			exit(EXIT_FAILURE);
+		}
+		pipe_advance(p, ev, "cl_img_hysteresis");
+	}
+
+	err = clEnqueueReadBuffer(p->queue, changed, CL_FALSE, (passes - 1)*sizeof(cl_int), sizeof(cl_int),
+				  &p->unsettled, pipe_nwait(p), pipe_wait(p), &ev);
+	if (err != CL_SUCCESS) {
+		fprintf(stderr, "error: clEnqueueReadBuffer() %d %s\n", err, cl_strerror(err));
+		exit(EXIT_FAILURE);
+	}
+	pipe_advance(p, ev, "download");
+
+	global_work_size[0] = p->h;
+	global_work_size[1] = p->w;
+	local = cltune_local(p->rt, p->queue, cl_img_edges_final, "cl_img_edges_final", 2, global_work_size,
+			     local_work_size, FALSE);
+
+	err = clEnqueueNDRangeKernel(p->queue, cl_img_edges_final, 2, NULL, global_work_size, local,
+				     pipe_nwait(p), pipe_wait(p), &ev);
+	if (err != CL_SUCCESS) {
+		fprintf(stderr, "error: clEnqueueNDRangeKernel() edges %d %s\n", err, cl_strerror(err));
+		exit(EXIT_FAILURE);
+	}
+
+	pipe_buf_put(p, gmag);
+	pipe_buf_put(p, gdir);
+	pipe_buf_put(p, changed);
+	pipe_buf_put(p, p->cur);
+	p->cur = out;
+	p->pitch = opitch;
+	pipe_advance(p, ev, "cl_img_edges_final");
+}
+
+/* work-groups per compute unit of the histogram */
+#define HIST_GROUPS_CU 4
+
+/* largest power of two work-group up to one item per bin both Otsu kernels take */
+static size_t otsu_local(struct xcl_pipe *p, cl_kernel k0, cl_kernel k1)
+{
+	size_t kmax[2], local;
+	cl_int err;
+
+	err = clGetKernelWorkGroupInfo(k0, p->rt->device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(kmax[0]),
+				       &kmax[0], NULL);
+	err |= clGetKernelWorkGroupInfo(k1, p->rt->device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(kmax[1]),
+					&kmax[1], NULL);
+	if (err != CL_SUCCESS) {
+		fprintf(stderr, "error: clGetKernelWorkGroupInfo() %d %s\n", err, cl_strerror(err));
+		exit(EXIT_FAILURE);
+	}
+
+	for (local = 256; local > kmax[0] || local > kmax[1]; local >>= 1)
+		;
+
+	return local;
+}
+
+/* the threshold is computed and applied on the device, never read back */
+static void stage_otsu(struct xcl_pipe *p)
+{
+	static const cl_uint zero = 0;
+	cl_kernel cl_img_histogram, cl_img_otsu, cl_img_binarize;
+	cl_mem hist, thresh, out;
+	cl_event ev;
+	cl_int err;
+	cl_uint w, h, pitch;
+	size_t len, global_work_size, local_work_size, ngroups, bglobal[2], blocal[2];
+	const size_t *local;
+	int opitch;
+
+	if (p->type != TYPE_GRAY) {
+		fprintf(stderr, "error: otsu stage needs a grayscale image\n");
+		exit(EXIT_FAILURE);
+	}
+
+	w = p->w;
+	h = p->h;
+	pitch = p->pitch;
+	len = (size_t)w*h;
+	err = 0;
+
+	/* the bins are 32 bit */
+	if (len > CL_UINT_MAX) {
+		fprintf(stderr, "error: otsu stage takes at most %u pixels\n", CL_UINT_MAX);
+		exit(EXIT_FAILURE);
+	}
+
+	cl_img_histogram = clrt_kernel(p->rt, "cl_img_histogram");
+	cl_img_otsu = clrt_kernel(p->rt, "cl_img_otsu");
+	cl_img_binarize = clrt_kernel(p->rt, "cl_img_binarize");
+
+	hist = pipe_buf_get(p, 256*sizeof(cl_uint));
+	thresh = pipe_buf_get(p, sizeof(cl_uint));
+	out = pipe_out(p, &opitch);
+
+	err |= clSetKernelArg(cl_img_histogram, 0, sizeof(cl_mem), &p->cur);
+	err |= clSetKernelArg(cl_img_histogram, 1, sizeof(cl_uint), &w);
+	err |= clSetKernelArg(cl_img_histogram, 2, sizeof(cl_uint), &h);
+	err |= clSetKernelArg(cl_img_histogram, 3, sizeof(cl_uint), &pitch);
+	err |= clSetKernelArg(cl_img_histogram, 4, sizeof(cl_mem), &hist);
+
+	err |= clSetKernelArg(cl_img_otsu, 0, sizeof(cl_mem), &hist);
+	err |= clSetKernelArg(cl_img_otsu, 1, sizeof(cl_mem), &thresh);
+
+	err |= clSetKernelArg(cl_img_binarize, 0, sizeof(cl_mem), &p->cur);
+	err |= clSetKernelArg(cl_img_binarize, 1, sizeof(cl_mem), &out);
+	err |= clSetKernelArg(cl_img_binarize, 2, sizeof(cl_int), &p->w);
+	err |= clSetKernelArg(cl_img_binarize, 3, sizeof(cl_int), &p->h);
+	err |= clSetKernelArg(cl_img_binarize, 4, sizeof(cl_int), &p->pitch);
+	err |= clSetKernelArg(cl_img_binarize, 5, sizeof(cl_int), &opitch);
+	err |= clSetKernelArg(cl_img_binarize, 6, sizeof(cl_mem), &thresh);
+
+	if (err != CL_SUCCESS) {
+		fprintf(stderr, "error: clSetKernelArg() %d %s\n", err, cl_strerror(err));
+		exit(EXIT_FAILURE);
+	}
+
+	err = clEnqueueFillBuffer(p->queue, hist, &zero, sizeof(zero), 0, 256*sizeof(cl_uint),
+				  pipe_nwait(p), pipe_wait(p), &ev);
+	if (err != CL_SUCCESS) {
+		fprintf(stderr, "error: clEnqueueFillBuffer() %d %s\n", err, cl_strerror(err));
+		exit(EXIT_FAILURE);
+	}
+	pipe_advance(p, ev, "fill");
+
+	/* enough groups to fill the device, each loops over the image */
+	local_work_size = otsu_local(p, cl_img_histogram, cl_img_otsu);
+	ngroups = (len + local_work_size - 1)/local_work_size;
+	if (ngroups > p->rt->ncu*HIST_GROUPS_CU)
+		ngroups = p->rt->ncu*HIST_GROUPS_CU;
+	global_work_size = ngroups*local_work_size;
+
+	err = clEnqueueNDRangeKernel(p->queue, cl_img_histogram, 1, NULL, &global_work_size,
+				     &local_work_size, pipe_nwait(p), pipe_wait(p), &ev);
+	if (err != CL_SUCCESS) {
+		fprintf(stderr, "error: clEnqueueNDRangeKernel() histogram %d %s\n", err, cl_strerror(err));
+		exit(EXIT_FAILURE);
+	}
+	pipe_advance(p, ev, "cl_img_histogram");
+
+	global_work_size = local_work_size;
+	err = clEnqueueNDRangeKernel(p->queue, cl_img_otsu, 1, NULL, &global_work_size,
+				     &local_work_size, pipe_nwait(p), pipe_wait(p), &ev);
+	if (err != CL_SUCCESS) {
+		fprintf(stderr, "error: clEnqueueNDRangeKernel() otsu %d %s\n", err, cl_strerror(err));
+		exit(EXIT_FAILURE);
+	}
+	pipe_advance(p, ev, "cl_img_otsu");
+
+	bglobal[0] = p->h;
+	bglobal[1] = p->w;
+	local = cltune_local(p->rt, p->queue, cl_img_binarize, "cl_img_binarize", 2, bglobal, blocal, FALSE);
+	err = clEnqueueNDRangeKernel(p->queue, cl_img_binarize, 2, NULL, bglobal, local,
+				     pipe_nwait(p), pipe_wait(p), &ev);
+	if (err != CL_SUCCESS) {
+		fprintf(stderr, "error: clEnqueueNDRangeKernel() binarize %d %s\n", err, cl_strerror(err));
+		exit(EXIT_FAILURE);
+	}
+
+	pipe_buf_put(p, hist);
+	pipe_buf_put(p, thresh);
+	pipe_buf_put(p, p->cur);
+	p->cur = out;
+	p->pitch = opitch;
+	pipe_advance(p, ev, "cl_img_binarize");
+}
+
+static void pipe_stage_once(struct xcl_pipe *p, struct stage *st)
+{
+	switch (st->type) {
+	case STAGE_GRAYSCALE:
+		stage_grayscale(p, st);
+		break;
+	case STAGE_GAUSSIAN_BLUR:
+		if (st->sigma > 0)
+			stage_gaussian_sep(p, st);
+		else
+			stage_gaussian_blur(p, st);
+		break;
+	case STAGE_CANNY:
+		stage_canny(p, st);
+		break;
+	case STAGE_OTSU:
+		stage_otsu(p);
+		break;
+	case STAGE_CONVOLVE:
+		stage_convolve(p, st);
+		break;
+	default:
+		fprintf(stderr, "error: unknown stage %d\n", st->type);
+		abort();
+	}
+}
+
+/*
+ * Passes of a repeated filter ping-pong between two pool buffers on the
+ * device, each stage gives its input back once its kernel is queued.
+ * Only the last pass may write to the caller's image or its pitch.
+ */
+void xcl_pipe_stage(struct xcl_pipe *p, struct stage *st)
+{
+	cl_mem target;
+	int i, passes, pitch;
+
+	assert(p != NULL);
+	assert(st != NULL);
+	assert(p->cur != NULL);
+
+	passes = stage_passes(st);
+	target = p->target;
+	pitch = p->target_pitch;
+	p->target = NULL;
+	p->target_pitch = 0;
+
+	for (i = 0; i < passes - 1; i++)
+		pipe_stage_once(p, st);
+
+	p->target = target;
+	p->target_pitch = pitch;
+	pipe_stage_once(p, st);
+}
+
+/*
+ * Let the next stage write rows at the pitch of `dst', so they read back
+ * in one piece, and write straight into `dst' where it can be wrapped:
+ * on zero-copy devices, and for views on any device, which would take a
+ * rectangle copy otherwise. Not done for in-place processing, a kernel
+ * must not read its output.
+ */
+void xcl_pipe_target(struct xcl_pipe *p, struct img_ctx *dst)
+{
+	assert(p != NULL);
+	assert(dst != NULL);
+
+	if (dst->type != TYPE_GRAY)
+		return;
+
+	p->target_pitch = dst->pitch;
+
+	if (!p->rt->zero_copy && (img_compact(dst) || !(dst->flags & IMG_F_FOREIGN)))
+		return;
+
+	if (p->src != NULL && p->src->pix == dst->pix)
+		return;
+
+	p->target = p->dst_mem = pipe_wrap(p, dst->pix, pipe_block(dst));
+}
+
+/* rows of the next stage's output `pitch' bytes apart, e.g. those of the image a band goes to */
+void xcl_pipe_target_pitch(struct xcl_pipe *p, int pitch)
+{
+	assert(p != NULL);
+	assert(pitch >= p->w);
+
+	p->target_pitch = pitch;
+}
+
+/* the read is not blocking, `dst' is valid after xcl_pipe_finish() */
+void xcl_pipe_download(struct xcl_pipe *p, struct img_ctx *dst)
+{
+	cl_event ev;
+	cl_int err;
+
+	assert(p != NULL);
+	assert(dst != NULL);
+
+	if (dst->type != p->type || dst->w != p->w || dst->h != p->h) {
+		fprintf(stderr, "error: output image does not match pipeline result\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (p->type != TYPE_GRAY) {
+		fprintf(stderr, "error: not implemented\n");
+		abort();
+	}
+
+	/* the result is already in `dst', mapping only synchronises */
+	if (p->cur == p->dst_mem) {
+		p->mapped = clEnqueueMapBuffer(p->queue, p->cur, CL_FALSE, CL_MAP_READ, 0, pipe_block(dst),
+					       pipe_nwait(p), pipe_wait(p), &ev, &err);
+		if (err != CL_SUCCESS) {
+			fprintf(stderr, "error: clEnqueueMapBuffer() %d %s\n", err, cl_strerror(err));
+			exit(EXIT_FAILURE);
+		}
+		p->mapped_dst = dst;
+		pipe_advance(p, ev, "map");
+		return;
+	}
+
+	err = pipe_read_rows(p, dst, 0, 0, p->h, &ev);
+	if (err != CL_SUCCESS) {
+		fprintf(stderr, "error: clEnqueueReadBuffer() %d %s\n", err, cl_strerror(err));
+		exit(EXIT_FAILURE);
+	}
+
+	pipe_advance(p, ev, "download");
+}
+
+/*
+ * Read rows [skip, skip + rows) of the result into rows from `y0' on of
+ * `dst', for bands of a larger image. Not blocking either.
+ */
+void xcl_pipe_download_rows(struct xcl_pipe *p, struct img_ctx *dst, int skip, int y0, int rows)
+{
+	cl_event ev;
+	cl_int err;
+
+	assert(p != NULL);
+	assert(dst != NULL);
+	assert(skip >= 0 && skip + rows <= p->h);
+	assert(y0 >= 0 && y0 + rows <= dst->h);
+
+	if (p->type != TYPE_GRAY || dst->type != TYPE_GRAY || dst->w != p->w) {
+		fprintf(stderr, "error: output image does not match pipeline result\n");
+		exit(EXIT_FAILURE);
+	}
+
+	err = pipe_read_rows(p, dst, skip, y0, rows, &ev);
+	if (err != CL_SUCCESS) {
+		fprintf(stderr, "error: clEnqueueReadBuffer() %d %s\n", err, cl_strerror(err));
+		exit(EXIT_FAILURE);
+	}
+
+	pipe_advance(p, ev, "download");
+}
+
+/* wait for the pass and return its buffers to the runtime pool */
+void xcl_pipe_finish(struct xcl_pipe *p)
+{
+	struct img_ctx *d;
+	cl_int err;
+	int i, y;
+
+	assert(p != NULL);
+
+	pipe_prof_drain(p);
+
+	if (p->ev != NULL) {
+		err = clWaitForEvents(1, &p->ev);
+		if (err != CL_SUCCESS) {
+			fprintf(stderr, "error: clWaitForEvents() %d %s\n", err, cl_strerror(err));
+			exit(EXIT_FAILURE);
+		}
+		clReleaseEvent(p->ev);
+		p->ev = NULL;
+	}
+
+	if (p->unsettled) {
+		fprintf(stderr, "warning: canny hysteresis did not settle, long edges may be cut short\n");
+		p->unsettled = 0;
+	}
+
+	if (p->mapped != NULL) {
+		/* maps of USE_HOST_PTR buffers normally return the host pointer */
+		d = p->mapped_dst;
+		if (p->mapped != d->pix) {
+			for (y = 0; y < d->h; y++)
+				memcpy(d->pix + (size_t)y*d->pitch, (unsigned char *)p->mapped + (size_t)y*d->pitch,
+				       d->w);
+		}
+
+		/* not waited for, it would also wait for passes queued after this one */
+		err = clEnqueueUnmapMemObject(p->queue, p->dst_mem, p->mapped, 0, NULL, NULL);
+		if (err != CL_SUCCESS) {
+			fprintf(stderr, "error: clEnqueueUnmapMemObject() %d %s\n", err, cl_strerror(err));
+			exit(EXIT_FAILURE);
+		}
+		p->mapped = NULL;
+	}
+
+	for (i = 0; i < p->nbufs; i++)
+		clrt_buf_put(p->rt, p->bufs[i].mem);
+
+	for (i = 0; i < p->nwrapped; i++)
+		clReleaseMemObject(p->wrapped[i]);
+
+	if (p->image != NULL)
+		clrt_image_put(p->rt, p->image);
+
+	p->nbufs = 0;
+	p->nwrapped = 0;
+	p->cur = NULL;
+	p->src = NULL;
+	p->target = NULL;
+	p->target_pitch = 0;
+	p->dst_mem = NULL;
+	p->mapped_dst = NULL;
+	p->image = NULL;
+}
+
+/*
+ * Queue the whole pipeline without waiting. p->ev completes when `dst'
+ * is ready; `src' and `dst' must stay valid until xcl_pipe_finish().
+ */
+void xcl_pipeline_enqueue(struct xcl_pipe *p, struct pipeline *pl, struct img_ctx *src,
+			  struct img_ctx *dst)
+{
+	int i;
+
+	assert(p != NULL);
+	assert(pl != NULL);
+
+	xcl_pipe_upload(p, src);
+
+	for (i = 0; i < pl->nstages; i++) {
+		if (i == pl->nstages - 1)
+			xcl_pipe_target(p, dst);
+		xcl_pipe_stage(p, &pl->stages[i]);
+	}
+
+	xcl_pipe_download(p, dst);
+}
+
+void xcl_pipeline_run(struct clrt *rt, struct pipeline *pl, struct img_ctx *src, struct img_ctx *dst)
+{
+	struct xcl_pipe p;
+
+	xcl_pipe_init(&p, rt, rt->queue);
+	xcl_pipeline_enqueue(&p, pl, src, dst);
+	xcl_pipe_finish(&p);
+}
+
+static void run_single(struct clrt *rt, stage_type_t type, struct img_ctx *src, struct img_ctx *dst)
+{
+	struct pipeline *pl;
+
+	pl = pipeline_new();
+	pipeline_add(pl, type);
+	xcl_pipeline_run(rt, pl, src, dst);
+	pipeline_destroy(pl);
+}
+
+void xcl_img_grayscale(struct clrt *rt, struct img_ctx *rgb, struct img_ctx *gray)
+{
+	assert(rgb != NULL);
+	assert(gray != NULL);
+
+	run_single(rt, STAGE_GRAYSCALE, rgb, gray);
+}
+
+void xcl_img_gaussian_blur(struct clrt *rt, struct img_ctx *gray, struct img_ctx *blur)
+{
+	xcl_img_gaussian_blur_passes(rt, gray, blur, 1);
+}
+
+/* `passes' 5x5 blurs in one upload and download, `blur' may be `gray' */
+void xcl_img_gaussian_blur_passes(struct clrt *rt, struct img_ctx *gray, struct img_ctx *blur, int passes)
+{
+	struct pipeline *pl;
+	struct stage *st;
+
+	assert(gray != NULL);
+	assert(blur != NULL);
+	assert(passes > 0);
+
+	pl = pipeline_new();
+	st = pipeline_add(pl, STAGE_GAUSSIAN_BLUR);
+	st->passes = passes;
+	xcl_pipeline_run(rt, pl, gray, blur);
+	pipeline_destroy(pl);
+}
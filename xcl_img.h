@@ -0,0 +1,86 @@
+#ifndef XCL_IMG_H_
+#define XCL_IMG_H_
+
+#include <CL/cl.h>
+
+#include "img.h"
+#include "clrt.h"
+#include "pipeline.h"
+
+#define XCL_PIPE_MAX_BUFS 8
+#define XCL_PIPE_MAX_WRAPPED 2
+#define XCL_PIPE_MAX_EVENTS 32
+
+/* TILE_SIZE kernels/img.cl is built with without -t */
+#define XCL_TILE_SIZE 16
+
+struct xcl_pipe_buf {
+	cl_mem mem;
+	size_t size;
+	int busy;
+};
+
+/* command of a pass kept for profiling */
+struct xcl_pipe_ev {
+	const char *name;
+	cl_event ev;
+};
+
+/*
+ * One pass of a pipeline over one image. Intermediates stay on the
+ * device in buffers held by the pass and every command waits on the
+ * event of the previous one; only the final plane is read back.
+ */
+struct xcl_pipe {
+	struct clrt *rt;
+	cl_command_queue queue;
+
+	struct xcl_pipe_buf bufs[XCL_PIPE_MAX_BUFS];
+	int nbufs;
+
+	cl_mem cur;		/* device plane(s) produced by the last stage */
+	img_type_t type;	/* layout of cur */
+	int w;
+	int h;
+	int pitch;		/* bytes from a row of cur to the next, of each plane */
+	size_t plane;		/* TYPE_RGB: bytes from a plane of cur to the next */
+	int nchan;
+	cl_event ev;		/* completes when cur is ready */
+	cl_int unsettled;	/* last hysteresis pass changed edges, see stage_canny() */
+	cl_mem image;		/* from clrt_image_get(), for VARIANT_IMAGE */
+
+	/* host images wrapped with CL_MEM_USE_HOST_PTR, in place on zero-copy devices */
+	cl_mem wrapped[XCL_PIPE_MAX_WRAPPED];
+	int nwrapped;
+	struct img_ctx *src;
+	cl_mem target;		/* output of the next stage, if set */
+	int target_pitch;	/* rows of the next stage's output, 0 packed */
+	cl_mem dst_mem;		/* wrapper of the output image */
+	void *mapped;
+	struct img_ctx *mapped_dst;
+
+	/* clrt.profile only */
+	struct xcl_pipe_ev evs[XCL_PIPE_MAX_EVENTS];
+	int nevs;
+};
+
+void xcl_build_options(struct clrt *rt, char *buf, size_t size, int tile);
+
+void xcl_pipe_init(struct xcl_pipe *p, struct clrt *rt, cl_command_queue queue);
+void xcl_pipe_upload(struct xcl_pipe *p, struct img_ctx *src);
+void xcl_pipe_target(struct xcl_pipe *p, struct img_ctx *dst);
+void xcl_pipe_target_pitch(struct xcl_pipe *p, int pitch);
+void xcl_pipe_stage(struct xcl_pipe *p, struct stage *st);
+void xcl_pipe_download(struct xcl_pipe *p, struct img_ctx *dst);
+void xcl_pipe_download_rows(struct xcl_pipe *p, struct img_ctx *dst, int skip, int y0, int rows);
+void xcl_pipe_finish(struct xcl_pipe *p);
+
+void xcl_pipeline_enqueue(struct xcl_pipe *p, struct pipeline *pl, struct img_ctx *src,
+			  struct img_ctx *dst);
+void xcl_pipeline_run(struct clrt *rt, struct pipeline *pl, struct img_ctx *src, struct img_ctx *dst);
+
+void xcl_img_grayscale(struct clrt *rt, struct img_ctx *rgb, struct img_ctx *gray);
+void xcl_img_gaussian_blur(struct clrt *rt, struct img_ctx *gray, struct img_ctx *blur);
+void xcl_img_gaussian_blur_passes(struct clrt *rt, struct img_ctx *gray, struct img_ctx *blur, int passes);
+
+#endif /* XCL_IMG_H_ */
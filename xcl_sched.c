@@ -0,0 +1,269 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include <CL/cl.h>
+
+#include "common.h"
+#include "xcl_sched.h"
+#include "xcl_img.h"
+#include "xcl_stream.h"
+#include "xmalloc.h"
+
+/* takes over the runtimes, each built already */
+struct xcl_sched *xcl_sched_new(struct clrt **rts, int n)
+{
+	struct xcl_sched *s;
+	int i;
+
+	assert(rts != NULL);
+	assert(n > 0);
+
+	s = xmalloc0(sizeof(*s));
+	s->workers = xmalloc0(n*sizeof(*(s->workers)));
+	s->nworkers = n;
+
+	for (i = 0; i < n; i++) {
+		s->workers[i].s = s;
+		s->workers[i].rt = rts[i];
+	}
+
+	pthread_mutex_init(&s->lock, NULL);
+
+	return s;
+}
+
+/* next item for `w', stolen from the fullest worker once its own run is out */
+static int sched_take(struct xcl_worker *w)
+{
+	struct xcl_sched *s;
+	struct xcl_worker *v;
+	int i, n, item;
+
+	s = w->s;
+
+	pthread_mutex_lock(&s->lock);
+
+	if (w->head == w->tail) {
+		v = NULL;
+		for (i = 0; i < s->nworkers; i++) {
+			n = s->workers[i].tail - s->workers[i].head;
+			if (n > 0 && (v == NULL || n > v->tail - v->head))
+				v = &s->workers[i];
+		}
+
+		/* the back half, the owner goes on from the front */
+		if (v != NULL) {
+			n = (v->tail - v->head + 1)/2;
+			w->head = v->tail - n;
+			w->tail = v->tail;
+			v->tail = w->head;
+		}
+	}
+
+	item = w->head < w->tail ? w->head++ : -1;
+
+	pthread_mutex_unlock(&s->lock);
+
+	return item;
+}
+
+static void *sched_worker(void *arg)
+{
+	struct xcl_worker *w;
+	int item;
+
+	w = arg;
+
+	while ((item = sched_take(w)) >= 0) {
+		w->s->fn(w->rt, w->s->arg, item);
+		w->ndone++;
+	}
+
+	return NULL;
+}
+
+/*
+ * Call `fn' for items [0, nitems) spread over the devices, returns when
+ * all are done. The calling thread drives the first device.
+ */
+void xcl_sched_run(struct xcl_sched *s, int nitems, xcl_sched_fn_t fn, void *arg)
+{
+	struct xcl_worker *w;
+	int i;
+
+	assert(s != NULL);
+	assert(fn != NULL);
+
+	s->fn = fn;
+	s->arg = arg;
+
+	for (i = 0; i < s->nworkers; i++) {
+		w = &s->workers[i];
+		w->head = (long)nitems*i/s->nworkers;
+		w->tail = (long)nitems*(i + 1)/s->nworkers;
+		w->ndone = 0;
+	}
+
+	for (i = 1; i < s->nworkers; i++) {
+		if (pthread_create(&s->workers[i].thread, NULL, sched_worker, &s->workers[i]) != 0) {
+			fprintf(stderr, "error: unable to create thread\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	sched_worker(&s->workers[0]);
+
+	for (i = 1; i < s->nworkers; i++)
+		pthread_join(s->workers[i].thread, NULL);
+}
+
+/*
+ * Copy of `pl' that gives the same result on every device: the grayscale
+ * stage would pick the double kernel on some and fixed point on others.
+ */
+struct pipeline *xcl_sched_pipeline(struct pipeline *pl)
+{
+	struct pipeline *copy;
+	struct stage *st;
+	int i;
+
+	assert(pl != NULL);
+
+	copy = pipeline_new();
+
+	for (i = 0; i < pl->nstages; i++) {
+		st = pipeline_add(copy, pl->stages[i].type);
+		*st = pl->stages[i];
+		if (st->type == STAGE_GRAYSCALE && st->variant == VARIANT_AUTO)
+			st->variant = VARIANT_VEC16;
+	}
+
+	return copy;
+}
+
+struct sched_rows {
+	struct pipeline *pl;
+	struct img_ctx *src;
+	struct img_ctx *dst;
+	int step;
+	int halo;
+};
+
+static void sched_band(struct clrt *rt, void *arg, int item)
+{
+	struct sched_rows *r;
+	struct img_ctx band;
+	struct xcl_pipe p;
+	int y, y1;
+
+	r = arg;
+	y = item*r->step;
+	y1 = y + r->step < r->src->h ? y + r->step : r->src->h;
+
+	xcl_pipe_init(&p, rt, rt->queue);
+	xcl_stream_band(&p, r->pl, r->src, &band, r->dst, y, y1, r->halo);
+	xcl_pipe_finish(&p);
+}
+
+/*
+ * Run `pl' over `src' on all devices, in bands with a halo of context
+ * as xcl_stream_run() does; the output does not depend on which device
+ * did which band. Pipelines that cannot be split and images too small
+ * to be worth it run on the first device. `band' > 0 forces the rows per
+ * band, otherwise there are XCL_SCHED_BANDS per device, small enough to
+ * fit on every one of them.
+ */
+void xcl_sched_rows(struct xcl_sched *s, struct pipeline *pl, struct img_ctx *src, struct img_ctx *dst,
+		    int band)
+{
+	struct sched_rows r;
+	int rows, fit, halo, nbands, i;
+
+	assert(s != NULL);
+	assert(pl != NULL);
+	assert(src != NULL);
+	assert(dst != NULL);
+
+	halo = pipeline_halo(pl);
+	if (s->nworkers == 1 || halo < 0) {
+		xcl_stream_run(s->workers[0].rt, pl, src, dst, band);
+		return;
+	}
+
+	if (band > 0) {
+		rows = band;
+		if (rows <= 2*halo) {
+			fprintf(stderr, "error: bands of %d rows leave nothing inside a halo of %d\n",
+				rows, halo);
+			exit(EXIT_FAILURE);
+		}
+	} else {
+		nbands = s->nworkers*XCL_SCHED_BANDS;
+		rows = (src->h + nbands - 1)/nbands;
+		if (rows < XCL_SCHED_MIN_ROWS)
+			rows = XCL_SCHED_MIN_ROWS;
+		rows += 2*halo;
+
+		for (i = 0; i < s->nworkers; i++) {
+			fit = xcl_stream_rows(s->workers[i].rt, pl, src, 0);
+			if (fit > 0 && fit < rows)
+				rows = fit;
+		}
+	}
+
+	r.step = rows - 2*halo;
+	if (r.step >= src->h) {
+		xcl_stream_run(s->workers[0].rt, pl, src, dst, 0);
+		return;
+	}
+
+	if (dst->type != TYPE_GRAY || dst->w != src->w || dst->h != src->h) {
+		fprintf(stderr, "error: output image does not match pipeline result\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (dst->pix == src->pix) {
+		fprintf(stderr, "error: bands cannot be processed in place\n");
+		exit(EXIT_FAILURE);
+	}
+
+	r.pl = xcl_sched_pipeline(pl);
+	r.src = src;
+	r.dst = dst;
+	r.halo = halo;
+
+	xcl_sched_run(s, (src->h + r.step - 1)/r.step, sched_band, &r);
+
+	pipeline_destroy(r.pl);
+}
+
+/* items of the last job per device, e.g. "images" or "bands" */
+void xcl_sched_report(struct xcl_sched *s, FILE *file, const char *what)
+{
+	char *name;
+	int i;
+
+	assert(s != NULL);
+
+	for (i = 0; i < s->nworkers; i++) {
+		name = cl_device_str(s->workers[i].rt->device, CL_DEVICE_NAME);
+		fprintf(file, "  device %d %s: %d %s\n", i, name, s->workers[i].ndone, what);
+		xfree(name);
+	}
+}
+
+void xcl_sched_destroy(struct xcl_sched *s)
+{
+	int i;
+
+	assert(s != NULL);
+
+	for (i = 0; i < s->nworkers; i++)
+		clrt_destroy(s->workers[i].rt);
+
+	pthread_mutex_destroy(&s->lock);
+	xfree(s->workers);
+	xfree(s);
+}
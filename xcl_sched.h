@@ -0,0 +1,56 @@
+#ifndef XCL_SCHED_H_
+#define XCL_SCHED_H_
+
+#include <stdio.h>
+#include <pthread.h>
+
+#include "img.h"
+#include "clrt.h"
+#include "pipeline.h"
+
+/* bands per device a large image is cut into, so faster ones can take more */
+#define XCL_SCHED_BANDS 8
+/* fewer rows than this per band are not worth a transfer of their own */
+#define XCL_SCHED_MIN_ROWS 64
+
+/* process item `item' of a job on the device of `rt' */
+typedef void (*xcl_sched_fn_t)(struct clrt *rt, void *arg, int item);
+
+struct xcl_sched;
+
+/* one device and the items of the current job it still owns */
+struct xcl_worker {
+	struct xcl_sched *s;
+	struct clrt *rt;
+	pthread_t thread;
+	int head;		/* next item to take */
+	int tail;		/* one past the last one */
+	int ndone;		/* items of the last job done here */
+};
+
+/*
+ * Runs jobs of independent items (images of a batch, bands of an image)
+ * on several devices, one host thread each. Every device starts with an
+ * equal run of items and, once out of work, steals the back half of the
+ * run with the most left, so faster devices end up doing more.
+ */
+struct xcl_sched {
+	struct xcl_worker *workers;
+	int nworkers;
+
+	pthread_mutex_t lock;
+
+	/* current job */
+	xcl_sched_fn_t fn;
+	void *arg;
+};
+
+struct xcl_sched *xcl_sched_new(struct clrt **rts, int n);
+void xcl_sched_run(struct xcl_sched *s, int nitems, xcl_sched_fn_t fn, void *arg);
+struct pipeline *xcl_sched_pipeline(struct pipeline *pl);
+void xcl_sched_rows(struct xcl_sched *s, struct pipeline *pl, struct img_ctx *src, struct img_ctx *dst,
+		    int band);
+void xcl_sched_report(struct xcl_sched *s, FILE *file, const char *what);
+void xcl_sched_destroy(struct xcl_sched *s);
+
+#endif /* XCL_SCHED_H_ */
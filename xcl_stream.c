@@ -0,0 +1,158 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+
+#include <CL/cl.h>
+
+#include "xcl_stream.h"
+#include "xcl_img.h"
+
+/* device bytes of one input row */
+static size_t stream_in_row(struct img_ctx *src)
+{
+	switch (src->type) {
+	case TYPE_RGB:
+		return 3*src->pitch;
+	default:
+		return src->pitch;
+	}
+}
+
+/*
+ * Rows per band for running `pl' over `src' on the device, 0 if one pass
+ * over the whole image fits. A row costs the input, two gray planes and
+ * the float plane of the separable blur; the largest of them must stay
+ * under CL_DEVICE_MAX_MEM_ALLOC_SIZE and all bands in flight under half
+ * of the global memory. `band' > 0 forces bands of that many rows.
+ */
+int xcl_stream_rows(struct clrt *rt, struct pipeline *pl, struct img_ctx *src, int band)
+{
+	size_t in_row, row, big;
+	cl_ulong rows;
+	int halo;
+
+	assert(rt != NULL);
+	assert(pl != NULL);
+	assert(src != NULL);
+
+	in_row = stream_in_row(src);
+	row = in_row + 6*src->w;
+	big = in_row > 4*src->w ? in_row : 4*src->w;
+
+	if (band > 0) {
+		rows = band;
+	} else {
+		if (src->h*big <= rt->max_alloc && src->h*row <= rt->global_mem/2)
+			return 0;
+
+		rows = rt->max_alloc/big;
+		if (rows > rt->global_mem/2/(XCL_STREAM_DEPTH*row))
+			rows = rt->global_mem/2/(XCL_STREAM_DEPTH*row);
+	}
+
+	if (rows >= src->h)
+		return 0;
+
+	halo = pipeline_halo(pl);
+	if (halo < 0) {
+		fprintf(stderr, "error: image does not fit on the device and the pipeline "
+			"cannot be split into bands\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (rows <= 2*halo) {
+		fprintf(stderr, "error: bands of %d rows leave nothing inside a halo of %d\n",
+			(int)rows, halo);
+		exit(EXIT_FAILURE);
+	}
+
+	return rows;
+}
+
+/*
+ * Enqueue `pl' over rows [y, y1) of `src' on `p' with up to `halo' rows of
+ * context on both sides, written to the same rows of `dst'. `band' is
+ * the view uploaded and has to live until the pass is finished.
+ */
+void xcl_stream_band(struct xcl_pipe *p, struct pipeline *pl, struct img_ctx *src, struct img_ctx *band,
+		     struct img_ctx *dst, int y, int y1, int halo)
+{
+	int top, bot, n;
+
+	top = y < halo ? y : halo;
+	bot = src->h - y1 < halo ? src->h - y1 : halo;
+
+	img_ctx_band(src, y - top, top + y1 - y + bot, band);
+
+	xcl_pipe_upload(p, band);
+	for (n = 0; n < pl->nstages; n++) {
+		if (n == pl->nstages - 1)
+			xcl_pipe_target_pitch(p, dst->pitch);
+		xcl_pipe_stage(p, &pl->stages[n]);
+	}
+	xcl_pipe_download_rows(p, dst, top, y, y1 - y);
+}
+
+/*
+ * Run `pl' over horizontal bands of `src', each with `halo' rows of
+ * context on both sides that are computed and dropped. Bands alternate
+ * between the queues of `rt', so the upload of one band overlaps the
+ * kernels and the download of the one before. Device memory is bounded
+ * by the band size. Falls back to a single pass if the image fits.
+ */
+void xcl_stream_run(struct clrt *rt, struct pipeline *pl, struct img_ctx *src, struct img_ctx *dst,
+		    int band)
+{
+	struct xcl_pipe pipes[XCL_STREAM_DEPTH];
+	struct img_ctx bands[XCL_STREAM_DEPTH];
+	cl_command_queue queues[XCL_STREAM_DEPTH];
+	struct xcl_pipe *p;
+	int rows, halo, step, y, y1, i, k;
+
+	assert(rt != NULL);
+	assert(pl != NULL);
+	assert(src != NULL);
+	assert(dst != NULL);
+
+	rows = xcl_stream_rows(rt, pl, src, band);
+	if (rows == 0) {
+		xcl_pipeline_run(rt, pl, src, dst);
+		return;
+	}
+
+	if (dst->type != TYPE_GRAY || dst->w != src->w || dst->h != src->h) {
+		fprintf(stderr, "error: output image does not match pipeline result\n");
+		exit(EXIT_FAILURE);
+	}
+
+	/* a band would read rows the one before already wrote */
+	if (dst->pix == src->pix) {
+		fprintf(stderr, "error: bands cannot be processed in place\n");
+		exit(EXIT_FAILURE);
+	}
+
+	halo = pipeline_halo(pl);
+	step = rows - 2*halo;
+
+	queues[0] = rt->queue;
+	queues[1] = rt->queue2;
+
+	for (i = 0; i < XCL_STREAM_DEPTH; i++)
+		xcl_pipe_init(&pipes[i], rt, queues[i]);
+
+	for (y = 0, k = 0; y < src->h; y += step, k++) {
+		i = k%XCL_STREAM_DEPTH;
+		p = &pipes[i];
+
+		/* the last band of this queue must give back its buffers */
+		xcl_pipe_finish(p);
+
+		y1 = y + step < src->h ? y + step : src->h;
+		xcl_stream_band(p, pl, src, &bands[i], dst, y, y1, halo);
+
+		clFlush(p->queue);
+	}
+
+	for (i = 0; i < XCL_STREAM_DEPTH; i++)
+		xcl_pipe_finish(&pipes[i]);
+}
@@ -0,0 +1,18 @@
+#ifndef XCL_STREAM_H_
+#define XCL_STREAM_H_
+
+#include "img.h"
+#include "clrt.h"
+#include "pipeline.h"
+#include "xcl_img.h"
+
+/* bands in flight, one per command queue of struct clrt */
+#define XCL_STREAM_DEPTH 2
+
+void xcl_stream_band(struct xcl_pipe *p, struct pipeline *pl, struct img_ctx *src, struct img_ctx *band,
+		     struct img_ctx *dst, int y, int y1, int halo);
+int xcl_stream_rows(struct clrt *rt, struct pipeline *pl, struct img_ctx *src, int band);
+void xcl_stream_run(struct clrt *rt, struct pipeline *pl, struct img_ctx *src, struct img_ctx *dst,
+		    int band);
+
+#endif /* XCL_STREAM_H_ */
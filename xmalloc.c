@@ -29,6 +29,17 @@ void *xmalloc0(size_t size)
 	return ptr;
 }
 
+void *xmemalign(size_t align, size_t size)
+{
+	void *ptr;
+
+	if (posix_memalign(&ptr, align, size) != 0)
+		errx(EXIT_FAILURE, "out of memory allocation %lu bytes",
+							(unsigned long)size);
+
+	return ptr;
+}
+
 void *xrealloc(void *ptr, size_t size)
 {
 	void *p;
@@ -4,6 +4,7 @@
  /* If memory was not allocated, terminate a process. */
 void *xmalloc(size_t size);
 void *xmalloc0(size_t size);
+void *xmemalign(size_t align, size_t size);
 void *xrealloc(void *ptr, size_t size);
 void xfree(void *ptr);
 char *xstrdup(const char *str);